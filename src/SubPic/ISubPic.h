@@ -55,6 +55,85 @@ struct SubPicDesc {
 };
 #pragma pack(pop)
 
+// Dirty area of a subpicture as a few disjoint rectangles, so that a sign at the top and
+// the dialogue at the bottom don't make the whole frame between them dirty.
+struct SubPicRegion {
+	static const int MAX_RECTS = 8;
+
+	int nRects;
+	RECT rects[MAX_RECTS];
+
+	SubPicRegion() : nRects(0) {}
+
+	void Clear() {
+		nRects = 0;
+	}
+
+	// Adds r, merged with the rectangles it overlaps. When the list is full, the pair
+	// whose union grows the area the least is merged instead.
+	void Add(const RECT& r) {
+		CRect rc(r);
+		if (rc.IsRectEmpty()) {
+			return;
+		}
+
+		for (int i = 0; i < nRects; ) {
+			CRect rcOverlap;
+			if (rcOverlap.IntersectRect(rc, &rects[i])) {
+				rc.UnionRect(rc, &rects[i]);
+				rects[i] = rects[--nRects];
+				i = 0; // the union can overlap the rectangles checked before
+			} else {
+				i++;
+			}
+		}
+
+		if (nRects < MAX_RECTS) {
+			rects[nRects++] = rc;
+			return;
+		}
+
+		// rc is the candidate MAX_RECTS
+		auto Get = [&](int i) -> CRect { return i < MAX_RECTS ? CRect(rects[i]) : rc; };
+		auto Area = [](const CRect& a) { return (LONGLONG)a.Width() * a.Height(); };
+
+		int best_i = 0, best_j = 1;
+		LONGLONG best_cost = _I64_MAX;
+		for (int i = 0; i < MAX_RECTS; i++) {
+			for (int j = i + 1; j <= MAX_RECTS; j++) {
+				CRect u;
+				u.UnionRect(Get(i), Get(j));
+				const LONGLONG cost = Area(u) - Area(Get(i)) - Area(Get(j));
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+
+		CRect u;
+		u.UnionRect(Get(best_i), Get(best_j));
+		if (best_j < MAX_RECTS) {
+			rects[best_j] = rects[--nRects];
+		}
+		rects[best_i] = rects[--nRects];
+
+		Add(u);
+		if (best_j < MAX_RECTS) {
+			Add(rc);
+		}
+	}
+
+	CRect GetBoundingBox() const {
+		CRect bbox(0, 0, 0, 0);
+		for (int i = 0; i < nRects; i++) {
+			bbox.UnionRect(bbox, &rects[i]);
+		}
+		return bbox;
+	}
+};
+
 //
 // ISubPic
 //
@@ -101,6 +180,20 @@ public IUnknown {
 	STDMETHOD_(void, SetInverseAlpha)(bool bInverted) PURE;
 };
 
+//
+// ISubPicRegion
+//
+
+// Optional, implemented by the subpictures that keep their dirty area as a SubPicRegion
+interface __declspec(uuid("CE9B3C4C-DADF-4328-ADB0-D195D5A537AE"))
+ISubPicRegion :
+public IUnknown {
+	// Unlock() for a region, GetDirtyRect() returns its bounding box afterwards
+	STDMETHOD (UnlockRegion) (const SubPicRegion& region /*[in]*/) PURE;
+	STDMETHOD (GetDirtyRegion) (SubPicRegion& region /*[out]*/) PURE;
+	STDMETHOD (SetDirtyRegion) (const SubPicRegion& region /*[in]*/) PURE;
+};
+
 //
 // ISubPicAllocator
 //
@@ -148,6 +241,18 @@ public IUnknown {
 	STDMETHOD_(SUBTITLE_TYPE, GetType) () PURE;
 };
 
+//
+// ISubPicProviderRegion
+//
+
+// Optional, implemented by the providers that can report what they drew per subtitle
+interface __declspec(uuid("17561295-9DF5-4982-994B-D9D73177D87A"))
+ISubPicProviderRegion :
+public IUnknown {
+	// Render() that also returns the drawn area as a region, bbox is its bounding box
+	STDMETHOD (RenderRegion) (SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox, SubPicRegion& region) PURE;
+};
+
 //
 // ISubPicQueue
 //
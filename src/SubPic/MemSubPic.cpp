@@ -21,8 +21,11 @@
 
 #include "stdafx.h"
 #include "MemSubPic.h"
+#include "../DSUtil/CPUInfo.h"
 
 #include <emmintrin.h>
+#include <immintrin.h>
+#include <vector>
 
 // color conv
 
@@ -81,15 +84,444 @@ void ColorConvInit()
 	fColorConvInitOK = true;
 }
 
+// RGB to YUV conversion of Unlock()
+
+namespace
+{
+	// Coefficients of one matrix and range. The chroma is derived from the rounded luma
+	// like the original BT.601 code did, so that one stays bit-exact.
+	struct YUVConv {
+		int yb, yg, yr;	// luma of B, G and R in the output range, *65536
+		int cy;			// output luma back to full scale, *65536
+		int cy2;		// the same *32768, for the sum of two pixels
+		int cu, cv;		// chroma of B-Y and R-Y in the output range, *1024
+		bool fFullRange;
+	};
+
+	YUVConv MakeYUVConv(double kr, double kb, bool fFullRange)
+	{
+		const double ys = fFullRange ? 1.0 : 219.0 / 255;
+		const double cs = fFullRange ? 1.0 : 224.0 / 255;
+
+		YUVConv c;
+		c.yb = int(kb * ys * 65536 + 0.5);
+		c.yg = int((1.0 - kr - kb) * ys * 65536 + 0.5);
+		c.yr = int(kr * ys * 65536 + 0.5);
+		c.cy = int(1.0 / ys * 65536 + 0.5);
+		c.cy2 = int(1.0 / ys * 32768 + 0.5);
+		c.cu = int(cs / (2.0 * (1.0 - kb)) * 1024 + 0.5);
+		c.cv = int(cs / (2.0 * (1.0 - kr)) * 1024 + 0.5);
+		c.fFullRange = fFullRange;
+		return c;
+	}
+
+	const YUVConv& GetYUVConv(int matrix, bool fFullRange)
+	{
+		// BT.601 limited range keeps the constants the conversion always had
+		static const YUVConv bt601 = { c2y_cyb, c2y_cyg, c2y_cyr, cy_cy, cy_cy2, c2y_cu, c2y_cv, false };
+		static const YUVConv convs[] = {
+			bt601,
+			MakeYUVConv(0.299, 0.114, true),
+			MakeYUVConv(0.2126, 0.0722, false),
+			MakeYUVConv(0.2126, 0.0722, true),
+			MakeYUVConv(0.2627, 0.0593, false),
+			MakeYUVConv(0.2627, 0.0593, true),
+		};
+
+		if (matrix != MSP_BT709 && matrix != MSP_BT2020) {
+			matrix = MSP_BT601;
+		}
+		return convs[matrix * 2 + (fFullRange ? 1 : 0)];
+	}
+
+	// The blending functions remove 16 from the destination luma as the offset of the limited range.
+	// A full range luma gets 16 scaled by the transparency added back: d*a/256 + y.
+	__forceinline int LumaOffset(const YUVConv& c, int a)
+	{
+		return c.fFullRange ? (a + 8) >> 4 : 16;
+	}
+
+	__forceinline BYTE ClipByte(int v)
+	{
+		return BYTE(std::min(std::max(v, 0), 255));
+	}
+
+	// ARGB ARGB -> AxYU AxYV
+	void ConvertRowYUY2_C(BYTE* s, int w, const YUVConv& c)
+	{
+		for (BYTE* e = s + w * 4; s < e; s += 8) {
+			if ((s[3] + s[7]) < 0x1fe) {
+				const int y1 = (c.yb * s[0] + c.yg * s[1] + c.yr * s[2] + 0x8000) >> 16;
+				const int y2 = (c.yb * s[4] + c.yg * s[5] + c.yr * s[6] + 0x8000) >> 16;
+
+				const int scaled_y = (y1 + y2) * c.cy2;
+
+				s[1] = BYTE(y1 + LumaOffset(c, s[3]));
+				s[5] = BYTE(y2 + LumaOffset(c, s[7]));
+				s[0] = ClipByte((((((s[0] + s[4]) << 15) - scaled_y) >> 10) * c.cu + 0x800000 + 0x8000) >> 16);
+				s[4] = ClipByte((((((s[2] + s[6]) << 15) - scaled_y) >> 10) * c.cv + 0x800000 + 0x8000) >> 16);
+			} else {
+				s[1] = s[5] = 0x10;
+				s[0] = s[4] = 0x80;
+			}
+		}
+	}
+
+	// ARGB -> AYUV
+	void ConvertRowAYUV_C(BYTE* s, int w, const YUVConv& c)
+	{
+		// the limited range has always measured the luma from 32 here, that is kept
+		const int yq = c.fFullRange ? 0 : 16;
+
+		for (BYTE* e = s + w * 4; s < e; s += 4) {
+			if (s[3] < 0xff) {
+				const int y = (c.yb * s[0] + c.yg * s[1] + c.yr * s[2] + 0x8000) >> 16;
+				const int scaled_y = (y - yq) * c.cy;
+				s[1] = ClipByte(((((s[0] << 16) - scaled_y) >> 10) * c.cu + 0x800000 + 0x8000) >> 16);
+				s[0] = ClipByte(((((s[2] << 16) - scaled_y) >> 10) * c.cv + 0x800000 + 0x8000) >> 16);
+				s[2] = BYTE(y + LumaOffset(c, s[3]));
+			} else {
+				s[0] = s[1] = 0x80;
+				s[2] = 0x10;
+			}
+		}
+	}
+
+	// The same with SSE2 or AVX2, 4 or 8 pixels at a time. SSE2 has no 32 bit multiply,
+	// the products are made with _mm_madd_epi16 from coefficients split into 16 bit parts.
+
+	struct SSE2 {
+		typedef __m128i V;
+		static const int N = 4;
+		static V load(const BYTE* p) { return _mm_loadu_si128((const V*)p); }
+		static void store(BYTE* p, V v) { _mm_storeu_si128((V*)p, v); }
+		static V set1(int i) { return _mm_set1_epi32(i); }
+		static V set2(int lo, int hi) { return _mm_set1_epi32((lo & 0xffff) | (hi << 16)); }
+		static V zero() { return _mm_setzero_si128(); }
+		static V add(V a, V b) { return _mm_add_epi32(a, b); }
+		static V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+		static V and_(V a, V b) { return _mm_and_si128(a, b); }
+		static V or_(V a, V b) { return _mm_or_si128(a, b); }
+		static V andnot(V a, V b) { return _mm_andnot_si128(a, b); }
+		static V cmpgt(V a, V b) { return _mm_cmpgt_epi32(a, b); }
+		static V madd(V a, V b) { return _mm_madd_epi16(a, b); }
+		template<int i> static V srli(V a) { return _mm_srli_epi32(a, i); }
+		template<int i> static V srai(V a) { return _mm_srai_epi32(a, i); }
+		template<int i> static V slli(V a) { return _mm_slli_epi32(a, i); }
+		static V srli64(V a) { return _mm_srli_epi64(a, 32); }
+		static V slli64(V a) { return _mm_slli_epi64(a, 32); }
+		static V clip(V a) { return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_packus_epi16(_mm_packs_epi32(a, a), a), _mm_setzero_si128()), _mm_setzero_si128()); }
+		// B G R A 16 bit words of the pixels in a -> B G G R
+		static V bggr(V a) { return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(2, 1, 1, 0)), _MM_SHUFFLE(2, 1, 1, 0)); }
+		static V unpacklo8(V a) { return _mm_unpacklo_epi8(a, _mm_setzero_si128()); }
+		static V unpackhi8(V a) { return _mm_unpackhi_epi8(a, _mm_setzero_si128()); }
+		// 16 bit lanes, 2*N of them
+		static V load8(const BYTE* p) { return _mm_unpacklo_epi8(_mm_loadl_epi64((const V*)p), _mm_setzero_si128()); }
+		static void store8(BYTE* p, V v) { _mm_storel_epi64((V*)p, _mm_packus_epi16(v, v)); }
+		static V set1_16(short i) { return _mm_set1_epi16(i); }
+		static V add16(V a, V b) { return _mm_add_epi16(a, b); }
+		static V sub16(V a, V b) { return _mm_sub_epi16(a, b); }
+		static V mullo16(V a, V b) { return _mm_mullo_epi16(a, b); }
+		static V cmpeq16(V a, V b) { return _mm_cmpeq_epi16(a, b); }
+		template<int i> static V srli16(V a) { return _mm_srli_epi16(a, i); }
+		static V unpacklo16(V a, V b) { return _mm_unpacklo_epi16(a, b); }
+		static V unpackhi16(V a, V b) { return _mm_unpackhi_epi16(a, b); }
+		// the 32 bit lanes of a and b, in order
+		static V packs32(V a, V b) { return _mm_packs_epi32(a, b); }
+		// the bytes of the 16 bit lanes of a and b, per 128 bit lane
+		static V packus16(V a, V b) { return _mm_packus_epi16(a, b); }
+		// the 32 bit lanes of a and b clipped to 0..65535, in order
+		static V packus32(V a, V b) {
+			const V bias = _mm_set1_epi32(0x8000);
+			return _mm_add_epi16(_mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias)), _mm_set1_epi16(-0x8000));
+		}
+		static V cmpeq(V a, V b) { return _mm_cmpeq_epi32(a, b); }
+		static V mulhi16u(V a, V b) { return _mm_mulhi_epu16(a, b); }
+		static V adds16u(V a, V b) { return _mm_adds_epu16(a, b); }
+		static V unpacklo64(V a, V b) { return _mm_unpacklo_epi64(a, b); }
+		static V unpackhi64(V a, V b) { return _mm_unpackhi_epi64(a, b); }
+		// a, so that unpacklo16/unpackhi16 give its first and second half in order
+		static V unpackorder(V a) { return a; }
+		template<int i> static V slli16(V a) { return _mm_slli_epi16(a, i); }
+		static V cmpgt16(V a, V b) { return _mm_cmpgt_epi16(a, b); }
+		// n / d rounded toward zero, exact for the small integers used here
+		static V divtrunc(V n, V d) { return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(n), _mm_cvtepi32_ps(d))); }
+		// the sums of lanes 0+1 and 2+3 of a and b, in order
+		static V hadd(V a, V b) {
+			return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0))),
+								 _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1))));
+		}
+	};
+
+	struct AVX2 {
+		typedef __m256i V;
+		static const int N = 8;
+		static V load(const BYTE* p) { return _mm256_loadu_si256((const V*)p); }
+		static void store(BYTE* p, V v) { _mm256_storeu_si256((V*)p, v); }
+		static V set1(int i) { return _mm256_set1_epi32(i); }
+		static V set2(int lo, int hi) { return _mm256_set1_epi32((lo & 0xffff) | (hi << 16)); }
+		static V zero() { return _mm256_setzero_si256(); }
+		static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_epi32(a, b); }
+		static V and_(V a, V b) { return _mm256_and_si256(a, b); }
+		static V or_(V a, V b) { return _mm256_or_si256(a, b); }
+		static V andnot(V a, V b) { return _mm256_andnot_si256(a, b); }
+		static V cmpgt(V a, V b) { return _mm256_cmpgt_epi32(a, b); }
+		static V madd(V a, V b) { return _mm256_madd_epi16(a, b); }
+		template<int i> static V srli(V a) { return _mm256_srli_epi32(a, i); }
+		template<int i> static V srai(V a) { return _mm256_srai_epi32(a, i); }
+		template<int i> static V slli(V a) { return _mm256_slli_epi32(a, i); }
+		static V srli64(V a) { return _mm256_srli_epi64(a, 32); }
+		static V slli64(V a) { return _mm256_slli_epi64(a, 32); }
+		static V clip(V a) { return _mm256_unpacklo_epi16(_mm256_unpacklo_epi8(_mm256_packus_epi16(_mm256_packs_epi32(a, a), a), _mm256_setzero_si256()), _mm256_setzero_si256()); }
+		static V bggr(V a) { return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a, _MM_SHUFFLE(2, 1, 1, 0)), _MM_SHUFFLE(2, 1, 1, 0)); }
+		static V unpacklo8(V a) { return _mm256_unpacklo_epi8(a, _mm256_setzero_si256()); }
+		static V unpackhi8(V a) { return _mm256_unpackhi_epi8(a, _mm256_setzero_si256()); }
+		static V load8(const BYTE* p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+		static void store8(BYTE* p, V v) { _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), _MM_SHUFFLE(3, 1, 2, 0)))); }
+		static V set1_16(short i) { return _mm256_set1_epi16(i); }
+		static V add16(V a, V b) { return _mm256_add_epi16(a, b); }
+		static V sub16(V a, V b) { return _mm256_sub_epi16(a, b); }
+		static V mullo16(V a, V b) { return _mm256_mullo_epi16(a, b); }
+		static V cmpeq16(V a, V b) { return _mm256_cmpeq_epi16(a, b); }
+		template<int i> static V srli16(V a) { return _mm256_srli_epi16(a, i); }
+		static V unpacklo16(V a, V b) { return _mm256_unpacklo_epi16(a, b); }
+		static V unpackhi16(V a, V b) { return _mm256_unpackhi_epi16(a, b); }
+		static V packs32(V a, V b) { return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)); }
+		static V packus16(V a, V b) { return _mm256_packus_epi16(a, b); }
+		static V packus32(V a, V b) { return _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)); }
+		static V cmpeq(V a, V b) { return _mm256_cmpeq_epi32(a, b); }
+		static V mulhi16u(V a, V b) { return _mm256_mulhi_epu16(a, b); }
+		static V adds16u(V a, V b) { return _mm256_adds_epu16(a, b); }
+		static V unpacklo64(V a, V b) { return _mm256_unpacklo_epi64(a, b); }
+		static V unpackhi64(V a, V b) { return _mm256_unpackhi_epi64(a, b); }
+		static V unpackorder(V a) { return _mm256_permute4x64_epi64(a, _MM_SHUFFLE(3, 1, 2, 0)); }
+		template<int i> static V slli16(V a) { return _mm256_slli_epi16(a, i); }
+		static V cmpgt16(V a, V b) { return _mm256_cmpgt_epi16(a, b); }
+		static V divtrunc(V n, V d) { return _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(n), _mm256_cvtepi32_ps(d))); }
+		static V hadd(V a, V b) {
+			return _mm256_add_epi32(_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2, 0, 2, 0))),
+									_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(3, 1, 3, 1))));
+		}
+	};
+
+	// coefficients of the 16 bit multiplies, see Mul()
+	template<class S>
+	struct YUVConvConsts {
+		typename S::V luma, cy, cy2, cu, cv;
+
+		explicit YUVConvConsts(const YUVConv& c)
+			: luma(S::zero()) {
+			// B*yb + G*yg/2, G*(yg-yg/2) + R*yr, all parts fit in 16 bits
+			alignas(32) short l[16];
+			for (int i = 0; i < 16; i += 4) {
+				l[i] = short(c.yb);
+				l[i + 1] = short(c.yg / 2);
+				l[i + 2] = short(c.yg - c.yg / 2);
+				l[i + 3] = short(c.yr);
+			}
+			memcpy(&luma, l, sizeof(luma));
+			cy = S::set2(c.cy >> 2, c.cy & 3);
+			cy2 = S::set2(c.cy2 >> 2, c.cy2 & 3);
+			cu = S::set2(c.cu, 0);
+			cv = S::set2(c.cv, 0);
+		}
+	};
+
+	// per 32 bit lane: v * coefficient, v is a 16 bit value (signed), k from set2(c >> 2, c & 3)
+	template<class S>
+	__forceinline typename S::V Mul(typename S::V v, typename S::V k)
+	{
+		v = S::and_(v, S::set1(0xffff));
+		return S::madd(S::or_(S::and_(S::template slli<2>(v), S::set1(0xffff)), S::template slli<16>(v)), k);
+	}
+
+	// unrounded luma *65536 of the pixels in px
+	template<class S>
+	__forceinline typename S::V Luma(typename S::V px, const YUVConvConsts<S>& k)
+	{
+		const typename S::V lo = S::madd(S::bggr(S::unpacklo8(px)), k.luma);
+		const typename S::V hi = S::madd(S::bggr(S::unpackhi8(px)), k.luma);
+		return S::hadd(lo, hi);
+	}
+
+	// the luma offset, see LumaOffset()
+	template<class S>
+	__forceinline typename S::V LumaOffset(typename S::V a, const YUVConv& c)
+	{
+		return c.fFullRange ? S::template srli<4>(S::add(a, S::set1(8))) : S::set1(16);
+	}
+
+	// clip((d >> 10) * coefficient + 128.5), d fits in 16 bits after the shift
+	template<class S>
+	__forceinline typename S::V Chroma(typename S::V d, typename S::V k)
+	{
+		d = S::and_(S::template srai<10>(d), S::set1(0xffff));
+		return S::clip(S::template srai<16>(S::add(S::madd(d, k), S::set1(0x808000))));
+	}
+
+	template<class S>
+	void ConvertRowYUY2(BYTE* s, int w, const YUVConv& c)
+	{
+		typedef typename S::V V;
+		const YUVConvConsts<S> k(c);
+		const V mask = S::set1(0xff);
+
+		int i = 0;
+		for (; i + S::N <= w; i += S::N, s += S::N * 4) {
+			const V px = S::load(s);
+			const V b = S::and_(px, mask);
+			const V r = S::and_(S::template srli<16>(px), mask);
+			const V a = S::template srli<24>(px);
+
+			const V y = S::template srli<16>(S::add(Luma<S>(px, k), S::set1(0x8000)));
+
+			// the sums of the pairs are in the even lanes
+			const V ySum = S::add(y, S::srli64(y));
+			const V bSum = S::add(b, S::srli64(b));
+			const V rSum = S::add(r, S::srli64(r));
+			const V aSum = S::add(a, S::srli64(a));
+
+			const V scaled_y = Mul<S>(ySum, k.cy2);
+			const V u = Chroma<S>(S::sub(S::template slli<15>(bSum), scaled_y), k.cu);
+			const V v = Chroma<S>(S::sub(S::template slli<15>(rSum), scaled_y), k.cv);
+
+			// U in the first pixel of a pair, V in the second
+			const V evenMask = S::srli64(S::set1(-1));
+			V uv = S::or_(S::and_(u, evenMask), S::slli64(v));
+			V out = S::or_(S::and_(px, S::set1(0xffff0000)), S::or_(S::template slli<8>(S::and_(S::add(y, LumaOffset<S>(a, c)), mask)), uv));
+
+			// transparent pairs
+			V opaque = S::cmpgt(S::set1(0x1fe), aSum);
+			opaque = S::and_(opaque, evenMask);
+			opaque = S::or_(opaque, S::slli64(opaque));
+			out = S::or_(S::and_(opaque, out), S::andnot(opaque, S::or_(S::and_(px, S::set1(0xffff0000)), S::set1(0x1080))));
+
+			S::store(s, out);
+		}
+
+		ConvertRowYUY2_C(s, w - i, c);
+	}
+
+	template<class S>
+	void ConvertRowAYUV(BYTE* s, int w, const YUVConv& c)
+	{
+		typedef typename S::V V;
+		const YUVConvConsts<S> k(c);
+		const V mask = S::set1(0xff);
+		const V yq = S::set1(c.fFullRange ? 0 : 16);
+
+		int i = 0;
+		for (; i + S::N <= w; i += S::N, s += S::N * 4) {
+			const V px = S::load(s);
+			const V b = S::and_(px, mask);
+			const V r = S::and_(S::template srli<16>(px), mask);
+			const V a = S::template srli<24>(px);
+
+			const V y = S::template srli<16>(S::add(Luma<S>(px, k), S::set1(0x8000)));
+
+			const V scaled_y = Mul<S>(S::sub(y, yq), k.cy);
+			const V u = Chroma<S>(S::sub(S::template slli<16>(b), scaled_y), k.cu);
+			const V v = Chroma<S>(S::sub(S::template slli<16>(r), scaled_y), k.cv);
+
+			const V alpha = S::template slli<24>(a);
+			V out = S::or_(S::or_(alpha, S::template slli<16>(S::and_(S::add(y, LumaOffset<S>(a, c)), mask))), S::or_(S::template slli<8>(u), v));
+
+			// transparent pixels
+			const V opaque = S::cmpgt(mask, a);
+			out = S::or_(S::and_(opaque, out), S::andnot(opaque, S::or_(alpha, S::set1(0x108080))));
+
+			S::store(s, out);
+		}
+
+		ConvertRowAYUV_C(s, w - i, c);
+	}
+}
+
+#ifdef _DEBUG
+// Debug builds compare the SIMD kernels with the C rows on random pixels once, see CMemSubPicAllocator().
+// The widths are not multiples of the vector sizes, so the C tails of the kernels run too.
+
+namespace
+{
+	class CRandomRows
+	{
+		unsigned int m_seed;
+
+	public:
+		CRandomRows() : m_seed(1) {}
+
+		std::vector<BYTE> Bytes(size_t n) {
+			std::vector<BYTE> v(n);
+			for (auto& b : v) {
+				m_seed = m_seed * 1103515245 + 12345;
+				b = BYTE(m_seed >> 16);
+			}
+			return v;
+		}
+
+		// n ARGB pixels and the slack the kernels may read, half of them are 0 or maxAlpha
+		std::vector<BYTE> Pixels(size_t n, BYTE maxAlpha = 0xff) {
+			std::vector<BYTE> v = Bytes(n * 4 + 64);
+			for (size_t i = 3; i < v.size(); i += 4) {
+				const int k = v[i] & 3;
+				v[i] = k == 0 ? 0 : k == 1 ? maxAlpha : BYTE(v[i] % (maxAlpha + 1));
+			}
+			return v;
+		}
+	};
+
+	const int s_matrices[] = {MSP_BT601, MSP_BT709, MSP_BT2020};
+
+	template<class S>
+	bool CheckConvertRows(CRandomRows& r)
+	{
+		for (int matrix : s_matrices) {
+			for (int range = 0; range < 2; range++) {
+				const YUVConv& c = GetYUVConv(matrix, !!range);
+
+				// YUY2 converts pixel pairs
+				for (int w = 2; w <= 74; w += 2) {
+					std::vector<BYTE> a = r.Pixels(w), b = a;
+					ConvertRowYUY2<S>(a.data(), w, c);
+					ConvertRowYUY2_C(b.data(), w, c);
+					if (a != b) {
+						return false;
+					}
+				}
+				for (int w = 1; w <= 75; w += 2) {
+					std::vector<BYTE> a = r.Pixels(w), b = a;
+					ConvertRowAYUV<S>(a.data(), w, c);
+					ConvertRowAYUV_C(b.data(), w, c);
+					if (a != b) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	bool CheckConvertRows()
+	{
+		CRandomRows r;
+		return CheckConvertRows<SSE2>(r) && (!CPUInfo::HaveAVX2() || CheckConvertRows<AVX2>(r));
+	}
+}
+#endif
+
 //
 // CMemSubPic
 //
 
 CMemSubPic::CMemSubPic(SubPicDesc& spd)
 	: m_spd(spd)
+	, m_matrix(MSP_BT601)
+	, m_fFullRange(false)
 {
 	m_maxsize.SetSize(spd.w, spd.h);
 	m_rcDirty.SetRect(0, 0, spd.w, spd.h);
+	m_dirtyRegion.Add(m_rcDirty);
 }
 
 CMemSubPic::~CMemSubPic()
@@ -97,6 +529,84 @@ CMemSubPic::~CMemSubPic()
 	SAFE_DELETE_ARRAY(m_spd.bits);
 }
 
+STDMETHODIMP CMemSubPic::NonDelegatingQueryInterface(REFIID riid, void** ppv)
+{
+	return
+		QI(ISubPicRegion)
+		__super::NonDelegatingQueryInterface(riid, ppv);
+}
+
+void CMemSubPic::SetYUVMatrix(int matrix, bool fFullRange)
+{
+	m_matrix = matrix;
+	m_fFullRange = fFullRange;
+}
+
+// private
+
+// widens r to the chroma subsampling of the target
+void CMemSubPic::AlignDirtyRect(CRect& r) const
+{
+	if (m_spd.type == MSP_YUY2 || m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV
+		|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12)
+	{
+		r.left &= ~1;
+		r.right = (r.right+1)&~1;
+
+		if(m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV
+			|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12) {
+			r.top &= ~1;
+			r.bottom = (r.bottom+1)&~1;
+		}
+	}
+}
+
+// converts the ARGB the provider drew in r to the format of the target, in place
+void CMemSubPic::ConvertDirtyRect(const CRect& r)
+{
+	if(m_spd.type == MSP_YUY2 || m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV || m_spd.type == MSP_AYUV
+		|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12) {
+		ColorConvInit();
+	}
+
+	int w = r.Width(), h = r.Height();
+	BYTE* top = (BYTE*)m_spd.bits + m_spd.pitch*r.top + r.left*4;
+	BYTE* bottom = top + m_spd.pitch*h;
+
+	if (m_spd.type == MSP_RGB16) {
+		for (; top < bottom ; top += m_spd.pitch) {
+			DWORD* s = (DWORD*)top;
+			DWORD* e = s + w;
+			for (; s < e; s++) {
+				*s = ((*s>>3)&0x1f000000)|((*s>>8)&0xf800)|((*s>>5)&0x07e0)|((*s>>3)&0x001f);
+				//				*s = (*s&0xff000000)|((*s>>8)&0xf800)|((*s>>5)&0x07e0)|((*s>>3)&0x001f);
+			}
+		}
+	} else if (m_spd.type == MSP_RGB15) {
+		for (; top < bottom; top += m_spd.pitch) {
+			DWORD* s = (DWORD*)top;
+			DWORD* e = s + w;
+			for (; s < e; s++) {
+				*s = ((*s>>3)&0x1f000000)|((*s>>9)&0x7c00)|((*s>>6)&0x03e0)|((*s>>3)&0x001f);
+				//				*s = (*s&0xff000000)|((*s>>9)&0x7c00)|((*s>>6)&0x03e0)|((*s>>3)&0x001f);
+			}
+		}
+	} else if(m_spd.type == MSP_YUY2 || m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV || m_spd.type == MSP_NV12) {
+		// P010 and P016 stay ARGB, AlphaBlt() converts them with 16 bit precision
+		const YUVConv& c = GetYUVConv(m_matrix, m_fFullRange);
+		void (*convertRow)(BYTE*, int, const YUVConv&) = CPUInfo::HaveAVX2() ? ConvertRowYUY2<AVX2> : ConvertRowYUY2<SSE2>;
+		for(; top < bottom ; top += m_spd.pitch) {
+			convertRow(top, w, c);
+		}
+	} else if (m_spd.type == MSP_AYUV) {
+		const YUVConv& c = GetYUVConv(m_matrix, m_fFullRange);
+		void (*convertRow)(BYTE*, int, const YUVConv&) = CPUInfo::HaveAVX2() ? ConvertRowAYUV<AVX2> : ConvertRowAYUV<SSE2>;
+		for (; top < bottom ; top += m_spd.pitch) {
+			convertRow(top, w, c);
+		}
+	}
+}
+
 // ISubPic
 
 STDMETHODIMP_(void*) CMemSubPic::GetObject()
@@ -131,12 +641,20 @@ STDMETHODIMP CMemSubPic::CopyTo(ISubPic* pSubPic)
 		return E_FAIL;
 	}
 
-	int w = m_rcDirty.Width(), h = m_rcDirty.Height();
-	BYTE* s = (BYTE*)src.bits + src.pitch*m_rcDirty.top + m_rcDirty.left * 4;
-	BYTE* d = (BYTE*)dst.bits + dst.pitch*m_rcDirty.top + m_rcDirty.left * 4;
+	for (int i = 0; i < m_dirtyRegion.nRects; i++) {
+		const CRect r(m_dirtyRegion.rects[i]);
+
+		int w = r.Width(), h = r.Height();
+		BYTE* s = (BYTE*)src.bits + src.pitch*r.top + r.left * 4;
+		BYTE* d = (BYTE*)dst.bits + dst.pitch*r.top + r.left * 4;
+
+		for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
+			memcpy(d, s, w * 4);
+		}
+	}
 
-	for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-		memcpy(d, s, w * 4);
+	if (CComQIPtr<ISubPicRegion> pSubPicRegion = pSubPic) {
+		pSubPicRegion->SetDirtyRegion(m_dirtyRegion);
 	}
 
 	return S_OK;
@@ -148,27 +666,43 @@ STDMETHODIMP CMemSubPic::ClearDirtyRect(DWORD color)
 		return S_FALSE;
 	}
 
-	BYTE* p = (BYTE*)m_spd.bits + m_spd.pitch*m_rcDirty.top + m_rcDirty.left*(m_spd.bpp>>3);
-	for (ptrdiff_t j = 0, h = m_rcDirty.Height(); j < h; j++, p += m_spd.pitch) {
-		int w = m_rcDirty.Width();
+	for (int i = 0; i < m_dirtyRegion.nRects; i++) {
+		const CRect r(m_dirtyRegion.rects[i]);
+
+		BYTE* p = (BYTE*)m_spd.bits + m_spd.pitch*r.top + r.left*(m_spd.bpp>>3);
+		for (ptrdiff_t j = 0, h = r.Height(); j < h; j++, p += m_spd.pitch) {
+			int w = r.Width();
 #ifdef _WIN64
-		memsetd(p, color, w*4);
+			memsetd(p, color, w*4);
 #else
-		__asm {
-			mov eax, color
-			mov ecx, w
-			mov edi, p
-			cld
-			rep stosd
-		}
+			__asm {
+				mov eax, color
+				mov ecx, w
+				mov edi, p
+				cld
+				rep stosd
+			}
 #endif
+		}
 	}
 
 	m_rcDirty.SetRectEmpty();
+	m_dirtyRegion.Clear();
 
 	return S_OK;
 }
 
+STDMETHODIMP CMemSubPic::SetDirtyRect(RECT* pDirtyRect)
+{
+	HRESULT hr = __super::SetDirtyRect(pDirtyRect);
+	if (SUCCEEDED(hr)) {
+		m_dirtyRegion.Clear();
+		m_dirtyRegion.Add(m_rcDirty);
+	}
+
+	return hr;
+}
+
 STDMETHODIMP CMemSubPic::Lock(SubPicDesc& spd)
 {
 	return GetDesc(spd);
@@ -177,93 +711,56 @@ STDMETHODIMP CMemSubPic::Lock(SubPicDesc& spd)
 STDMETHODIMP CMemSubPic::Unlock(RECT* pDirtyRect)
 {
 	m_rcDirty = pDirtyRect ? *pDirtyRect : CRect(0,0,m_spd.w,m_spd.h);
+	m_dirtyRegion.Clear();
 
 	if (m_rcDirty.IsRectEmpty()) {
 		return S_OK;
 	}
 
-	if(m_spd.type == MSP_YUY2 || m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV || m_spd.type == MSP_AYUV
-		|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12) {
-		ColorConvInit();
+	AlignDirtyRect(m_rcDirty);
+	m_dirtyRegion.Add(m_rcDirty);
 
-		if(m_spd.type == MSP_YUY2 || m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV
-			|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12)
-		{
-			m_rcDirty.left &= ~1;
-			m_rcDirty.right = (m_rcDirty.right+1)&~1;
+	ConvertDirtyRect(m_rcDirty);
 
-			if(m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV
-				|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12) {
-				m_rcDirty.top &= ~1;
-				m_rcDirty.bottom = (m_rcDirty.bottom+1)&~1;
-			}
-		}
+	return S_OK;
+}
+
+// ISubPicRegion
+
+STDMETHODIMP CMemSubPic::UnlockRegion(const SubPicRegion& region)
+{
+	// aligning can make neighbours overlap, Add() merges them so nothing is converted twice
+	m_dirtyRegion.Clear();
+	for (int i = 0; i < region.nRects; i++) {
+		CRect r(region.rects[i]);
+		AlignDirtyRect(r);
+		m_dirtyRegion.Add(r);
 	}
 
-	int w = m_rcDirty.Width(), h = m_rcDirty.Height();
-	BYTE* top = (BYTE*)m_spd.bits + m_spd.pitch*m_rcDirty.top + m_rcDirty.left*4;
-	BYTE* bottom = top + m_spd.pitch*h;
+	m_rcDirty = m_dirtyRegion.GetBoundingBox();
 
-	if (m_spd.type == MSP_RGB16) {
-		for (; top < bottom ; top += m_spd.pitch) {
-			DWORD* s = (DWORD*)top;
-			DWORD* e = s + w;
-			for (; s < e; s++) {
-				*s = ((*s>>3)&0x1f000000)|((*s>>8)&0xf800)|((*s>>5)&0x07e0)|((*s>>3)&0x001f);
-				//				*s = (*s&0xff000000)|((*s>>8)&0xf800)|((*s>>5)&0x07e0)|((*s>>3)&0x001f);
-			}
-		}
-	} else if (m_spd.type == MSP_RGB15) {
-		for (; top < bottom; top += m_spd.pitch) {
-			DWORD* s = (DWORD*)top;
-			DWORD* e = s + w;
-			for (; s < e; s++) {
-				*s = ((*s>>3)&0x1f000000)|((*s>>9)&0x7c00)|((*s>>6)&0x03e0)|((*s>>3)&0x001f);
-				//				*s = (*s&0xff000000)|((*s>>9)&0x7c00)|((*s>>6)&0x03e0)|((*s>>3)&0x001f);
-			}
-		}
-	} else if(m_spd.type == MSP_YUY2 || m_spd.type == MSP_YV12 || m_spd.type == MSP_IYUV
-		|| m_spd.type == MSP_P010 || m_spd.type == MSP_P016 || m_spd.type == MSP_NV12) {
-		for(; top < bottom ; top += m_spd.pitch) {
-			BYTE* s = top;
-			BYTE* e = s + w*4;
-			for(; s < e; s+=8) { // ARGB ARGB -> AxYU AxYV
-				if((s[3]+s[7]) < 0x1fe) {
-					s[1] = (c2y_yb[s[0]] + c2y_yg[s[1]] + c2y_yr[s[2]] + 0x108000) >> 16;
-					s[5] = (c2y_yb[s[4]] + c2y_yg[s[5]] + c2y_yr[s[6]] + 0x108000) >> 16;
-
-					int scaled_y = (s[1]+s[5]-32) * cy_cy2;
-
-					s[0] = Clip[(((((s[0]+s[4])<<15) - scaled_y) >> 10) * c2y_cu + 0x800000 + 0x8000) >> 16];
-					s[4] = Clip[(((((s[2]+s[6])<<15) - scaled_y) >> 10) * c2y_cv + 0x800000 + 0x8000) >> 16];
-				} else {
-					s[1] = s[5] = 0x10;
-					s[0] = s[4] = 0x80;
-				}
-			}
-		}
-	} else if (m_spd.type == MSP_AYUV) {
-		for (; top < bottom ; top += m_spd.pitch) {
-			BYTE* s = top;
-			BYTE* e = s + w*4;
-			for (; s < e; s+=4) { // ARGB -> AYUV
-				if (s[3] < 0xff) {
-					int y = (c2y_yb[s[0]] + c2y_yg[s[1]] + c2y_yr[s[2]] + 0x108000) >> 16;
-					int scaled_y = (y-32) * cy_cy;
-					s[1] = Clip[((((s[0]<<16) - scaled_y) >> 10) * c2y_cu + 0x800000 + 0x8000) >> 16];
-					s[0] = Clip[((((s[2]<<16) - scaled_y) >> 10) * c2y_cv + 0x800000 + 0x8000) >> 16];
-					s[2] = y;
-				} else {
-					s[0] = s[1] = 0x80;
-					s[2] = 0x10;
-				}
-			}
-		}
+	for (int i = 0; i < m_dirtyRegion.nRects; i++) {
+		ConvertDirtyRect(m_dirtyRegion.rects[i]);
 	}
 
 	return S_OK;
 }
 
+STDMETHODIMP CMemSubPic::GetDirtyRegion(SubPicRegion& region)
+{
+	region = m_dirtyRegion;
+
+	return S_OK;
+}
+
+STDMETHODIMP CMemSubPic::SetDirtyRegion(const SubPicRegion& region)
+{
+	m_dirtyRegion = region;
+	m_rcDirty = m_dirtyRegion.GetBoundingBox();
+
+	return S_OK;
+}
+
 static void AlphaBlt_YUY2_SSE2(int w, int h, BYTE* d, int dstpitch, BYTE* s, int srcpitch)
 {
 	unsigned int ia;
@@ -328,6 +825,661 @@ void AlphaBlt_YUY2_C(int w, int h, BYTE* d, int dstpitch, BYTE* s, int srcpitch)
 }
 */
 
+// 4:2:0 blending of AlphaBlt(), the source is the AxYU AxYV output of Unlock().
+// The results are the same as the plain C loops: the 8 bit wrap-around of the
+// stores is kept by taking bits 8..15 of the 16 bit products.
+
+namespace
+{
+	// d = ((d - 16) * a >> 8) + y, where a < 0xff
+	void AlphaBlt_Y_C(BYTE* d, const BYTE* s, int w)
+	{
+		for (const BYTE* e = s + w * 4; s < e; s += 4, d++) {
+			if (s[3] < 0xff) {
+				d[0] = (((d[0] - 0x10) * s[3]) >> 8) + s[1];
+			}
+		}
+	}
+
+	// the average alpha and chroma of the 2x2 block of pixel pair k, s2 is the next source row
+	__forceinline void AlphaBlt_UV_C(BYTE& u, BYTE& v, const BYTE* s, const BYTE* s2)
+	{
+		const unsigned int ia = (s[3] + s2[3] + s[7] + s2[7]) >> 2;
+		if (ia < 0xff) {
+			u = (((u - 0x80) * ia) >> 8) + ((s[0] + s2[0]) >> 1);
+			v = (((v - 0x80) * ia) >> 8) + ((s[4] + s2[4]) >> 1);
+		}
+	}
+
+	template<class S>
+	__forceinline typename S::V Blend16(typename S::V d, typename S::V a, typename S::V c, short offset)
+	{
+		typedef typename S::V V;
+		const V res = S::and_(S::add16(S::template srli16<8>(S::mullo16(S::sub16(d, S::set1_16(offset)), a)), c), S::set1_16(0xff));
+		const V keep = S::cmpeq16(a, S::set1_16(0xff));
+		return S::or_(S::and_(keep, d), S::andnot(keep, res));
+	}
+
+	template<class S>
+	void AlphaBlt_Y(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+	{
+		typedef typename S::V V;
+		const V mask = S::set1(0xff);
+
+		for (ptrdiff_t j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+			int i = 0;
+			for (; i + S::N * 2 <= w; i += S::N * 2) {
+				const V p0 = S::load(s + i * 4);
+				const V p1 = S::load(s + i * 4 + S::N * 4);
+				const V y = S::packs32(S::and_(S::template srli<8>(p0), mask), S::and_(S::template srli<8>(p1), mask));
+				const V a = S::packs32(S::template srli<24>(p0), S::template srli<24>(p1));
+				S::store8(d + i, Blend16<S>(S::load8(d + i), a, y, 0x10));
+			}
+			AlphaBlt_Y_C(d + i, s + i * 4, w - i);
+		}
+	}
+
+	// the sums of the alpha and chroma of two source rows, 2*N pixels in pixel order
+	template<class S>
+	__forceinline void SumRows(const BYTE* s, int srcpitch, typename S::V& a, typename S::V& c)
+	{
+		typedef typename S::V V;
+		const V mask = S::set1(0xff);
+		const V p0 = S::load(s), p1 = S::load(s + S::N * 4);
+		const V q0 = S::load(s + srcpitch), q1 = S::load(s + srcpitch + S::N * 4);
+		a = S::add16(S::packs32(S::template srli<24>(p0), S::template srli<24>(p1)), S::packs32(S::template srli<24>(q0), S::template srli<24>(q1)));
+		c = S::add16(S::packs32(S::and_(p0, mask), S::and_(p1, mask)), S::packs32(S::and_(q0, mask), S::and_(q1, mask)));
+	}
+
+	// the averages of the 2x2 blocks of 4*N pixels, 2*N chroma samples in order
+	template<class S>
+	__forceinline void Average2x2(const BYTE* s, int srcpitch, typename S::V& ia, typename S::V& u, typename S::V& v)
+	{
+		typedef typename S::V V;
+		const V lo = S::set1(0xffff);
+		V a0, c0, a1, c1;
+		SumRows<S>(s, srcpitch, a0, c0);
+		SumRows<S>(s + S::N * 8, srcpitch, a1, c1);
+		// the pixel pairs are the halves of the 32 bit lanes, U in the first and V in the second
+		ia = S::template srli16<2>(S::packs32(S::add(S::and_(a0, lo), S::template srli<16>(a0)), S::add(S::and_(a1, lo), S::template srli<16>(a1))));
+		u = S::template srli16<1>(S::packs32(S::and_(c0, lo), S::and_(c1, lo)));
+		v = S::template srli16<1>(S::packs32(S::template srli<16>(c0), S::template srli<16>(c1)));
+	}
+
+	template<class S>
+	void AlphaBlt_UV_Planar(int w, int h2, BYTE* dU, BYTE* dV, int dstpitch, const BYTE* s, int srcpitch)
+	{
+		typedef typename S::V V;
+		const int w2 = (w + 1) / 2;
+
+		for (ptrdiff_t j = 0; j < h2; j++, s += srcpitch * 2, dU += dstpitch, dV += dstpitch) {
+			int i = 0;
+			for (; (i + S::N * 2) * 2 <= w; i += S::N * 2) {
+				V ia, u, v;
+				Average2x2<S>(s + i * 8, srcpitch, ia, u, v);
+				S::store8(dU + i, Blend16<S>(S::load8(dU + i), ia, u, 0x80));
+				S::store8(dV + i, Blend16<S>(S::load8(dV + i), ia, v, 0x80));
+			}
+			for (; i < w2; i++) {
+				AlphaBlt_UV_C(dU[i], dV[i], s + i * 8, s + i * 8 + srcpitch);
+			}
+		}
+	}
+
+	template<class S>
+	void AlphaBlt_UV_NV12(int w, int h2, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+	{
+		typedef typename S::V V;
+		const int w2 = (w + 1) / 2;
+
+		for (ptrdiff_t j = 0; j < h2; j++, s += srcpitch * 2, d += dstpitch) {
+			int i = 0;
+			for (; (i + S::N * 2) * 2 <= w; i += S::N * 2) {
+				V ia, u, v;
+				Average2x2<S>(s + i * 8, srcpitch, ia, u, v);
+				// interleaving per 128 bit lane matches the unpacking of the destination bytes
+				const V uv = S::load(d + i * 2);
+				const V lo = Blend16<S>(S::unpacklo8(uv), S::unpacklo16(ia, ia), S::unpacklo16(u, v), 0x80);
+				const V hi = Blend16<S>(S::unpackhi8(uv), S::unpackhi16(ia, ia), S::unpackhi16(u, v), 0x80);
+				S::store(d + i * 2, S::packus16(lo, hi));
+			}
+			for (; i < w2; i++) {
+				AlphaBlt_UV_C(d[i * 2], d[i * 2 + 1], s + i * 8, s + i * 8 + srcpitch);
+			}
+		}
+	}
+}
+
+#ifdef _DEBUG
+namespace
+{
+	// one luma row and one chroma row of every 4:2:0 layout, the source has two rows
+	template<class S>
+	bool CheckAlphaBlt420(CRandomRows& r)
+	{
+		for (int w = 1; w <= 75; w += 2) {
+			const int w2 = (w + 1) / 2;
+			const int srcpitch = w * 4 + 32;
+			const std::vector<BYTE> s = r.Pixels(w + 8 + w);
+
+			std::vector<BYTE> y = r.Bytes(w), y2 = y;
+			AlphaBlt_Y<S>(w, 1, y.data(), w, s.data(), srcpitch);
+			AlphaBlt_Y_C(y2.data(), s.data(), w);
+
+			std::vector<BYTE> u = r.Bytes(w2), v = r.Bytes(w2), u2 = u, v2 = v;
+			AlphaBlt_UV_Planar<S>(w, 1, u.data(), v.data(), w2, s.data(), srcpitch);
+
+			std::vector<BYTE> uv = r.Bytes(w2 * 2), uv2 = uv;
+			AlphaBlt_UV_NV12<S>(w, 1, uv.data(), w2 * 2, s.data(), srcpitch);
+
+			for (int i = 0; i < w2; i++) {
+				AlphaBlt_UV_C(u2[i], v2[i], s.data() + i * 8, s.data() + i * 8 + srcpitch);
+				AlphaBlt_UV_C(uv2[i * 2], uv2[i * 2 + 1], s.data() + i * 8, s.data() + i * 8 + srcpitch);
+			}
+
+			if (y != y2 || u != u2 || v != v2 || uv != uv2) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool CheckAlphaBlt420()
+	{
+		CRandomRows r;
+		return CheckAlphaBlt420<SSE2>(r) && (!CPUInfo::HaveAVX2() || CheckAlphaBlt420<AVX2>(r));
+	}
+}
+#endif
+
+// P010/P016 blending of AlphaBlt(). Unlock() leaves these subpictures in ARGB, the
+// premultiplied colors are converted here straight to 16 bit YUV and blended with the
+// full precision of the destination, rounded to 10 bits at the end for P010.
+
+namespace
+{
+	struct YUV16Conv {
+		short yb, yg, yr;	// 16 bit output luma of 8 bit B, G and R, *128
+		short ub, ug, ur;	// the same for U and V, centered on 0
+		short vb, vg, vr;
+		int yOffset;		// 16 bit luma offset, 16 << 8 for the limited range
+	};
+
+	YUV16Conv MakeYUV16Conv(double kr, double kb, bool fFullRange)
+	{
+		const double kg = 1.0 - kr - kb;
+		const double scale = (fFullRange ? 257.0 : 256.0) * 128;
+		const double ys = fFullRange ? 1.0 : 219.0 / 255;
+		const double cs = fFullRange ? 1.0 : 224.0 / 255;
+		const double cu = cs / (2.0 * (1.0 - kb)), cv = cs / (2.0 * (1.0 - kr));
+
+		auto round = [scale](double c) { return short(floor(c * scale + 0.5)); };
+
+		YUV16Conv c;
+		c.yb = round(kb * ys);
+		c.yg = round(kg * ys);
+		c.yr = round(kr * ys);
+		c.ub = round((1.0 - kb) * cu);
+		c.ug = round(-kg * cu);
+		c.ur = round(-kr * cu);
+		c.vb = round(-kb * cv);
+		c.vg = round(-kg * cv);
+		c.vr = round((1.0 - kr) * cv);
+		c.yOffset = fFullRange ? 0 : 16 << 8;
+		return c;
+	}
+
+	const YUV16Conv& GetYUV16Conv(int matrix, bool fFullRange)
+	{
+		static const YUV16Conv convs[] = {
+			MakeYUV16Conv(0.299, 0.114, false),
+			MakeYUV16Conv(0.299, 0.114, true),
+			MakeYUV16Conv(0.2126, 0.0722, false),
+			MakeYUV16Conv(0.2126, 0.0722, true),
+			MakeYUV16Conv(0.2627, 0.0593, false),
+			MakeYUV16Conv(0.2627, 0.0593, true),
+		};
+
+		if (matrix != MSP_BT709 && matrix != MSP_BT2020) {
+			matrix = MSP_BT601;
+		}
+		return convs[matrix * 2 + (fFullRange ? 1 : 0)];
+	}
+
+	// the transparency of the rasterizer is out of 256, 0xff is left as fully transparent
+	__forceinline int Transparency(BYTE a)
+	{
+		return a == 0xff ? 256 : a;
+	}
+
+	__forceinline WORD ClipP01x(int v, bool f10bit)
+	{
+		v = std::min(std::max(v, 0), 0xffff);
+		return WORD(f10bit ? std::min(v + 0x20, 0xffff) & 0xffc0 : v);
+	}
+
+	// d = off + (d - off) * t / 256 + y, rounded
+	void AlphaBlt_P01x_Y_C(WORD* d, const BYTE* s, int w, const YUV16Conv& c, bool f10bit)
+	{
+		for (const BYTE* e = s + w * 4; s < e; s += 4, d++) {
+			const int t = Transparency(s[3]);
+			const int y = (c.yb * s[0] + c.yg * s[1] + c.yr * s[2] + 64) >> 7;
+			d[0] = ClipP01x(((d[0] * t + (256 - t) * c.yOffset + 128) >> 8) + y, f10bit);
+		}
+	}
+
+	// one UV pair from the 2x2 block of pixels at s, s2 is the next source row
+	__forceinline void AlphaBlt_P01x_UV_C(WORD* d, const BYTE* s, const BYTE* s2, const YUV16Conv& c, bool f10bit)
+	{
+		const int t = Transparency(s[3]) + Transparency(s[7]) + Transparency(s2[3]) + Transparency(s2[7]);
+		const int b = s[0] + s[4] + s2[0] + s2[4];
+		const int g = s[1] + s[5] + s2[1] + s2[5];
+		const int r = s[2] + s[6] + s2[2] + s2[6];
+		const int u = (c.ub * b + c.ug * g + c.ur * r + 256) >> 9;
+		const int v = (c.vb * b + c.vg * g + c.vr * r + 256) >> 9;
+		d[0] = ClipP01x(((d[0] * t + (1024 - t) * 0x8000 + 512) >> 10) + u, f10bit);
+		d[1] = ClipP01x(((d[1] * t + (1024 - t) * 0x8000 + 512) >> 10) + v, f10bit);
+	}
+
+	// exact 32 bit products of the 16 bit lanes of d and t, halves in order
+	template<class S>
+	__forceinline void Mul16(typename S::V d, typename S::V t, typename S::V& lo, typename S::V& hi)
+	{
+		const typename S::V pl = S::unpackorder(S::mullo16(d, t));
+		const typename S::V ph = S::unpackorder(S::mulhi16u(d, t));
+		lo = S::unpacklo16(pl, ph);
+		hi = S::unpackhi16(pl, ph);
+	}
+
+	template<class S>
+	__forceinline typename S::V StoreP01x(typename S::V lo, typename S::V hi, bool f10bit)
+	{
+		const typename S::V v = S::packus32(lo, hi);
+		return f10bit ? S::and_(S::adds16u(v, S::set1_16(0x20)), S::set1_16(short(0xffc0))) : v;
+	}
+
+	template<class S>
+	void AlphaBlt_P01x_Y(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch, const YUV16Conv& c, bool f10bit)
+	{
+		typedef typename S::V V;
+		const V ky = S::unpacklo16(S::set2(c.yb, c.yr), S::set2(c.yg, 0));
+
+		for (ptrdiff_t j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+			WORD* d2 = (WORD*)d;
+			int i = 0;
+			for (; i + S::N * 2 <= w; i += S::N * 2) {
+				V y[2], t[2];
+				for (int k = 0; k < 2; k++) {
+					const V px = S::load(s + (i + S::N * k) * 4);
+					y[k] = S::template srai<7>(S::add(S::hadd(S::madd(S::unpacklo8(px), ky), S::madd(S::unpackhi8(px), ky)), S::set1(64)));
+					t[k] = S::template srli<24>(px);
+					t[k] = S::sub(t[k], S::cmpeq(t[k], S::set1(0xff)));
+				}
+
+				V lo, hi;
+				Mul16<S>(S::load((BYTE*)(d2 + i)), S::packs32(t[0], t[1]), lo, hi);
+				V r[2] = {lo, hi};
+				for (int k = 0; k < 2; k++) {
+					if (c.yOffset) {
+						r[k] = S::add(r[k], S::template slli<12>(S::sub(S::set1(256), t[k])));
+					}
+					r[k] = S::add(S::template srli<8>(S::add(r[k], S::set1(128))), y[k]);
+				}
+				S::store((BYTE*)(d2 + i), StoreP01x<S>(r[0], r[1], f10bit));
+			}
+			AlphaBlt_P01x_Y_C(d2 + i, s + i * 4, w - i, c, f10bit);
+		}
+	}
+
+	template<class S>
+	void AlphaBlt_P01x_UV(int w, int h2, BYTE* d, int dstpitch, const BYTE* s, int srcpitch, const YUV16Conv& c, bool f10bit)
+	{
+		typedef typename S::V V;
+		const V ku = S::unpacklo16(S::set2(c.ub, c.ur), S::set2(c.ug, 0));
+		const V kv = S::unpacklo16(S::set2(c.vb, c.vr), S::set2(c.vg, 0));
+		const V evenMask = S::srli64(S::set1(-1));
+		// 1 in the alpha words of the unpacked pixels
+		const V alphaOne = S::slli64(S::set1(0x10000));
+		const int w2 = (w + 1) / 2;
+
+		for (ptrdiff_t j = 0; j < h2; j++, s += srcpitch * 2, d += dstpitch) {
+			WORD* d2 = (WORD*)d;
+			int i = 0;
+			for (; (i + S::N) * 2 <= w; i += S::N) {
+				V uv[2], t[2];
+				for (int k = 0; k < 2; k++) {
+					const V p = S::load(s + (i + S::N / 2 * k) * 8);
+					const V q = S::load(s + (i + S::N / 2 * k) * 8 + srcpitch);
+					const V pl = S::unpacklo8(p), ph = S::unpackhi8(p);
+					const V ql = S::unpacklo8(q), qh = S::unpackhi8(q);
+					const V lo = S::add16(S::add16(pl, S::and_(S::cmpeq16(pl, S::set1_16(0xff)), alphaOne)),
+										  S::add16(ql, S::and_(S::cmpeq16(ql, S::set1_16(0xff)), alphaOne)));
+					const V hi = S::add16(S::add16(ph, S::and_(S::cmpeq16(ph, S::set1_16(0xff)), alphaOne)),
+										  S::add16(qh, S::and_(S::cmpeq16(qh, S::set1_16(0xff)), alphaOne)));
+					// the sums of the 2x2 blocks, B G R T of one block per 64 bits
+					const V x = S::add16(S::unpacklo64(lo, hi), S::unpackhi64(lo, hi));
+
+					const V mu = S::madd(x, ku), mv = S::madd(x, kv);
+					const V u = S::add(mu, S::srli64(mu));
+					const V v = S::add(mv, S::slli64(mv));
+					uv[k] = S::template srai<9>(S::add(S::or_(S::and_(u, evenMask), S::andnot(evenMask, v)), S::set1(256)));
+
+					t[k] = S::template srli<16>(S::srli64(x));
+					t[k] = S::or_(t[k], S::slli64(t[k]));
+				}
+
+				V lo, hi;
+				Mul16<S>(S::load((BYTE*)(d2 + i * 2)), S::packs32(t[0], t[1]), lo, hi);
+				V r[2] = {lo, hi};
+				for (int k = 0; k < 2; k++) {
+					r[k] = S::add(r[k], S::template slli<15>(S::sub(S::set1(1024), t[k])));
+					r[k] = S::add(S::template srli<10>(S::add(r[k], S::set1(512))), uv[k]);
+				}
+				S::store((BYTE*)(d2 + i * 2), StoreP01x<S>(r[0], r[1], f10bit));
+			}
+			for (; i < w2; i++) {
+				AlphaBlt_P01x_UV_C(d2 + i * 2, s + i * 8, s + i * 8 + srcpitch, c, f10bit);
+			}
+		}
+	}
+}
+
+#ifdef _DEBUG
+namespace
+{
+	template<class S>
+	bool CheckAlphaBltP01x(CRandomRows& r)
+	{
+		for (int matrix : s_matrices) {
+			for (int range = 0; range < 4; range++) {
+				const YUV16Conv& c = GetYUV16Conv(matrix, !!(range & 1));
+				const bool f10bit = !!(range & 2);
+
+				for (int w = 1; w <= 75; w += 2) {
+					const int w2 = (w + 1) / 2;
+					const int srcpitch = w * 4 + 32;
+					const std::vector<BYTE> s = r.Pixels(w + 8 + w);
+
+					std::vector<BYTE> y = r.Bytes(w * 2), y2 = y;
+					AlphaBlt_P01x_Y<S>(w, 1, y.data(), w * 2, s.data(), srcpitch, c, f10bit);
+					AlphaBlt_P01x_Y_C((WORD*)y2.data(), s.data(), w, c, f10bit);
+
+					std::vector<BYTE> uv = r.Bytes(w2 * 4), uv2 = uv;
+					AlphaBlt_P01x_UV<S>(w, 1, uv.data(), w2 * 4, s.data(), srcpitch, c, f10bit);
+					for (int i = 0; i < w2; i++) {
+						AlphaBlt_P01x_UV_C((WORD*)uv2.data() + i * 2, s.data() + i * 8, s.data() + i * 8 + srcpitch, c, f10bit);
+					}
+
+					if (y != y2 || uv != uv2) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	bool CheckAlphaBltP01x()
+	{
+		CRandomRows r;
+		return CheckAlphaBltP01x<SSE2>(r) && (!CPUInfo::HaveAVX2() || CheckAlphaBltP01x<AVX2>(r));
+	}
+}
+#endif
+
+// RGB blending of AlphaBlt(). The kernels reproduce the 32 bit arithmetic of the
+// C rows exactly, carries between the packed channels included.
+
+namespace
+{
+	void AlphaBlt_RGBA_C(DWORD* d, const BYTE* s, int w)
+	{
+		for (const BYTE* e = s + w * 4; s < e; s += 4, d++) {
+			if (s[3] < 0xff) {
+				DWORD bd =0x00000100 -( (DWORD) s[3]);
+				DWORD B = ((*((DWORD*)s)&0x000000ff)<<8)/bd;
+				DWORD V = ((*((DWORD*)s)&0x0000ff00)/bd)<<8;
+				DWORD R = (((*((DWORD*)s)&0x00ff0000)>>8)/bd)<<16;
+				*d = B | V | R
+					 | (0xff000000-(*((DWORD*)s)&0xff000000))&0xff000000;
+			}
+		}
+	}
+
+	void AlphaBlt_RGB32_C(DWORD* d, const BYTE* s, int w)
+	{
+		for (const BYTE* e = s + w * 4; s < e; s += 4, d++) {
+#ifdef _WIN64
+			DWORD ia = 256-s[3];
+			if (s[3] < 0xff) {
+				*d = ((((*d&0x00ff00ff)*s[3])>>8) + (((*((DWORD*)s)&0x00ff00ff)*ia)>>8)&0x00ff00ff)
+					 | ((((*d&0x0000ff00)*s[3])>>8) + (((*((DWORD*)s)&0x0000ff00)*ia)>>8)&0x0000ff00);
+			}
+#else
+			if (s[3] < 0xff) {
+				*d = ((((*d&0x00ff00ff)*s[3])>>8) + (*((DWORD*)s)&0x00ff00ff)&0x00ff00ff)
+					 | ((((*d&0x0000ff00)*s[3])>>8) + (*((DWORD*)s)&0x0000ff00)&0x0000ff00);
+			}
+#endif
+		}
+	}
+
+	void AlphaBlt_RGB24_C(BYTE* d, const BYTE* s, int w)
+	{
+		for (const BYTE* e = s + w * 4; s < e; s += 4, d += 3) {
+			if (s[3] < 0xff) {
+				d[0] = ((d[0] *s[3]) >> 8) + s[0];
+				d[1] = ((d[1] *s[3]) >> 8) + s[1];
+				d[2] = ((d[2] *s[3]) >> 8) + s[2];
+			}
+		}
+	}
+
+	// RGB565 and RGB555 with the masks of the red/blue and of the green bits,
+	// Unlock() left 5 bit transparency in the alpha byte
+	void AlphaBlt_RGB16_C(WORD* d, const BYTE* s, int w, DWORD rb, DWORD g)
+	{
+		for (const BYTE* e = s + w * 4; s < e; s += 4, d++) {
+			if (s[3] < 0x1f) {
+				*d = (WORD)((((((*d&rb)*s[3])>>5) + (*(DWORD*)s&rb))&rb)
+							| (((((*d&g)*s[3])>>5) + (*(DWORD*)s&g))&g));
+			}
+		}
+	}
+
+	template<class S>
+	void AlphaBlt_RGBA(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+	{
+		typedef typename S::V V;
+		const V mask = S::set1(0xff);
+
+		for (ptrdiff_t j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+			int i = 0;
+			for (; i + S::N <= w; i += S::N) {
+				const V px = S::load(s + i * 4);
+				const V a = S::template srli<24>(px);
+				const V bd = S::sub(S::set1(0x100), a);
+				const V b = S::divtrunc(S::template slli<8>(S::and_(px, mask)), bd);
+				const V g = S::template slli<8>(S::divtrunc(S::and_(px, S::set1(0xff00)), bd));
+				const V r = S::template slli<16>(S::divtrunc(S::and_(S::template srli<8>(px), S::set1(0xff00)), bd));
+				const V out = S::or_(S::or_(b, g), S::or_(r, S::template slli<24>(S::sub(mask, a))));
+
+				const V keep = S::cmpeq(a, mask);
+				S::store(d + i * 4, S::or_(S::and_(keep, S::load(d + i * 4)), S::andnot(keep, out)));
+			}
+			AlphaBlt_RGBA_C((DWORD*)d + i, s + i * 4, w - i);
+		}
+	}
+
+	template<class S>
+	void AlphaBlt_RGB32(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+	{
+		typedef typename S::V V;
+		const V mask = S::set1(0xff);
+		const V rbMask = S::set1(0x00ff00ff);
+		const V gMask = S::set1(0x0000ff00);
+
+		for (ptrdiff_t j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+			int i = 0;
+			for (; i + S::N <= w; i += S::N) {
+				const V sp = S::load(s + i * 4);
+				const V dp = S::load(d + i * 4);
+				const V a = S::template srli<24>(sp);
+
+				// every channel times an 8 bit factor fits in its 16 bit half
+				V rb = S::template srli<8>(S::mullo16(S::and_(dp, rbMask), S::or_(a, S::template slli<16>(a))));
+				V g = S::mullo16(S::and_(S::template srli<8>(dp), mask), a);
+#ifdef _WIN64
+				const V ia = S::sub(S::set1(0x100), a);
+				rb = S::add(rb, S::template srli<8>(S::mullo16(S::and_(sp, rbMask), S::or_(ia, S::template slli<16>(ia)))));
+				g = S::add(g, S::mullo16(S::and_(S::template srli<8>(sp), mask), ia));
+#else
+				rb = S::add(rb, S::and_(sp, rbMask));
+				g = S::add(g, S::and_(sp, gMask));
+#endif
+				const V out = S::or_(S::and_(rb, rbMask), S::and_(g, gMask));
+
+				const V keep = S::cmpeq(a, mask);
+				S::store(d + i * 4, S::or_(S::and_(keep, dp), S::andnot(keep, out)));
+			}
+			AlphaBlt_RGB32_C((DWORD*)d + i, s + i * 4, w - i);
+		}
+	}
+
+	// packed 24 bit pixels need pshufb, 16 pixels a time
+	void AlphaBlt_RGB24_SSSE3(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+	{
+		const __m128i rgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		const __m128i alpha = _mm_setr_epi8(3, 3, 3, 7, 7, 7, 11, 11, 11, 15, 15, 15, -1, -1, -1, -1);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_set1_epi16(0xff);
+
+		for (ptrdiff_t j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+			int i = 0;
+			for (; i + 16 <= w; i += 16) {
+				__m128i c[4], a[4];
+				for (int k = 0; k < 4; k++) {
+					const __m128i px = _mm_loadu_si128((const __m128i*)(s + (i + k * 4) * 4));
+					c[k] = _mm_shuffle_epi8(px, rgb);
+					a[k] = _mm_shuffle_epi8(px, alpha);
+				}
+
+				// 4 times 12 bytes to 3 times 16 bytes
+				const __m128i cc[3] = {
+					_mm_or_si128(c[0], _mm_slli_si128(c[1], 12)),
+					_mm_or_si128(_mm_srli_si128(c[1], 4), _mm_slli_si128(c[2], 8)),
+					_mm_or_si128(_mm_srli_si128(c[2], 8), _mm_slli_si128(c[3], 4)),
+				};
+				const __m128i aa[3] = {
+					_mm_or_si128(a[0], _mm_slli_si128(a[1], 12)),
+					_mm_or_si128(_mm_srli_si128(a[1], 4), _mm_slli_si128(a[2], 8)),
+					_mm_or_si128(_mm_srli_si128(a[2], 8), _mm_slli_si128(a[3], 4)),
+				};
+
+				for (int k = 0; k < 3; k++) {
+					__m128i* p = (__m128i*)(d + i * 3 + k * 16);
+					const __m128i dp = _mm_loadu_si128(p);
+					const __m128i lo = _mm_and_si128(_mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dp, zero), _mm_unpacklo_epi8(aa[k], zero)), 8), _mm_unpacklo_epi8(cc[k], zero)), mask);
+					const __m128i hi = _mm_and_si128(_mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dp, zero), _mm_unpackhi_epi8(aa[k], zero)), 8), _mm_unpackhi_epi8(cc[k], zero)), mask);
+					const __m128i keep = _mm_cmpeq_epi8(aa[k], _mm_set1_epi8(-1));
+					_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep, dp), _mm_andnot_si128(keep, _mm_packus_epi16(lo, hi))));
+				}
+			}
+			AlphaBlt_RGB24_C(d + i * 3, s + i * 4, w - i);
+		}
+	}
+
+	// bits 5..20 of the products of the 16 bit lanes of x and a
+	template<class S>
+	__forceinline typename S::V MulShift5(typename S::V x, typename S::V a)
+	{
+		return S::or_(S::template srli16<5>(S::mullo16(x, a)), S::template slli16<11>(S::mulhi16u(x, a)));
+	}
+
+	template<class S>
+	void AlphaBlt_RGB16(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch, DWORD rb, DWORD g)
+	{
+		typedef typename S::V V;
+		const V rbMask = S::set1_16(short(rb));
+		const V gMask = S::set1_16(short(g));
+
+		for (ptrdiff_t j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+			int i = 0;
+			for (; i + S::N * 2 <= w; i += S::N * 2) {
+				const V p0 = S::load(s + i * 4);
+				const V p1 = S::load(s + i * 4 + S::N * 4);
+				const V a = S::packs32(S::template srli<24>(p0), S::template srli<24>(p1));
+				const V c = S::packs32(S::template srai<16>(S::template slli<16>(p0)), S::template srai<16>(S::template slli<16>(p1)));
+				const V dp = S::load(d + i * 2);
+
+				const V out = S::or_(S::and_(S::add16(MulShift5<S>(S::and_(dp, rbMask), a), S::and_(c, rbMask)), rbMask),
+									 S::and_(S::add16(MulShift5<S>(S::and_(dp, gMask), a), S::and_(c, gMask)), gMask));
+
+				const V keep = S::cmpgt16(a, S::set1_16(0x1e));
+				S::store(d + i * 2, S::or_(S::and_(keep, dp), S::andnot(keep, out)));
+			}
+			AlphaBlt_RGB16_C((WORD*)d + i, s + i * 4, w - i, rb, g);
+		}
+	}
+}
+
+#ifdef _DEBUG
+namespace
+{
+	template<class S>
+	bool CheckAlphaBltRGB(CRandomRows& r)
+	{
+		for (int w = 1; w <= 75; w += 2) {
+			const std::vector<BYTE> s = r.Pixels(w);
+
+			std::vector<BYTE> rgba = r.Bytes(w * 4), rgba2 = rgba;
+			AlphaBlt_RGBA<S>(w, 1, rgba.data(), w * 4, s.data(), w * 4);
+			AlphaBlt_RGBA_C((DWORD*)rgba2.data(), s.data(), w);
+
+			std::vector<BYTE> rgb32 = r.Bytes(w * 4), rgb32_2 = rgb32;
+			AlphaBlt_RGB32<S>(w, 1, rgb32.data(), w * 4, s.data(), w * 4);
+			AlphaBlt_RGB32_C((DWORD*)rgb32_2.data(), s.data(), w);
+
+			if (rgba != rgba2 || rgb32 != rgb32_2) {
+				return false;
+			}
+
+			// Unlock() left 5 bit transparency
+			const std::vector<BYTE> s16 = r.Pixels(w, 0x1f);
+			const DWORD masks[][2] = {{0xf81f, 0x07e0}, {0x7c1f, 0x03e0}};
+			for (const auto& m : masks) {
+				std::vector<BYTE> rgb16 = r.Bytes(w * 2), rgb16_2 = rgb16;
+				AlphaBlt_RGB16<S>(w, 1, rgb16.data(), w * 2, s16.data(), w * 4, m[0], m[1]);
+				AlphaBlt_RGB16_C((WORD*)rgb16_2.data(), s16.data(), w, m[0], m[1]);
+				if (rgb16 != rgb16_2) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool CheckAlphaBltRGB()
+	{
+		CRandomRows r;
+
+		if (CPUInfo::HaveSSSE3()) {
+			for (int w = 1; w <= 75; w += 2) {
+				const std::vector<BYTE> s = r.Pixels(w);
+				std::vector<BYTE> rgb24 = r.Bytes(w * 3), rgb24_2 = rgb24;
+				AlphaBlt_RGB24_SSSE3(w, 1, rgb24.data(), w * 3, s.data(), w * 4);
+				AlphaBlt_RGB24_C(rgb24_2.data(), s.data(), w);
+				if (rgb24 != rgb24_2) {
+					return false;
+				}
+			}
+		}
+
+		return CheckAlphaBltRGB<SSE2>(r) && (!CPUInfo::HaveAVX2() || CheckAlphaBltRGB<AVX2>(r));
+	}
+}
+#endif
+
 STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 {
 	ASSERT(pTarget);
@@ -336,14 +1488,45 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 		return E_POINTER;
 	}
 
-	const SubPicDesc& src = m_spd;
-	SubPicDesc dst = *pTarget;
+	if (m_spd.type != pTarget->type) {
+		return E_INVALIDARG;
+	}
 
-	if (src.type != dst.type) {
+	const CRect rs(*pSrc), rd(*pDst);
+
+	if (rd.top > rd.bottom) {
+		return AlphaBltRect(rs, rd, pTarget);
+	}
+
+	if (rs.Size() != rd.Size()) {
 		return E_INVALIDARG;
 	}
 
-	CRect rs(*pSrc), rd(*pDst);
+	// only the rectangles of the dirty region hold subtitles, the gaps between them are clear
+	const CPoint offset = rd.TopLeft() - rs.TopLeft();
+	for (int i = 0; i < m_dirtyRegion.nRects; i++) {
+		CRect rcSrc;
+		if (!rcSrc.IntersectRect(rs, &m_dirtyRegion.rects[i])) {
+			continue;
+		}
+
+		HRESULT hr = AlphaBltRect(rcSrc, rcSrc + offset, pTarget);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+
+	return S_OK;
+}
+
+// private
+
+HRESULT CMemSubPic::AlphaBltRect(const CRect& rcSrc, const CRect& rcDst, SubPicDesc* pTarget)
+{
+	const SubPicDesc& src = m_spd;
+	SubPicDesc dst = *pTarget;
+
+	CRect rs(rcSrc), rd(rcDst);
 
 	if (dst.h < 0) {
 		dst.h		= -dst.h;
@@ -380,113 +1563,50 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 	switch (dst.type) {
 		case MSP_P010:
 		case MSP_P016:
-			{
-				// Alpha blend the Y plane. Source is UYxAVYxA packed values (converted by Unlock())
-				// destination is P010/P016 surface.
-				int bitDepth = (dst.type == MSP_P016) ? 16 : 10;
-
-				for(ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch)
-				{
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w * 4;
-					WORD* d2 = (WORD*)d;
-					for(; s2 < s2end; s2 += 4, d2++)
-					{
-						if(s2[3] < 0xff)
-						{
-							// Convert current luminance to 8-bit value.
-							WORD dstLum = d2[0] >> 8;
-
-							// Perform calculation in 8-bit.
-							WORD result = (((dstLum - 0x10) * s2[3]) >> 8) + s2[1];
-
-							// Convert to 10/16 bit value.
-							d2[0] = result << 8;
-						}
-					}
-				}
-
-				break;
+			// the Y plane, see the UV plane below
+			if (CPUInfo::HaveAVX2()) {
+				AlphaBlt_P01x_Y<AVX2>(w, h, d, dst.pitch, s, src.pitch, GetYUV16Conv(m_matrix, m_fFullRange), dst.type == MSP_P010);
+			} else {
+				AlphaBlt_P01x_Y<SSE2>(w, h, d, dst.pitch, s, src.pitch, GetYUV16Conv(m_matrix, m_fFullRange), dst.type == MSP_P010);
 			}
+			break;
 		case MSP_RGBA:
-				for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w * 4;
-					DWORD* d2 = (DWORD*)d;
-					for (; s2 < s2end; s2 += 4, d2++) {
-						if (s2[3] < 0xff) {
-							DWORD bd =0x00000100 -( (DWORD) s2[3]);
-							DWORD B = ((*((DWORD*)s2)&0x000000ff)<<8)/bd;
-							DWORD V = ((*((DWORD*)s2)&0x0000ff00)/bd)<<8;
-							DWORD R = (((*((DWORD*)s2)&0x00ff0000)>>8)/bd)<<16;
-							*d2 = B | V | R
-								  | (0xff000000-(*((DWORD*)s2)&0xff000000))&0xff000000;
-						}
-					}
-				}
+			if (CPUInfo::HaveAVX2()) {
+				AlphaBlt_RGBA<AVX2>(w, h, d, dst.pitch, s, src.pitch);
+			} else {
+				AlphaBlt_RGBA<SSE2>(w, h, d, dst.pitch, s, src.pitch);
+			}
 			break;
 		case MSP_RGB32:
 		case MSP_AYUV:
-				for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w*4;
-
-					DWORD* d2 = (DWORD*)d;
-					for (; s2 < s2end; s2 += 4, d2++) {
-#ifdef _WIN64
-						DWORD ia = 256-s2[3];
-						if (s2[3] < 0xff) {
-							*d2 = ((((*d2&0x00ff00ff)*s2[3])>>8) + (((*((DWORD*)s2)&0x00ff00ff)*ia)>>8)&0x00ff00ff)
-									| ((((*d2&0x0000ff00)*s2[3])>>8) + (((*((DWORD*)s2)&0x0000ff00)*ia)>>8)&0x0000ff00);
-						}
-#else
-						if (s2[3] < 0xff) {
-							*d2 = ((((*d2&0x00ff00ff)*s2[3])>>8) + (*((DWORD*)s2)&0x00ff00ff)&0x00ff00ff)
-									| ((((*d2&0x0000ff00)*s2[3])>>8) + (*((DWORD*)s2)&0x0000ff00)&0x0000ff00);
-						}
-#endif
-					}
-				}
+			if (CPUInfo::HaveAVX2()) {
+				AlphaBlt_RGB32<AVX2>(w, h, d, dst.pitch, s, src.pitch);
+			} else {
+				AlphaBlt_RGB32<SSE2>(w, h, d, dst.pitch, s, src.pitch);
+			}
 			break;
 		case MSP_RGB24:
+			if (CPUInfo::HaveSSSE3()) {
+				AlphaBlt_RGB24_SSSE3(w, h, d, dst.pitch, s, src.pitch);
+			} else {
 				for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w * 4;
-					BYTE* d2 = d;
-					for (; s2 < s2end; s2 += 4, d2 += 3) {
-						if (s2[3] < 0xff) {
-							d2[0] = ((d2[0] *s2[3]) >> 8) + s2[0];
-							d2[1] = ((d2[1] *s2[3]) >> 8) + s2[1];
-							d2[2] = ((d2[2] *s2[3]) >> 8) + s2[2];
-						}
-					}
+					AlphaBlt_RGB24_C(d, s, w);
 				}
+			}
 			break;
 		case MSP_RGB16:
-				for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w * 4;
-					WORD* d2 = (WORD*)d;
-					for (; s2 < s2end; s2 += 4, d2++) {
-						if (s2[3] < 0x1f) {
-							*d2 = (WORD)((((((*d2&0xf81f)*s2[3])>>5) + (*(DWORD*)s2&0xf81f))&0xf81f)
-										 | (((((*d2&0x07e0)*s2[3])>>5) + (*(DWORD*)s2&0x07e0))&0x07e0));
-						}
-					}
-				}
+			if (CPUInfo::HaveAVX2()) {
+				AlphaBlt_RGB16<AVX2>(w, h, d, dst.pitch, s, src.pitch, 0xf81f, 0x07e0);
+			} else {
+				AlphaBlt_RGB16<SSE2>(w, h, d, dst.pitch, s, src.pitch, 0xf81f, 0x07e0);
+			}
 			break;
 		case MSP_RGB15:
-				for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w * 4;
-					WORD* d2 = (WORD*)d;
-					for (; s2 < s2end; s2 += 4, d2++) {
-						if (s2[3] < 0x1f) {
-							*d2 = (WORD)((((((*d2&0x7c1f)*s2[3])>>5) + (*(DWORD*)s2&0x7c1f))&0x7c1f)
-										 | (((((*d2&0x03e0)*s2[3])>>5) + (*(DWORD*)s2&0x03e0))&0x03e0));
-						}
-					}
-				}
+			if (CPUInfo::HaveAVX2()) {
+				AlphaBlt_RGB16<AVX2>(w, h, d, dst.pitch, s, src.pitch, 0x7c1f, 0x03e0);
+			} else {
+				AlphaBlt_RGB16<SSE2>(w, h, d, dst.pitch, s, src.pitch, 0x7c1f, 0x03e0);
+			}
 			break;
 		case MSP_YUY2:
 			AlphaBlt_YUY2_SSE2(w, h, d, dst.pitch, s, src.pitch);
@@ -494,16 +1614,11 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 		case MSP_YV12:
 		case MSP_NV12:
 		case MSP_IYUV:
-				for (ptrdiff_t j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-					BYTE* s2 = s;
-					BYTE* s2end = s2 + w * 4;
-					BYTE* d2 = d;
-					for (; s2 < s2end; s2 += 4, d2++) {
-						if (s2[3] < 0xff) {
-							d2[0] = (((d2[0] - 0x10) * s2[3]) >> 8) + s2[1];
-						}
-					}
-				}
+			if (CPUInfo::HaveAVX2()) {
+				AlphaBlt_Y<AVX2>(w, h, d, dst.pitch, s, src.pitch);
+			} else {
+				AlphaBlt_Y<SSE2>(w, h, d, dst.pitch, s, src.pitch);
+			}
 			break;
 		default:
 				return E_NOTIMPL;
@@ -514,7 +1629,7 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 	if (dst.type == MSP_P010 || dst.type == MSP_P016) {
 		// Alpha blend UV plane. UV is interleaved. Each UV represents a 2x2 block of pixels
 		// so we need to sample the current row and the row after for source color info.
-		// Source is UYxAVYxA.
+		// Source is ARGB, see AlphaBlt_P01x_UV().
 		int h2 = h / 2;
 
 		BYTE* ss = (BYTE*)src.bits + src.pitch * rs.top + rs.left * 4;
@@ -529,32 +1644,10 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 			dstUV = dstUV + dst.pitch * rd.top / 2 + rd.left * 2;
 		}
 
-		for(ptrdiff_t j = 0; j < h2; j++, ss += src.pitch * 2, dstUV += dst.pitch) {
-			BYTE* srcData = ss;
-			BYTE* srcDataEnd = srcData + w * 4;
-			WORD* dstData = (WORD*)dstUV;
-			for (; srcData < srcDataEnd; srcData += 8, dstData += 2) {
-				// Sample 2x2 block of alpha values
-				unsigned int ia = (srcData[3] + srcData[3 + src.pitch] + srcData[7] + srcData[7 + src.pitch]) >> 2;
-
-				if (ia < 255) {
-					WORD result;
-
-					// Convert U to 8-bit
-					WORD dstUV = dstData[0] >> 8;
-
-					// Alpha blend U
-					result = (((dstUV - 0x80) * ia) >> 8) + ((srcData[0] + srcData[src.pitch]) >> 1);
-
-					// Convert U to 10/16 bit value;
-					dstData[0] = result << 8;
-
-					// Repeat for V
-					dstUV = dstData[1] >> 8;
-					result = (((dstUV - 0x80) * ia) >> 8) + ((srcData[4] + srcData[4 + src.pitch]) >> 1);
-					dstData[1] = result << 8;
-				}
-			}
+		if (CPUInfo::HaveAVX2()) {
+			AlphaBlt_P01x_UV<AVX2>(w, h2, dstUV, dst.pitch, ss, src.pitch, GetYUV16Conv(m_matrix, m_fFullRange), dst.type == MSP_P010);
+		} else {
+			AlphaBlt_P01x_UV<SSE2>(w, h2, dstUV, dst.pitch, ss, src.pitch, GetYUV16Conv(m_matrix, m_fFullRange), dst.type == MSP_P010);
 		}
 	} else if (dst.type == MSP_YV12 || dst.type == MSP_IYUV) {
 		int h2 = h / 2;
@@ -563,9 +1656,7 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 			dst.pitchUV = dst.pitch / 2;
 		}
 
-		BYTE* ss[2];
-		ss[0] = (BYTE*)src.bits + src.pitch * rs.top + rs.left * 4;
-		ss[1] = ss[0] + 4;
+		BYTE* ss = (BYTE*)src.bits + src.pitch * rs.top + rs.left * 4;
 
 		if (!dst.bitsU || !dst.bitsV) {
 			dst.bitsU = (BYTE*)dst.bits + dst.pitch * dst.h;
@@ -588,58 +1679,30 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 			dst.pitchUV = -dst.pitchUV;
 		}
 
-		for (ptrdiff_t i = 0; i < 2; i++) {
-			s = ss[i];
-			d = dd[i];
-			BYTE* is = ss[1-i];
-			for (ptrdiff_t j = 0; j < h2; j++, s += src.pitch * 2, d += dst.pitchUV, is += src.pitch * 2) {
-				BYTE* s2 = s;
-				BYTE* s2end = s2 + w * 4;
-				BYTE* d2 = d;
-				BYTE* is2 = is;
-				for (; s2 < s2end; s2 += 8, d2++, is2 += 8) {
-					unsigned int ia = (s2[3]+s2[3+src.pitch]+is2[3]+is2[3+src.pitch])>>2;
-					if (ia < 0xff) {
-						*d2 = (((*d2-0x80)*ia)>>8) + ((s2[0]+s2[src.pitch])>>1);
-					}
-				}
-			}
+		if (CPUInfo::HaveAVX2()) {
+			AlphaBlt_UV_Planar<AVX2>(w, h2, dd[0], dd[1], dst.pitchUV, ss, src.pitch);
+		} else {
+			AlphaBlt_UV_Planar<SSE2>(w, h2, dd[0], dd[1], dst.pitchUV, ss, src.pitch);
 		}
 	} else if (dst.type == MSP_NV12) {
 		int h2 = h/2;
 
-		BYTE* ss[2];
-		ss[0] = (BYTE*)src.bits + src.pitch * rs.top + rs.left * 4;
-		ss[1] = ss[0] + 4;
+		BYTE* ss = (BYTE*)src.bits + src.pitch * rs.top + rs.left * 4;
 
 		if (!dst.bitsU) {
 			dst.bitsU = (BYTE*)dst.bits + dst.pitch * dst.h;
 		}
 
-		BYTE* dd[2];
-		dd[0] = dst.bitsU + dst.pitch * rd.top / 2 + rd.left;
+		BYTE* dd = dst.bitsU + dst.pitch * rd.top / 2 + rd.left;
 		if (rd.top > rd.bottom) {
-			dd[0] = dst.bitsU + dst.pitch*(rd.top/2 - 1) + rd.left;
+			dd = dst.bitsU + dst.pitch*(rd.top/2 - 1) + rd.left;
 			dst.pitch = - dst.pitch;
 		}
-		dd[1] = dd[0] + 1;
-
-		for (ptrdiff_t i = 0; i < 2; i++) {
-			s = ss[i];
-			d = dd[i];
-			BYTE* is = ss[1-i];
-			for (ptrdiff_t j = 0; j < h2; j++, s += src.pitch * 2, d += dst.pitch, is += src.pitch * 2) {
-				BYTE* s2 = s;
-				BYTE* s2end = s2 + w * 4;
-				BYTE* d2 = d;
-				BYTE* is2 = is;
-				for (; s2 < s2end; s2 += 8, d2 += 2, is2 += 8) {
-					unsigned int ia = (s2[3]+s2[3+src.pitch]+is2[3]+is2[3+src.pitch])>>2;
-					if (ia < 255) {
-						*d2 = (((*d2-0x80)*ia)>>8) + ((s2[0]+s2[src.pitch])>>1);
-					}
-				}
-			}
+
+		if (CPUInfo::HaveAVX2()) {
+			AlphaBlt_UV_NV12<AVX2>(w, h2, dd, dst.pitch, ss, src.pitch);
+		} else {
+			AlphaBlt_UV_NV12<SSE2>(w, h2, dd, dst.pitch, ss, src.pitch);
 		}
 	}
 
@@ -654,7 +1717,20 @@ CMemSubPicAllocator::CMemSubPicAllocator(int type, SIZE maxsize)
 	: CSubPicAllocatorImpl(maxsize, false)
 	, m_type(type)
 	, m_maxsize(maxsize)
+	, m_matrix(MSP_BT601)
+	, m_fFullRange(false)
+{
+#ifdef _DEBUG
+	// the SIMD kernels must give the bytes of the C rows, checked once
+	static const bool fKernelsOK = CheckConvertRows() && CheckAlphaBlt420() && CheckAlphaBltP01x() && CheckAlphaBltRGB();
+	ASSERT(fKernelsOK);
+#endif
+}
+
+void CMemSubPicAllocator::SetYUVMatrix(int matrix, bool fFullRange)
 {
+	m_matrix = matrix;
+	m_fFullRange = fFullRange;
 }
 
 // ISubPicAllocatorImpl
@@ -676,10 +1752,12 @@ bool CMemSubPicAllocator::Alloc(bool fStatic, ISubPic** ppSubPic)
 		return false;
 	}
 
-	*ppSubPic = DNew CMemSubPic(spd);
-	if (!(*ppSubPic)) {
+	CMemSubPic* pSubPic = DNew CMemSubPic(spd);
+	if (!pSubPic) {
 		return false;
 	}
+	pSubPic->SetYUVMatrix(m_matrix, m_fFullRange);
+	*ppSubPic = pSubPic;
 
 	(*ppSubPic)->AddRef();
 
@@ -25,11 +25,23 @@
 
 enum {MSP_P010,MSP_P016,MSP_RGB32,MSP_RGB24,MSP_RGB16,MSP_RGB15,MSP_YUY2,MSP_NV12,MSP_YV12,MSP_IYUV,MSP_AYUV,MSP_RGBA};
 
+// YUV matrix of the conversion done by Unlock()
+enum {MSP_BT601,MSP_BT709,MSP_BT2020};
+
 // CMemSubPic
 
-class CMemSubPic : public CSubPicImpl
+class CMemSubPic : public CSubPicImpl, public ISubPicRegion
 {
 	SubPicDesc m_spd;
+	int m_matrix;
+	bool m_fFullRange;
+
+	// the rectangles of m_rcDirty that hold subtitles, the rest of the buffer is clear
+	SubPicRegion m_dirtyRegion;
+
+	void AlignDirtyRect(CRect& r) const;
+	void ConvertDirtyRect(const CRect& r);
+	HRESULT AlphaBltRect(const CRect& rcSrc, const CRect& rcDst, SubPicDesc* pTarget);
 
 protected:
 	STDMETHODIMP_(void*) GetObject(); // returns SubPicDesc*
@@ -38,13 +50,24 @@ public:
 	CMemSubPic(SubPicDesc& spd);
 	virtual ~CMemSubPic();
 
+	DECLARE_IUNKNOWN;
+	STDMETHODIMP NonDelegatingQueryInterface(REFIID riid, void** ppv);
+
+	void SetYUVMatrix(int matrix, bool fFullRange);
+
 	// ISubPic
 	STDMETHODIMP GetDesc(SubPicDesc& spd);
 	STDMETHODIMP CopyTo(ISubPic* pSubPic);
 	STDMETHODIMP ClearDirtyRect(DWORD color);
+	STDMETHODIMP SetDirtyRect(RECT* pDirtyRect);
 	STDMETHODIMP Lock(SubPicDesc& spd);
 	STDMETHODIMP Unlock(RECT* pDirtyRect);
 	STDMETHODIMP AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget);
+
+	// ISubPicRegion
+	STDMETHODIMP UnlockRegion(const SubPicRegion& region);
+	STDMETHODIMP GetDirtyRegion(SubPicRegion& region);
+	STDMETHODIMP SetDirtyRegion(const SubPicRegion& region);
 };
 
 // CMemSubPicAllocator
@@ -53,9 +76,14 @@ class CMemSubPicAllocator : public CSubPicAllocatorImpl
 {
 	int m_type;
 	CSize m_maxsize;
+	int m_matrix;
+	bool m_fFullRange;
 
 	bool Alloc(bool fStatic, ISubPic** ppSubPic);
 
 public:
 	CMemSubPicAllocator(int type, SIZE maxsize);
+
+	// applies to the subpictures allocated after the call, BT.601 limited range by default
+	void SetYUVMatrix(int matrix, bool fFullRange);
 };
@@ -136,12 +136,25 @@ HRESULT CSubPicQueueImpl::RenderTo(ISubPic* pSubPic, REFERENCE_TIME rtStart, REF
 		} else {
 			rtRender += (rtStop - rtStart - 1);
 		}
-		hr = pSubPicProvider->Render(spd, rtRender, fps, r);
+
+		// one dirty rectangle per subtitle when both the provider and the subpic support it
+		CComQIPtr<ISubPicProviderRegion> pProviderRegion = pSubPicProvider;
+		CComQIPtr<ISubPicRegion> pSubPicRegion = pSubPic;
+		SubPicRegion region;
+		if (pProviderRegion && pSubPicRegion) {
+			hr = pProviderRegion->RenderRegion(spd, rtRender, fps, r, region);
+		} else {
+			hr = pSubPicProvider->Render(spd, rtRender, fps, r);
+		}
 
 		pSubPic->SetStart(rtStart);
 		pSubPic->SetStop(rtStop);
 
-		pSubPic->Unlock(r);
+		if (pProviderRegion && pSubPicRegion) {
+			pSubPicRegion->UnlockRegion(region);
+		} else {
+			pSubPic->Unlock(r);
+		}
 	}
 
 	return hr;
@@ -0,0 +1,181 @@
+/*
+ * (C) 2003-2006 Gabest
+ * (C) 2006-2019 see Authors.txt
+ *
+ * This file is part of MPC-BE.
+ *
+ * MPC-BE is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-BE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include <list>
+#include "GlyphOutlineProvider.h"
+
+static CGlyphOutlineProviderSharedPtr s_pGlyphOutlineProvider = std::make_shared<CGDIGlyphOutlineProvider>();
+
+CGlyphOutlineProviderSharedPtr GetGlyphOutlineProvider()
+{
+	return std::atomic_load(&s_pGlyphOutlineProvider);
+}
+
+void SetGlyphOutlineProvider(const CGlyphOutlineProviderSharedPtr& pProvider)
+{
+	std::atomic_store(&s_pGlyphOutlineProvider, pProvider ? pProvider : std::make_shared<CGDIGlyphOutlineProvider>());
+}
+
+static void StyleToLogFont(STSStyle& style, LOGFONTW& lf)
+{
+	ZeroMemory(&lf, sizeof(lf));
+	lf <<= style;
+	lf.lfHeight = (LONG)(style.fontSize+0.5);
+	lf.lfOutPrecision = OUT_TT_PRECIS;
+	lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
+	lf.lfQuality = ANTIALIASED_QUALITY;
+	lf.lfPitchAndFamily = DEFAULT_PITCH|FF_DONTCARE;
+}
+
+// CMyFont
+
+CMyFont::CMyFont(STSStyle& style)
+{
+	LOGFONTW lf;
+	StyleToLogFont(style, lf);
+
+	if (!CreateFontIndirectW(&lf)) {
+		wcscpy_s(lf.lfFaceName, L"Arial");
+		CreateFontIndirectW(&lf);
+	}
+}
+
+// CGDIGlyphOutlineProvider
+
+struct CGDIGlyphOutlineProvider::CThreadContext {
+	static const size_t MAX_FONTS = 32;
+
+	HDC hDC;
+	// most recently used first
+	std::list<std::pair<LOGFONTW, std::unique_ptr<CMyFont>>> fonts;
+
+	CThreadContext() {
+		hDC = CreateCompatibleDC(NULL);
+		SetBkMode(hDC, TRANSPARENT);
+		SetTextColor(hDC, 0xffffff);
+		SetMapMode(hDC, MM_TEXT);
+	}
+
+	~CThreadContext() {
+		fonts.clear();
+		DeleteDC(hDC);
+	}
+
+	CMyFont& GetFont(STSStyle& style) {
+		LOGFONTW lf;
+		StyleToLogFont(style, lf);
+
+		for (auto it = fonts.begin(); it != fonts.end(); ++it) {
+			if (!memcmp(&it->first, &lf, sizeof(lf))) {
+				fonts.splice(fonts.begin(), fonts, it);
+				return *it->second;
+			}
+		}
+
+		fonts.emplace_front(lf, std::make_unique<CMyFont>(style));
+		if (fonts.size() > MAX_FONTS) {
+			fonts.pop_back();
+		}
+
+		return *fonts.front().second;
+	}
+};
+
+CGDIGlyphOutlineProvider::CThreadContext& CGDIGlyphOutlineProvider::GetThreadContext()
+{
+	static thread_local CThreadContext threadContext;
+	return threadContext;
+}
+
+bool CGDIGlyphOutlineProvider::GetFontMetrics(STSStyle& style, int& ascent, int& descent)
+{
+	CThreadContext& tc = GetThreadContext();
+
+	HFONT hOldFont = SelectFont(tc.hDC, tc.GetFont(style));
+	TEXTMETRICW tm;
+	bool bResult = !!GetTextMetricsW(tc.hDC, &tm);
+	SelectFont(tc.hDC, hOldFont);
+
+	if (!bResult) {
+		return false;
+	}
+
+	ascent = ((tm.tmAscent + 4) >> 3);
+	descent = ((tm.tmDescent + 4) >> 3);
+
+	return true;
+}
+
+bool CGDIGlyphOutlineProvider::GetTextExtent(STSStyle& style, LPCWSTR str, int len, CSize& extent)
+{
+	CThreadContext& tc = GetThreadContext();
+
+	HFONT hOldFont = SelectFont(tc.hDC, tc.GetFont(style));
+	bool bResult = !!GetTextExtentPoint32W(tc.hDC, str, len, &extent);
+	SelectFont(tc.hDC, hOldFont);
+
+	return bResult;
+}
+
+bool CGDIGlyphOutlineProvider::GetTextOutline(STSStyle& style, LPCWSTR str, int len, long dx, long dy,
+											  CAtlArray<BYTE>& types, CAtlArray<POINT>& points)
+{
+	CThreadContext& tc = GetThreadContext();
+
+	HFONT hOldFont = SelectFont(tc.hDC, tc.GetFont(style));
+
+	bool bResult = false;
+
+	if (::BeginPath(tc.hDC)) {
+		TextOutW(tc.hDC, 0, 0, str, len);
+		::CloseFigure(tc.hDC);
+
+		if (::EndPath(tc.hDC)) {
+			int nPoints = GetPath(tc.hDC, NULL, NULL, 0);
+
+			if (nPoints > 0) {
+				size_t base = types.GetCount();
+				types.SetCount(base + nPoints);
+				points.SetCount(base + nPoints);
+
+				if (nPoints == GetPath(tc.hDC, points.GetData() + base, types.GetData() + base, nPoints)) {
+					for (size_t i = base, j = base + nPoints; i < j; i++) {
+						points[i].x += dx;
+						points[i].y += dy;
+					}
+					bResult = true;
+				} else {
+					types.SetCount(base);
+					points.SetCount(base);
+				}
+			} else {
+				bResult = (nPoints == 0);
+			}
+		} else {
+			::AbortPath(tc.hDC);
+		}
+	}
+
+	SelectFont(tc.hDC, hOldFont);
+
+	return bResult;
+}
@@ -0,0 +1,66 @@
+/*
+ * (C) 2003-2006 Gabest
+ * (C) 2006-2019 see Authors.txt
+ *
+ * This file is part of MPC-BE.
+ *
+ * MPC-BE is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-BE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include "STS.h"
+
+// Font metrics and glyph outlines for the text renderer.
+// Implementations are called from several rendering threads at the same time.
+class IGlyphOutlineProvider
+{
+public:
+	virtual ~IGlyphOutlineProvider() = default;
+
+	// ascent and descent of the font, rounded to whole units like the rest of CWord
+	virtual bool GetFontMetrics(STSStyle& style, int& ascent, int& descent) PURE;
+	virtual bool GetTextExtent(STSStyle& style, LPCWSTR str, int len, CSize& extent) PURE;
+	// appends the outline of str moved by (dx, dy), point types are the GDI PT_* ones
+	virtual bool GetTextOutline(STSStyle& style, LPCWSTR str, int len, long dx, long dy,
+								CAtlArray<BYTE>& types, CAtlArray<POINT>& points) PURE;
+};
+
+typedef std::shared_ptr<IGlyphOutlineProvider> CGlyphOutlineProviderSharedPtr;
+
+// The provider used by all CText words, CGDIGlyphOutlineProvider unless replaced.
+CGlyphOutlineProviderSharedPtr GetGlyphOutlineProvider();
+void SetGlyphOutlineProvider(const CGlyphOutlineProviderSharedPtr& pProvider);
+
+class CMyFont : public CFont
+{
+public:
+	CMyFont(STSStyle& style);
+};
+
+// GDI backend, every thread has its own memory DC and font cache so nothing is serialized.
+class CGDIGlyphOutlineProvider : public IGlyphOutlineProvider
+{
+	struct CThreadContext;
+
+	static CThreadContext& GetThreadContext();
+
+public:
+	bool GetFontMetrics(STSStyle& style, int& ascent, int& descent) override;
+	bool GetTextExtent(STSStyle& style, LPCWSTR str, int len, CSize& extent) override;
+	bool GetTextOutline(STSStyle& style, LPCWSTR str, int len, long dx, long dy,
+						CAtlArray<BYTE>& types, CAtlArray<POINT>& points) override;
+};
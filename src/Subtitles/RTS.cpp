@@ -22,12 +22,9 @@
 #include "stdafx.h"
 #include <math.h>
 #include <intrin.h>
+#include <thread>
 #include "RTS.h"
 
-// WARNING: this isn't very thread safe, use only one RTS a time. We should use TLS in future.
-static HDC g_hDC;
-static int g_hDC_refcnt = 0;
-
 static long revcolor(long c)
 {
 	return ((c & 0xff0000) >> 16) + (c & 0xff00) + ((c & 0xff) << 16);
@@ -44,32 +41,6 @@ void alpha_mask_deleter::operator()(CAlphaMask* ptr) const noexcept
 	}
 }
 
-// CMyFont
-
-CMyFont::CMyFont(STSStyle& style)
-{
-	LOGFONTW lf;
-	ZeroMemory(&lf, sizeof(lf));
-	lf <<= style;
-	lf.lfHeight = (LONG)(style.fontSize+0.5);
-	lf.lfOutPrecision = OUT_TT_PRECIS;
-	lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
-	lf.lfQuality = ANTIALIASED_QUALITY;
-	lf.lfPitchAndFamily = DEFAULT_PITCH|FF_DONTCARE;
-
-	if (!CreateFontIndirectW(&lf)) {
-		wcscpy_s(lf.lfFaceName, L"Arial");
-		CreateFontIndirectW(&lf);
-	}
-
-	HFONT hOldFont = SelectFont(g_hDC, *this);
-	TEXTMETRICW tm;
-	EXECUTE_ASSERT(GetTextMetricsW(g_hDC, &tm));
-	m_ascent = ((tm.tmAscent + 4) >> 3);
-	m_descent = ((tm.tmDescent + 4) >> 3);
-	SelectFont(g_hDC, hOldFont);
-}
-
 // CWord
 
 CWord::CWord(STSStyle& style, CStringW str, int ktype, int kstart, int kend, double scalex, double scaley,
@@ -166,7 +137,7 @@ void CWord::Paint(const CPoint& p, const CPoint& org)
 						}
 					}
 
-					if (!CreateWidenedRegion(rx, ry)) {
+					if (!CreateWidenedRegion(rx, ry, m_renderingCaches.rasterizerOptions)) {
 						return;
 					}
 				} else if (m_style.borderStyle == 1) {
@@ -180,12 +151,12 @@ void CWord::Paint(const CPoint& p, const CPoint& org)
 
 			m_fDrawn = true;
 
-			if (!Rasterize(p.x & 7, p.y & 7, m_style.fBlur, m_style.fGaussianBlur)) {
+			if (!Rasterize(p.x & 7, p.y & 7, m_style.fBlur, m_style.fGaussianBlur, m_renderingCaches.rasterizerOptions)) {
 				return;
 			}
 			m_renderingCaches.overlayCache.SetAt(overlayKey, m_pOverlayData);
 		} else if ((m_p.x & 7) != (p.x & 7) || (m_p.y & 7) != (p.y & 7)) {
-			Rasterize(p.x & 7, p.y & 7, m_style.fBlur, m_style.fGaussianBlur);
+			Rasterize(p.x & 7, p.y & 7, m_style.fBlur, m_style.fGaussianBlur, m_renderingCaches.rasterizerOptions);
 			m_renderingCaches.overlayCache.SetAt(overlayKey, m_pOverlayData);
 		}
 	}
@@ -491,17 +462,17 @@ CText::CText(STSStyle& style, CStringW str, int ktype, int kstart, int kend, dou
 	CTextDimsKey textDimsKey(m_str, m_style);
 	CTextDims textDims;
 	if (!renderingCaches.textDimsCache.Lookup(textDimsKey, textDims)) {
-		CMyFont font(m_style);
-		m_ascent  = font.m_ascent;
-		m_descent = font.m_descent;
+		CGlyphOutlineProviderSharedPtr pProvider = GetGlyphOutlineProvider();
 
-		HFONT hOldFont = SelectFont(g_hDC, font);
+		if (!pProvider->GetFontMetrics(m_style, m_ascent, m_descent)) {
+			ASSERT(0);
+			return;
+		}
 
 		if (m_style.fontSpacing) {
 			for (LPCWSTR s = m_str; *s; s++) {
 				CSize extent;
-				if (!GetTextExtentPoint32W(g_hDC, s, 1, &extent)) {
-					SelectFont(g_hDC, hOldFont);
+				if (!pProvider->GetTextExtent(m_style, s, 1, extent)) {
 					ASSERT(0);
 					return;
 				}
@@ -510,16 +481,13 @@ CText::CText(STSStyle& style, CStringW str, int ktype, int kstart, int kend, dou
 			// m_width -= (int)m_style.fontSpacing; // TODO: subtract only at the end of the line
 		} else {
 			CSize extent;
-			if (!GetTextExtentPoint32W(g_hDC, m_str, str.GetLength(), &extent)) {
-				SelectFont(g_hDC, hOldFont);
+			if (!pProvider->GetTextExtent(m_style, m_str, str.GetLength(), extent)) {
 				ASSERT(0);
 				return;
 			}
 			m_width += extent.cx;
 		}
 
-		SelectFont(g_hDC, hOldFont);
-
 		textDims.ascent  = m_ascent;
 		textDims.descent = m_descent;
 		textDims.width   = m_width;
@@ -546,45 +514,119 @@ bool CText::Append(CWord* w)
 	return (dynamic_cast<CText*>(w) && CWord::Append(w));
 }
 
+// The glyphs of these characters are not shaped or combined with their neighbours,
+// so a word drawn at once looks the same as its glyphs drawn one after the other.
+static bool IsIsolatedGlyph(WCHAR c)
+{
+	return c < 0x0300
+		   || (c >= 0x0370 && c < 0x0483)	// Greek, Cyrillic
+		   || (c >= 0x048a && c < 0x0530)
+		   || (c >= 0x3000 && c < 0xa000 && c != 0x3099 && c != 0x309a) // CJK, kana
+		   || (c >= 0xac00 && c < 0xd7a4)	// Hangul syllables
+		   || (c >= 0xff00 && c < 0xfff0);	// halfwidth and fullwidth forms
+}
+
+CGlyphOutlineSharedPtr CText::GetGlyphOutline(IGlyphOutlineProvider* pProvider, LPCWSTR c)
+{
+	CGlyphOutlineKey glyphKey(*c, m_style);
+	CGlyphOutlineSharedPtr pGlyph;
+
+	if (!m_renderingCaches.glyphOutlineCache.Lookup(glyphKey, pGlyph)) {
+		pGlyph = std::make_shared<CGlyphOutline>();
+
+		CSize extent;
+		if (!pProvider->GetTextExtent(m_style, c, 1, extent)
+				|| !pProvider->GetTextOutline(m_style, c, 1, 0, 0, pGlyph->types, pGlyph->points)) {
+			return nullptr;
+		}
+		pGlyph->advance = extent.cx;
+
+		m_renderingCaches.glyphOutlineCache.SetAt(glyphKey, pGlyph);
+	}
+
+	return pGlyph;
+}
+
 bool CText::CreatePath()
 {
-	CMyFont font(m_style);
+	CGlyphOutlineProviderSharedPtr pProvider = GetGlyphOutlineProvider();
 
-	HFONT hOldFont = SelectFont(g_hDC, font);
+	CAtlArray<BYTE> types;
+	CAtlArray<POINT> points;
 
-	if (m_style.fontSpacing) {
-		int width = 0;
-		bool bFirstPath = true;
+	bool bPerGlyph = m_style.fontSpacing != 0;
+	if (!bPerGlyph && !m_style.fUnderline && !m_style.fStrikeOut) {
+		bPerGlyph = true;
+		for (LPCWSTR s = m_str; *s && bPerGlyph; s++) {
+			bPerGlyph = IsIsolatedGlyph(*s);
+		}
+	}
 
+	std::vector<CGlyphOutlineSharedPtr> glyphs;
+	if (bPerGlyph) {
+		int advance = 0;
 		for (LPCWSTR s = m_str; *s; s++) {
-			CSize extent;
-			if (!GetTextExtentPoint32W(g_hDC, s, 1, &extent)) {
-				SelectFont(g_hDC, hOldFont);
+			CGlyphOutlineSharedPtr pGlyph = GetGlyphOutline(pProvider.get(), s);
+			if (!pGlyph) {
 				ASSERT(0);
 				return false;
 			}
+			glyphs.emplace_back(pGlyph);
+			advance += pGlyph->advance;
+		}
+
+		if (!m_style.fontSpacing) {
+			// Without spacing the word is drawn at once. Its glyphs only line up like that when the
+			// font adds no overhang (synthetic bold or italic) or kerning to the single characters.
+			CTextDims textDims;
+			CSize extent;
+			if (m_renderingCaches.textDimsCache.Lookup(CTextDimsKey(m_str, m_style), textDims)) {
+				extent.cx = textDims.width;
+			} else if (!pProvider->GetTextExtent(m_style, m_str, m_str.GetLength(), extent)) {
+				extent.cx = -1;
+			}
+			bPerGlyph = advance == extent.cx;
+		}
+	}
+
+	if (bPerGlyph) {
+		int width = 0;
 
-			PartialBeginPath(g_hDC, bFirstPath);
-			bFirstPath = false;
-			TextOutW(g_hDC, 0, 0, s, 1);
-			PartialEndPath(g_hDC, width, 0);
+		for (const auto& pGlyph : glyphs) {
+			size_t base = types.GetCount(), count = pGlyph->types.GetCount();
+			types.SetCount(base + count);
+			points.SetCount(base + count);
+			memcpy(types.GetData() + base, pGlyph->types.GetData(), count * sizeof(BYTE));
+			for (size_t i = 0; i < count; i++) {
+				points[base + i].x = pGlyph->points[i].x + width;
+				points[base + i].y = pGlyph->points[i].y;
+			}
 
-			width += extent.cx + (int)m_style.fontSpacing;
+			width += pGlyph->advance + (int)m_style.fontSpacing;
 		}
 	} else {
-		CSize extent;
-		if (!GetTextExtentPoint32W(g_hDC, m_str, m_str.GetLength(), &extent)) {
-			SelectFont(g_hDC, hOldFont);
-			ASSERT(0);
+		if (!pProvider->GetTextOutline(m_style, m_str, m_str.GetLength(), 0, 0, types, points)) {
 			return false;
 		}
+	}
 
-		BeginPath(g_hDC);
-		TextOutW(g_hDC, 0, 0, m_str, m_str.GetLength());
-		EndPath(g_hDC);
+	int len = (int)types.GetCount();
+	if (mPathPoints != len) {
+		BYTE* pNewPathTypes = (BYTE*)realloc(mpPathTypes, len * sizeof(BYTE));
+		if (len && !pNewPathTypes) {
+			return false;
+		}
+		mpPathTypes = pNewPathTypes;
+		POINT* pNewPathPoints = (POINT*)realloc(mpPathPoints, len * sizeof(POINT));
+		if (len && !pNewPathPoints) {
+			return false;
+		}
+		mpPathPoints = pNewPathPoints;
+		mPathPoints = len;
 	}
 
-	SelectFont(g_hDC, hOldFont);
+	memcpy(mpPathTypes, types.GetData(), len * sizeof(BYTE));
+	memcpy(mpPathPoints, points.GetData(), len * sizeof(POINT));
 
 	return true;
 }
@@ -894,7 +936,15 @@ CAlphaMaskSharedPtr CClipper::GetAlphaMask(const std::shared_ptr<CClipper>& clip
 		return NULL;
 	}
 
-	const size_t alphaMaskSize = size_t(m_size.cx) * m_size.cy;
+	// Only the box covered by the clip shape is stored. The scroll and banner fades scale
+	// whole rows or columns, that keeps the zeros outside of a \clip but not the 0x40 of an \iclip.
+	CRect rect(x, y, x + w, y + h);
+	if (m_inverse && (m_effectType == EF_SCROLL || m_effectType == EF_BANNER)) {
+		rect.SetRect(0, 0, m_size.cx, m_size.cy);
+	}
+
+	const int pitch = rect.Width();
+	const size_t alphaMaskSize = size_t(pitch) * rect.Height();
 
 	try {
 		m_pAlphaMask = CAlphaMask::Alloc(m_renderingCaches.alphaMaskPool, alphaMaskSize);
@@ -904,32 +954,55 @@ CAlphaMaskSharedPtr CClipper::GetAlphaMask(const std::shared_ptr<CClipper>& clip
 		return NULL;
 	}
 
+	m_pAlphaMask->m_rect = rect;
+	m_pAlphaMask->m_outside = m_inverse ? 0x40 : 0;
+
 	BYTE* pAlphaMask = m_pAlphaMask->get();
-	memset(pAlphaMask, (m_inverse ? 0x40 : 0), alphaMaskSize);
+	if (rect.Width() != w || rect.Height() != h) {
+		memset(pAlphaMask, m_pAlphaMask->m_outside, alphaMaskSize);
+	}
 
 	const BYTE* src = m_pOverlayData->mpOverlayBufferBody + m_pOverlayData->mOverlayPitch * yo + xo;
-	BYTE* dst = pAlphaMask + m_size.cx * y + x;
+	BYTE* dst = pAlphaMask + pitch * (y - rect.top) + (x - rect.left);
 
-	memset(pAlphaMask, (m_inverse ? 0x40 : 0), m_size.cx * y + x);
 	if (m_inverse) {
 		for (ptrdiff_t i = 0; i < h; ++i) {
 			for (ptrdiff_t wt = 0; wt < w; ++wt) {
 				dst[wt] = 0x40 - src[wt];
 			}
 			src += m_pOverlayData->mOverlayPitch;
-			dst += m_size.cx;
+			dst += pitch;
 		}
 	} else {
 		for (ptrdiff_t i = 0; i < h; ++i) {
 			memcpy(dst, src, w * sizeof(BYTE));
 			src += m_pOverlayData->mOverlayPitch;
-			dst += m_size.cx;
+			dst += pitch;
 		}
 	}
 
+	// frame rows [from, to) of the stored box, scaled by a which moves by da per row
+	auto ScaleRows = [&](int from, int to, int a, int da) {
+		for (int j = from; j < to; j++, a += da) {
+			if (j >= rect.top && j < rect.bottom) {
+				BYTE* am = pAlphaMask + pitch * (j - rect.top);
+				for (ptrdiff_t i = 0; i < pitch; i++) {
+					am[i] = BYTE((am[i] * a) >> 14);
+				}
+			}
+		}
+	};
+	auto ZeroRows = [&](int from, int to) {
+		from = std::max(from, (int)rect.top);
+		to = std::min(to, (int)rect.bottom);
+		if (from < to) {
+			ZeroMemory(pAlphaMask + pitch * (from - rect.top), pitch * (to - from));
+		}
+	};
+
 	if (m_effectType == EF_SCROLL) {
 		int height = m_effect.param[4];
-		int spd_w = m_size.cx, spd_h = m_size.cy;
+		int spd_h = m_size.cy;
 		int da = (64 << 8) / height;
 		int a = 0;
 		int k = m_effect.param[0] >> 3;
@@ -943,15 +1016,8 @@ CAlphaMaskSharedPtr CClipper::GetAlphaMask(const std::shared_ptr<CClipper>& clip
 		}
 
 		if (k < spd_h) {
-			BYTE* am = &pAlphaMask[k * spd_w];
-
-			ZeroMemory(pAlphaMask, am - pAlphaMask);
-
-			for (ptrdiff_t j = k; j < l; j++, a += da) {
-				for (ptrdiff_t i = 0; i < spd_w; i++, am++) {
-					*am = BYTE(((*am) * a) >> 14);
-				}
-			}
+			ZeroRows(0, k);
+			ScaleRows(k, l, a, da);
 		}
 
 		da = -(64 << 8) / height;
@@ -967,45 +1033,37 @@ CAlphaMaskSharedPtr CClipper::GetAlphaMask(const std::shared_ptr<CClipper>& clip
 		}
 
 		if (k < spd_h) {
-			BYTE* am = &pAlphaMask[k * spd_w];
-
-			int j = k;
-			for (; j < l; j++, a += da) {
-				for (ptrdiff_t i = 0; i < spd_w; i++, am++) {
-					*am = BYTE(((*am) * a) >> 14);
-				}
-			}
-
-			ZeroMemory(am, (spd_h - j)*spd_w);
+			ScaleRows(k, l, a, da);
+			ZeroRows(std::max(k, l), spd_h);
 		}
 	} else if (m_effectType == EF_BANNER)  {
 		int width = m_effect.param[2];
-		int spd_w = m_size.cx, spd_h = m_size.cy;
+		int spd_w = m_size.cx;
 		int da = (64 << 8) / width;
-		BYTE* am = pAlphaMask;
-
-		for (ptrdiff_t j = 0; j < spd_h; j++, am += spd_w) {
-			int a = 0;
-			int k = std::min(width, spd_w);
-
-			for (ptrdiff_t i = 0; i < k; i++, a += da) {
-				am[i] = BYTE((am[i] * a) >> 14);
-			}
-
-			a = 0x40 << 8;
-			k = spd_w - width;
 
-			if (k < 0) {
-				a -= -k * da;
-				k = 0;
-			}
+		// the fade in over the first columns and the fade out over the last ones, in frame columns
+		const int k1 = std::min(width, spd_w);
+		int k2 = spd_w - width;
+		int a2 = 0x40 << 8;
+		if (k2 < 0) {
+			a2 -= -k2 * da;
+			k2 = 0;
+		}
 
-			for (ptrdiff_t i = k; i < spd_w; i++, a -= da) {
-				am[i] = BYTE((am[i] * a) >> 14);
+		BYTE* am = pAlphaMask;
+		for (ptrdiff_t j = rect.top; j < rect.bottom; j++, am += pitch) {
+			for (ptrdiff_t i = 0; i < pitch; i++) {
+				const int xf = rect.left + int(i);
+				if (xf < k1) {
+					am[i] = BYTE((am[i] * (xf * da)) >> 14);
+				}
+				if (xf >= k2) {
+					am[i] = BYTE((am[i] * (a2 - (xf - k2) * da)) >> 14);
+				}
 			}
 		}
-
 	}
+
 	m_renderingCaches.alphaMaskCache.SetAt(key, m_pAlphaMask);
 	return m_pAlphaMask;
 }
@@ -1096,16 +1154,21 @@ void CLine::Compact()
 	}
 }
 
-CRect CLine::PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha)
+// Moves a position in 1/8 pixels to the closest of nPhases subpixel positions per pixel
+static inline int SnapToPhase(int v, int nPhases)
 {
-	CRect bbox(0, 0, 0, 0);
+	const int step = 8 / nPhases;
+	return (v + step / 2) & ~(step - 1);
+}
 
+void CLine::PaintShadow(std::vector<CRasterizerDraw>& draws, CPoint p, CPoint org, int time, int alpha, int nPhases)
+{
 	POSITION pos = GetHeadPosition();
 	while (pos) {
 		CWord* w = GetNext(pos);
 
 		if (w->m_fLineBreak) {
-			return bbox;	// should not happen since this class is just a line of text without any breaks
+			return;	// should not happen since this class is just a line of text without any breaks
 		}
 
 		if (w->m_style.shadowDepthX != 0 || w->m_style.shadowDepthY != 0) {
@@ -1123,33 +1186,32 @@ CRect CLine::PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPo
 			COLORREF shadow = revcolor(w->m_style.colors[3]) | (a<<24);
 			DWORD sw[6] = {shadow, DWORD_MAX};
 
+			x = SnapToPhase(x, nPhases);
+			y = SnapToPhase(y, nPhases);
+
 			w->Paint(CPoint(x, y), org);
 
 			if (w->m_style.borderStyle == 0) {
-				bbox |= w->Draw(spd, clipRect, pAlphaMask, x, y, sw,
-								w->m_ktype > 0 || w->m_style.alpha[0] < 0xff,
-								(w->m_style.outlineWidthX+w->m_style.outlineWidthY > 0) && !(w->m_ktype == 2 && time < w->m_kstart));
+				w->AddDraw(draws, x, y, sw,
+						   w->m_ktype > 0 || w->m_style.alpha[0] < 0xff,
+						   (w->m_style.outlineWidthX+w->m_style.outlineWidthY > 0) && !(w->m_ktype == 2 && time < w->m_kstart));
 			} else if (w->m_style.borderStyle == 1 && w->m_pOpaqueBox) {
-				bbox |= w->m_pOpaqueBox->Draw(spd, clipRect, pAlphaMask, x, y, sw, true, false);
+				w->m_pOpaqueBox->AddDraw(draws, x, y, sw, true, false);
 			}
 		}
 
 		p.x += w->m_width;
 	}
-
-	return bbox;
 }
 
-CRect CLine::PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha)
+void CLine::PaintOutline(std::vector<CRasterizerDraw>& draws, CPoint p, CPoint org, int time, int alpha, int nPhases)
 {
-	CRect bbox(0, 0, 0, 0);
-
 	POSITION pos = GetHeadPosition();
 	while (pos) {
 		CWord* w = GetNext(pos);
 
 		if (w->m_fLineBreak) {
-			return bbox;	// should not happen since this class is just a line of text without any breaks
+			return;	// should not happen since this class is just a line of text without any breaks
 		}
 
 		if ((w->m_style.outlineWidthX + w->m_style.outlineWidthY > 0 || w->m_style.borderStyle == 1) && !(w->m_ktype == 2 && time < w->m_kstart)) {
@@ -1166,31 +1228,30 @@ CRect CLine::PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CP
 			COLORREF outline = revcolor(w->m_style.colors[2]) | ((0xff-aoutline)<<24);
 			DWORD sw[6] = {outline, DWORD_MAX};
 
+			x = SnapToPhase(x, nPhases);
+			y = SnapToPhase(y, nPhases);
+
 			w->Paint(CPoint(x, y), org);
 
 			if (w->m_style.borderStyle == 0) {
-				bbox |= w->Draw(spd, clipRect, pAlphaMask, x, y, sw, !w->m_style.alpha[0] && !w->m_style.alpha[1] && !alpha, true);
+				w->AddDraw(draws, x, y, sw, !w->m_style.alpha[0] && !w->m_style.alpha[1] && !alpha, true);
 			} else if (w->m_style.borderStyle == 1 && w->m_pOpaqueBox) {
-				bbox |= w->m_pOpaqueBox->Draw(spd, clipRect, pAlphaMask, x, y, sw, true, false);
+				w->m_pOpaqueBox->AddDraw(draws, x, y, sw, true, false);
 			}
 		}
 
 		p.x += w->m_width;
 	}
-
-	return bbox;
 }
 
-CRect CLine::PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha)
+void CLine::PaintBody(std::vector<CRasterizerDraw>& draws, CPoint p, CPoint org, int time, int alpha, int nPhases)
 {
-	CRect bbox(0, 0, 0, 0);
-
 	POSITION pos = GetHeadPosition();
 	while (pos) {
 		CWord* w = GetNext(pos);
 
 		if (w->m_fLineBreak) {
-			return bbox;	// should not happen since this class is just a line of text without any breaks
+			return;	// should not happen since this class is just a line of text without any breaks
 		}
 
 		int x = p.x;
@@ -1251,15 +1312,16 @@ CRect CLine::PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoin
 		sw[4] = sw[2];
 		sw[5] = 0x00ffffff;
 
+		x = SnapToPhase(x, nPhases);
+		y = SnapToPhase(y, nPhases);
+
 		w->Paint(CPoint(x, y), org);
 
 		sw[3] = (int)(w->m_style.outlineWidthX + t*w->getOverlayWidth() + t*bluradjust) >> 3;
 
-		bbox |= w->Draw(spd, clipRect, pAlphaMask, x, y, sw, true, false);
+		w->AddDraw(draws, x, y, sw, true, false);
 		p.x += w->m_width;
 	}
-
-	return bbox;
 }
 
 
@@ -1275,6 +1337,9 @@ CSubtitle::CSubtitle(RenderingCaches& renderingCaches)
 	, m_wrapStyle(0)
 	, m_fAnimated(false)
 	, m_bIsAnimated(false)
+	, m_animStableFrom(INT_MIN)
+	, m_animStableTo(INT_MAX)
+	, m_animDelay(0)
 	, m_relativeTo(1)
 	, m_topborder(0)
 	, m_bottomborder(0)
@@ -1538,31 +1603,28 @@ void CSubtitle::MakeLines(CSize size, const CRect& marginRect)
 
 void CScreenLayoutAllocator::Empty()
 {
-	m_subrects.RemoveAll();
+	m_layers.clear();
 }
 
 void CScreenLayoutAllocator::AdvanceToSegment(int segment, const CAtlArray<int>& sa)
 {
-	POSITION pos = m_subrects.GetHeadPosition();
-	while (pos) {
-		POSITION prev = pos;
+	std::vector<int> entries(sa.GetData(), sa.GetData() + sa.GetCount());
+	std::sort(entries.begin(), entries.end());
 
-		SubRect& sr = m_subrects.GetNext(pos);
+	for (auto it = m_layers.begin(); it != m_layers.end();) {
+		std::vector<SubRect>& subrects = it->second;
 
-		bool fFound = false;
+		auto last = std::remove_if(subrects.begin(), subrects.end(), [&](const SubRect& sr) {
+			// using abs() makes it possible to play the subs backwards, too :)
+			return abs(sr.segment - segment) > 1 || !std::binary_search(entries.begin(), entries.end(), sr.entry);
+		});
+		subrects.erase(last, subrects.end());
 
-		if (abs(sr.segment - segment) <= 1) { // using abs() makes it possible to play the subs backwards, too :)
-			for (size_t i = 0; i < sa.GetCount() && !fFound; i++) {
-				if (sa[i] == sr.entry) {
-					sr.segment = segment;
-					fFound = true;
-				}
-			}
+		for (SubRect& sr : subrects) {
+			sr.segment = segment;
 		}
 
-		if (!fFound) {
-			m_subrects.RemoveAt(prev);
-		}
+		it = subrects.empty() ? m_layers.erase(it) : std::next(it);
 	}
 }
 
@@ -1570,9 +1632,9 @@ CRect CScreenLayoutAllocator::AllocRect(const CSubtitle* s, int segment, int ent
 {
 	// TODO: handle collisions == 1 (reversed collisions)
 
-	POSITION pos = m_subrects.GetHeadPosition();
-	while (pos) {
-		SubRect& sr = m_subrects.GetNext(pos);
+	std::vector<SubRect>& subrects = m_layers[layer];
+
+	for (const SubRect& sr : subrects) {
 		if (sr.segment == segment && sr.entry == entry) {
 			return (sr.r + CRect(0, -s->m_topborder, 0, -s->m_bottomborder));
 		}
@@ -1580,151 +1642,242 @@ CRect CScreenLayoutAllocator::AllocRect(const CSubtitle* s, int segment, int ent
 
 	CRect r = s->m_rect + CRect(0, s->m_topborder, 0, s->m_bottomborder);
 
-	bool fSearchDown = s->m_scrAlignment > 3;
-
-	bool fOK;
-
-	do {
-		fOK = true;
+	if (!r.IsRectEmpty()) {
+		// Pushing r past every rect it overlaps until it overlaps none, in whatever order, only moves
+		// it one way and can't jump over a free position. So it stops at the first free one among
+		// where it starts and the edges of the rects, which a sweep over their y ranges finds directly.
+		std::vector<std::pair<int, int>> spans; // top, bottom of the rects sharing columns with r
+		for (const SubRect& sr : subrects) {
+			if (!sr.r.IsRectEmpty() && sr.r.left < r.right && r.left < sr.r.right) {
+				spans.emplace_back(sr.r.top, sr.r.bottom);
+			}
+		}
 
-		pos = m_subrects.GetHeadPosition();
-		while (pos) {
-			SubRect& sr = m_subrects.GetNext(pos);
+		const int height = r.Height();
 
-			if (layer == sr.layer && !(r & sr.r).IsRectEmpty()) {
-				if (fSearchDown) {
-					r.bottom = sr.r.bottom + r.Height();
-					r.top = sr.r.bottom;
-				} else {
-					r.top = sr.r.top - r.Height();
-					r.bottom = sr.r.top;
+		if (s->m_scrAlignment > 3) { // search down
+			std::vector<int> tops(1, r.top);
+			for (const auto& span : spans) {
+				if (span.second > r.top) {
+					tops.push_back(span.second);
+				}
+			}
+			std::sort(tops.begin(), tops.end());
+			std::sort(spans.begin(), spans.end());
+
+			size_t k = 0;
+			int maxBottom = INT_MIN;
+			for (int top : tops) {
+				for (; k < spans.size() && spans[k].first < top + height; k++) {
+					maxBottom = std::max(maxBottom, spans[k].second);
+				}
+				if (maxBottom <= top) {
+					r.top = top;
+					r.bottom = top + height;
+					break;
+				}
+			}
+		} else {
+			std::vector<int> bottoms(1, r.bottom);
+			for (const auto& span : spans) {
+				if (span.first < r.bottom) {
+					bottoms.push_back(span.first);
+				}
+			}
+			std::sort(bottoms.begin(), bottoms.end(), std::greater<int>());
+			std::sort(spans.begin(), spans.end(), [](const auto& a, const auto& b) {
+				return a.second > b.second;
+			});
+
+			size_t k = 0;
+			int minTop = INT_MAX;
+			for (int bottom : bottoms) {
+				for (; k < spans.size() && spans[k].second > bottom - height; k++) {
+					minTop = std::min(minTop, spans[k].first);
+				}
+				if (minTop >= bottom) {
+					r.top = bottom - height;
+					r.bottom = bottom;
+					break;
 				}
-
-				fOK = false;
 			}
 		}
-	} while (!fOK);
+	}
 
 	SubRect sr;
 	sr.r = r;
 	sr.segment = segment;
 	sr.entry = entry;
-	sr.layer = layer;
-	m_subrects.AddTail(sr);
+	subrects.push_back(sr);
 
 	return (sr.r + CRect(0, -s->m_topborder, 0, -s->m_bottomborder));
 }
 
+// CRenderingContext
+
+CRenderingContext::~CRenderingContext()
+{
+	Empty();
+
+	DLog(L"CRenderingContext : glyph outline cache, %Iu hits, %Iu misses",
+		 m_renderingCaches.glyphOutlineCache.GetHitCount(), m_renderingCaches.glyphOutlineCache.GetMissCount());
+}
+
+void CRenderingContext::Empty()
+{
+	POSITION pos = m_subtitleCache.GetStartPosition();
+	while (pos) {
+		int i;
+		CSubtitle* s;
+		m_subtitleCache.GetNextAssoc(pos, i, s);
+		delete s;
+	}
+
+	m_subtitleCache.RemoveAll();
+
+	m_renderedFrom = INT_MAX;
+	m_renderedTo = INT_MIN;
+}
+
 // CRenderedTextSubtitle
 
-CAtlMap<CStringW, SSATagCmd, CStringElementTraits<CStringW>> CRenderedTextSubtitle::s_SSATagCmds;
+namespace
+{
+	struct SSATagCmdName {
+		LPCWSTR name;
+		SSATagCmd cmd;
+	};
+
+	constexpr SSATagCmdName s_SSATagCmdNames[] = {
+		{L"1c", SSA_1c},
+		{L"2c", SSA_2c},
+		{L"3c", SSA_3c},
+		{L"4c", SSA_4c},
+		{L"1a", SSA_1a},
+		{L"2a", SSA_2a},
+		{L"3a", SSA_3a},
+		{L"4a", SSA_4a},
+		{L"alpha", SSA_alpha},
+		{L"an", SSA_an},
+		{L"a", SSA_a},
+		{L"blur", SSA_blur},
+		{L"bord", SSA_bord},
+		{L"be", SSA_be},
+		{L"b", SSA_b},
+		{L"clip", SSA_clip},
+		{L"iclip", SSA_iclip},
+		{L"c", SSA_c},
+		{L"fade", SSA_fade},
+		{L"fad", SSA_fade},
+		{L"fax", SSA_fax},
+		{L"fay", SSA_fay},
+		{L"fe", SSA_fe},
+		{L"fn", SSA_fn},
+		{L"frx", SSA_frx},
+		{L"fry", SSA_fry},
+		{L"frz", SSA_frz},
+		{L"fr", SSA_fr},
+		{L"fscx", SSA_fscx},
+		{L"fscy", SSA_fscy},
+		{L"fsc", SSA_fsc},
+		{L"fsp", SSA_fsp},
+		{L"fs", SSA_fs},
+		{L"i", SSA_i},
+		{L"kt", SSA_kt},
+		{L"kf", SSA_kf},
+		{L"K", SSA_K},
+		{L"ko", SSA_ko},
+		{L"k", SSA_k},
+		{L"move", SSA_move},
+		{L"org", SSA_org},
+		{L"pbo", SSA_pbo},
+		{L"pos", SSA_pos},
+		{L"p", SSA_p},
+		{L"q", SSA_q},
+		{L"r", SSA_r},
+		{L"shad", SSA_shad},
+		{L"s", SSA_s},
+		{L"t", SSA_t},
+		{L"u", SSA_u},
+		{L"xbord", SSA_xbord},
+		{L"xshad", SSA_xshad},
+		{L"ybord", SSA_ybord},
+		{L"yshad", SSA_yshad},
+#ifdef _VSMOD
+		{L"fsvp", SSA_fsvp},
+		{L"z", SSA_z},
+		{L"rnd", SSA_rnd},
+		{L"rndx", SSA_rndx},
+		{L"rndy", SSA_rndy},
+		{L"rndz", SSA_rndz},
+		{L"rnds", SSA_rnds},
+#endif
+	};
+
+	// Perfect hash of the names above, a collision fails the build
+	constexpr unsigned SSATagCmdHash(LPCWSTR str, int length)
+	{
+		return (str[0] * 21u + (length > 1 ? str[1] : 0) * 4u + str[length - 1] * 29u + length * 40u) & 255;
+	}
+
+	constexpr int SSATagCmdLength(LPCWSTR str)
+	{
+		int length = 0;
+		while (str[length]) {
+			length++;
+		}
+		return length;
+	}
+
+	struct SSATagCmdTable {
+		int index[256];
+		bool bCollision;
+	};
+
+	constexpr SSATagCmdTable BuildSSATagCmdTable()
+	{
+		SSATagCmdTable table = {};
+		for (int& index : table.index) {
+			index = -1;
+		}
+		for (int i = 0; i < _countof(s_SSATagCmdNames); i++) {
+			unsigned hash = SSATagCmdHash(s_SSATagCmdNames[i].name, SSATagCmdLength(s_SSATagCmdNames[i].name));
+			if (table.index[hash] >= 0) {
+				table.bCollision = true;
+			}
+			table.index[hash] = i;
+		}
+		return table;
+	}
+
+	constexpr SSATagCmdTable s_SSATagCmdTable = BuildSSATagCmdTable();
+	static_assert(!s_SSATagCmdTable.bCollision, "SSATagCmdHash has a collision");
+
+	// The longest command name cmd starts with, like "fad" for "fad(0,100)" or "fscx" for "fscx120"
+	SSATagCmd LookupSSATagCmd(LPCWSTR cmd, int length)
+	{
+		for (int len = std::min(SSA_CMD_MAX_LENGTH, length); len >= SSA_CMD_MIN_LENGTH; len--) {
+			const int i = s_SSATagCmdTable.index[SSATagCmdHash(cmd, len)];
+			if (i >= 0 && !wcsncmp(s_SSATagCmdNames[i].name, cmd, len) && !s_SSATagCmdNames[i].name[len]) {
+				return s_SSATagCmdNames[i].cmd;
+			}
+		}
+		return SSA_unknown;
+	}
+}
 
 CRenderedTextSubtitle::CRenderedTextSubtitle(CCritSec* pLock)
 	: CSubPicProviderImpl(pLock)
 	, m_bOverrideStyle(false)
 	, m_bOverridePlacement(false)
 	, m_overridePlacement(50, 90)
-	, m_time(0)
-	, m_delay(0)
-	, m_animStart(0)
-	, m_animEnd(0)
-	, m_animAccel(0.0)
-	, m_ktype(0)
-	, m_kstart(0)
-	, m_kend(0)
-	, m_nPolygon(0)
-	, m_polygonBaselineOffset(0)
 {
 	m_size = CSize(0, 0);
-
-	if (g_hDC_refcnt == 0) {
-		g_hDC = CreateCompatibleDC(NULL);
-		SetBkMode(g_hDC, TRANSPARENT);
-		SetTextColor(g_hDC, 0xffffff);
-		SetMapMode(g_hDC, MM_TEXT);
-	}
-
-	g_hDC_refcnt++;
-
-	if (s_SSATagCmds.IsEmpty()) {
-		s_SSATagCmds[L"1c"] = SSA_1c;
-		s_SSATagCmds[L"2c"] = SSA_2c;
-		s_SSATagCmds[L"3c"] = SSA_3c;
-		s_SSATagCmds[L"4c"] = SSA_4c;
-		s_SSATagCmds[L"1a"] = SSA_1a;
-		s_SSATagCmds[L"2a"] = SSA_2a;
-		s_SSATagCmds[L"3a"] = SSA_3a;
-		s_SSATagCmds[L"4a"] = SSA_4a;
-		s_SSATagCmds[L"alpha"] = SSA_alpha;
-		s_SSATagCmds[L"an"] = SSA_an;
-		s_SSATagCmds[L"a"] = SSA_a;
-		s_SSATagCmds[L"blur"] = SSA_blur;
-		s_SSATagCmds[L"bord"] = SSA_bord;
-		s_SSATagCmds[L"be"] = SSA_be;
-		s_SSATagCmds[L"b"] = SSA_b;
-		s_SSATagCmds[L"clip"] = SSA_clip;
-		s_SSATagCmds[L"iclip"] = SSA_iclip;
-		s_SSATagCmds[L"c"] = SSA_c;
-		s_SSATagCmds[L"fade"] = SSA_fade;
-		s_SSATagCmds[L"fad"] = SSA_fade;
-		s_SSATagCmds[L"fax"] = SSA_fax;
-		s_SSATagCmds[L"fay"] = SSA_fay;
-		s_SSATagCmds[L"fe"] = SSA_fe;
-		s_SSATagCmds[L"fn"] = SSA_fn;
-		s_SSATagCmds[L"frx"] = SSA_frx;
-		s_SSATagCmds[L"fry"] = SSA_fry;
-		s_SSATagCmds[L"frz"] = SSA_frz;
-		s_SSATagCmds[L"fr"] = SSA_fr;
-		s_SSATagCmds[L"fscx"] = SSA_fscx;
-		s_SSATagCmds[L"fscy"] = SSA_fscy;
-		s_SSATagCmds[L"fsc"] = SSA_fsc;
-		s_SSATagCmds[L"fsp"] = SSA_fsp;
-		s_SSATagCmds[L"fs"] = SSA_fs;
-		s_SSATagCmds[L"i"] = SSA_i;
-		s_SSATagCmds[L"kt"] = SSA_kt;
-		s_SSATagCmds[L"kf"] = SSA_kf;
-		s_SSATagCmds[L"K"] = SSA_K;
-		s_SSATagCmds[L"ko"] = SSA_ko;
-		s_SSATagCmds[L"k"] = SSA_k;
-		s_SSATagCmds[L"move"] = SSA_move;
-		s_SSATagCmds[L"org"] = SSA_org;
-		s_SSATagCmds[L"pbo"] = SSA_pbo;
-		s_SSATagCmds[L"pos"] = SSA_pos;
-		s_SSATagCmds[L"p"] = SSA_p;
-		s_SSATagCmds[L"q"] = SSA_q;
-		s_SSATagCmds[L"r"] = SSA_r;
-		s_SSATagCmds[L"shad"] = SSA_shad;
-		s_SSATagCmds[L"s"] = SSA_s;
-		s_SSATagCmds[L"t"] = SSA_t;
-		s_SSATagCmds[L"u"] = SSA_u;
-		s_SSATagCmds[L"xbord"] = SSA_xbord;
-		s_SSATagCmds[L"xshad"] = SSA_xshad;
-		s_SSATagCmds[L"ybord"] = SSA_ybord;
-		s_SSATagCmds[L"yshad"] = SSA_yshad;
-
-#ifdef _VSMOD
-		// patch m001. Vertical fontspacing
-		s_SSATagCmds[L"fsvp"] = SSA_fsvp;
-		// patch m002. Z-coord
-		s_SSATagCmds[L"z"] = SSA_z;
-		// patch m003. random text points
-		s_SSATagCmds[L"rnd"] = SSA_rnd;
-		s_SSATagCmds[L"rndx"] = SSA_rndx;
-		s_SSATagCmds[L"rndy"] = SSA_rndy;
-		s_SSATagCmds[L"rndz"] = SSA_rndz;
-		s_SSATagCmds[L"rnds"] = SSA_rnds;
-#endif
-	}
 }
 
 CRenderedTextSubtitle::~CRenderedTextSubtitle()
 {
 	Deinit();
-
-	g_hDC_refcnt--;
-	if (g_hDC_refcnt == 0) {
-		DeleteDC(g_hDC);
-	}
 }
 
 void CRenderedTextSubtitle::Copy(CSimpleTextSubtitle& sts)
@@ -1749,17 +1902,16 @@ void CRenderedTextSubtitle::OnChanged()
 {
 	__super::OnChanged();
 
-	POSITION pos = m_subtitleCache.GetStartPosition();
-	while (pos) {
-		int i;
-		CSubtitle* s;
-		m_subtitleCache.GetNextAssoc(pos, i, s);
-		delete s;
-	}
+	EmptyRenderingContexts();
+}
 
-	m_subtitleCache.RemoveAll();
+void CRenderedTextSubtitle::OnSegmentsChanged()
+{
+	__super::OnSegmentsChanged();
 
-	m_sla.Empty();
+	// the layouts are stored by segment index, the parsed subtitles stay valid
+	std::unique_lock<std::mutex> lock(m_mutexLayouts);
+	m_layouts.clear();
 }
 
 bool CRenderedTextSubtitle::Init(CSize size, const CRect& vidrect)
@@ -1769,27 +1921,166 @@ bool CRenderedTextSubtitle::Init(CSize size, const CRect& vidrect)
 	m_size = CSize(size.cx*8, size.cy*8);
 	m_vidrect = CRect(vidrect.left*8, vidrect.top*8, vidrect.right*8, vidrect.bottom*8);
 
-	m_sla.Empty();
-
 	return true;
 }
 
 void CRenderedTextSubtitle::Deinit()
 {
-	POSITION pos = m_subtitleCache.GetStartPosition();
-	while (pos) {
-		int i;
-		CSubtitle* s;
-		m_subtitleCache.GetNextAssoc(pos, i, s);
-		delete s;
+	EmptyRenderingContexts();
+
+	m_size = CSize(0, 0);
+	m_vidrect.SetRectEmpty();
+}
+
+CRenderingContextPtr CRenderedTextSubtitle::AcquireRenderingContext(int t)
+{
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	if (m_renderingContexts.empty()) {
+		CRenderingContextPtr ctx = std::make_unique<CRenderingContext>();
+		// all the others are rendering, they shrink to their new share when they are given back
+		m_nRenderingContexts++;
+		ctx->m_renderingCaches.SetMemoryBudget(GetContextCacheBudget());
+		ctx->m_renderingCaches.rasterizerOptions = m_rasterizerOptions;
+		return ctx;
 	}
 
-	m_subtitleCache.RemoveAll();
+	// prefer the context which rendered closest to t, the parsed subtitles and overlays are there
+	size_t best = m_renderingContexts.size() - 1;
+	if (t != INT_MIN) {
+		__int64 bestDistance = INT64_MAX;
+		for (size_t i = m_renderingContexts.size(); i-- > 0;) {
+			const CRenderingContext& ctx = *m_renderingContexts[i];
+			if (ctx.m_renderedFrom > ctx.m_renderedTo) {
+				continue;
+			}
+			const __int64 distance = t < ctx.m_renderedFrom ? __int64(ctx.m_renderedFrom) - t
+									 : t > ctx.m_renderedTo ? __int64(t) - ctx.m_renderedTo
+									 : 0;
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				best = i;
+			}
+		}
+	}
 
-	m_sla.Empty();
+	CRenderingContextPtr ctx = std::move(m_renderingContexts[best]);
+	m_renderingContexts.erase(m_renderingContexts.begin() + best);
+	return ctx;
+}
 
-	m_size = CSize(0, 0);
-	m_vidrect.SetRectEmpty();
+void CRenderedTextSubtitle::ReleaseRenderingContext(CRenderingContextPtr ctx)
+{
+	// a burst of concurrent calls must not leave a context per call behind, one per core is kept
+	const size_t nMaxContexts = std::max(1u, std::thread::hardware_concurrency());
+
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	if (m_renderingContexts.size() < nMaxContexts) {
+		ctx->m_renderingCaches.SetMemoryBudget(GetContextCacheBudget());
+		UpdateCacheStats(*ctx, false);
+		m_renderingContexts.emplace_back(std::move(ctx));
+		return;
+	}
+
+	// the others grow to their new share when they are given back
+	UpdateCacheStats(*ctx, true);
+	m_nRenderingContexts--;
+	lock.unlock();
+	ctx.reset();
+}
+
+// Call with m_mutexRenderingContexts held. The hits, misses and evictions of a dropped
+// context stay in the totals, the entries and bytes it held leave with it.
+void CRenderedTextSubtitle::UpdateCacheStats(CRenderingContext& ctx, bool fDropped)
+{
+	CRenderingCacheStats stats[RenderingCaches::COUNT];
+	ctx.m_renderingCaches.GetStats(stats);
+
+	for (int i = 0; i < RenderingCaches::COUNT; i++) {
+		if (fDropped) {
+			stats[i].nEntries = stats[i].nBytes = 0;
+		}
+		m_cacheStats[i] += stats[i];
+		m_cacheStats[i] -= ctx.m_reportedStats[i];
+		ctx.m_reportedStats[i] = stats[i];
+	}
+}
+
+void CRenderedTextSubtitle::EmptyRenderingContexts()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+		for (auto& ctx : m_renderingContexts) {
+			ctx->Empty();
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutexLayouts);
+	m_layouts.clear();
+}
+
+void CRenderedTextSubtitle::SetRasterizerType(Rasterizer::RasterizerType type)
+{
+	std::unique_lock<std::shared_mutex> exclusiveLock(m_mutexRender);
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	m_rasterizerOptions.rasterizerType = type;
+	for (auto& ctx : m_renderingContexts) {
+		ctx->m_renderingCaches.rasterizerOptions = m_rasterizerOptions;
+	}
+}
+
+void CRenderedTextSubtitle::SetBorderType(Rasterizer::BorderType type)
+{
+	std::unique_lock<std::shared_mutex> exclusiveLock(m_mutexRender);
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	m_rasterizerOptions.borderType = type;
+	for (auto& ctx : m_renderingContexts) {
+		ctx->m_renderingCaches.rasterizerOptions = m_rasterizerOptions;
+	}
+}
+
+void CRenderedTextSubtitle::SetGaussianBlurType(Rasterizer::GaussianBlurType type)
+{
+	std::unique_lock<std::shared_mutex> exclusiveLock(m_mutexRender);
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	if (m_rasterizerOptions.gaussianBlurType == type) {
+		return;
+	}
+
+	// the overlays in the caches were blurred the other way, start over with empty contexts
+	m_rasterizerOptions.gaussianBlurType = type;
+	for (auto& ctx : m_renderingContexts) {
+		UpdateCacheStats(*ctx, true);
+		ctx = std::make_unique<CRenderingContext>();
+		ctx->m_renderingCaches.SetMemoryBudget(GetContextCacheBudget());
+		ctx->m_renderingCaches.rasterizerOptions = m_rasterizerOptions;
+	}
+}
+
+void CRenderedTextSubtitle::SetCacheBudget(size_t nBytes)
+{
+	std::unique_lock<std::shared_mutex> exclusiveLock(m_mutexRender);
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	m_cacheBudget = nBytes;
+	for (auto& ctx : m_renderingContexts) {
+		ctx->m_renderingCaches.SetMemoryBudget(GetContextCacheBudget());
+		UpdateCacheStats(*ctx, false);
+	}
+}
+
+void CRenderedTextSubtitle::GetCacheStats(CRenderingCacheStats stats[RenderingCaches::COUNT])
+{
+	std::unique_lock<std::mutex> lock(m_mutexRenderingContexts);
+
+	for (int i = 0; i < RenderingCaches::COUNT; i++) {
+		stats[i] = m_cacheStats[i];
+	}
 }
 
 void CRenderedTextSubtitle::ParseEffect(CSubtitle* sub, CString str)
@@ -1860,7 +2151,7 @@ void CRenderedTextSubtitle::ParseEffect(CSubtitle* sub, CString str)
 	}
 }
 
-void CRenderedTextSubtitle::ParseString(CSubtitle* sub, CStringW str, STSStyle& style)
+void CRenderedTextSubtitle::ParseString(CRenderingContext& ctx, CSubtitle* sub, CStringW str, STSStyle& style)
 {
 	if (!sub) {
 		return;
@@ -1880,21 +2171,21 @@ void CRenderedTextSubtitle::ParseString(CSubtitle* sub, CStringW str, STSStyle&
 		}
 
 		if (i < j) {
-			if (CWord* w = DNew CText(style, str.Mid(i, j - i), m_ktype, m_kstart, m_kend, sub->m_scalex, sub->m_scaley, m_renderingCaches)) {
+			if (CWord* w = DNew CText(style, str.Mid(i, j - i), ctx.m_ktype, ctx.m_kstart, ctx.m_kend, sub->m_scalex, sub->m_scaley, ctx.m_renderingCaches)) {
 				sub->m_words.AddTail(w);
-				m_kstart = m_kend;
+				ctx.m_kstart = ctx.m_kend;
 			}
 		}
 
 		if (c == L'\n') {
-			if (CWord* w = DNew CText(style, CStringW(), m_ktype, m_kstart, m_kend, sub->m_scalex, sub->m_scaley, m_renderingCaches)) {
+			if (CWord* w = DNew CText(style, CStringW(), ctx.m_ktype, ctx.m_kstart, ctx.m_kend, sub->m_scalex, sub->m_scaley, ctx.m_renderingCaches)) {
 				sub->m_words.AddTail(w);
-				m_kstart = m_kend;
+				ctx.m_kstart = ctx.m_kend;
 			}
 		} else if (c == L' ' || c == L'\x00A0') {
-			if (CWord* w = DNew CText(style, CStringW(c), m_ktype, m_kstart, m_kend, sub->m_scalex, sub->m_scaley, m_renderingCaches)) {
+			if (CWord* w = DNew CText(style, CStringW(c), ctx.m_ktype, ctx.m_kstart, ctx.m_kend, sub->m_scalex, sub->m_scaley, ctx.m_renderingCaches)) {
 				sub->m_words.AddTail(w);
-				m_kstart = m_kend;
+				ctx.m_kstart = ctx.m_kend;
 			}
 		}
 
@@ -1904,24 +2195,24 @@ void CRenderedTextSubtitle::ParseString(CSubtitle* sub, CStringW str, STSStyle&
 	return;
 }
 
-void CRenderedTextSubtitle::ParsePolygon(CSubtitle* sub, CStringW str, STSStyle& style)
+void CRenderedTextSubtitle::ParsePolygon(CRenderingContext& ctx, CSubtitle* sub, CStringW str, STSStyle& style)
 {
-	if (!sub || !str.GetLength() || !m_nPolygon) {
+	if (!sub || !str.GetLength() || !ctx.m_nPolygon) {
 		return;
 	}
 
-	if (CWord* w = DNew CPolygon(style, str, m_ktype, m_kstart, m_kend,
-									  sub->m_scalex / (1 << (m_nPolygon - 1)), sub->m_scaley / (1 << (m_nPolygon - 1)),
-									  m_polygonBaselineOffset,
-									  m_renderingCaches)) {
+	if (CWord* w = DNew CPolygon(style, str, ctx.m_ktype, ctx.m_kstart, ctx.m_kend,
+									  sub->m_scalex / (1 << (ctx.m_nPolygon - 1)), sub->m_scaley / (1 << (ctx.m_nPolygon - 1)),
+									  ctx.m_polygonBaselineOffset,
+									  ctx.m_renderingCaches)) {
 		sub->m_words.AddTail(w);
-		m_kstart = m_kend;
+		ctx.m_kstart = ctx.m_kend;
 	}
 }
 
-bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& str)
+bool CRenderedTextSubtitle::ParseSSATag(CRenderingContext& ctx, SSATagsList& tagsList, const CStringW& str)
 {
-	if (m_renderingCaches.SSATagsCache.Lookup(str, tagsList)) {
+	if (ctx.m_renderingCaches.SSATagsCache.Lookup(str, tagsList)) {
 		return true;
 	}
 
@@ -1943,12 +2234,7 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 		nTags++;
 
 		SSATag tag;
-		tag.cmd = SSA_unknown;
-		for (int cmdLength = std::min(SSA_CMD_MAX_LENGTH, cmd.GetLength()), cmdLengthMin = SSA_CMD_MIN_LENGTH; cmdLength >= cmdLengthMin; cmdLength--) {
-			if (s_SSATagCmds.Lookup(cmd.Left(cmdLength), tag.cmd)) {
-				break;
-			}
-		}
+		tag.cmd = LookupSSATagCmd(cmd, cmd.GetLength());
 		if (tag.cmd == SSA_unknown) {
 			nUnrecognizedTags++;
 			continue;
@@ -2149,7 +2435,7 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 						tag.paramsReal.Add(wcstod(tag.params[2], NULL));
 					}
 
-					ParseSSATag(tag.subTagsList, tag.params[nParams - 1]);
+					ParseSSATag(ctx, tag.subTagsList, tag.params[nParams - 1]);
 				}
 				tag.params.RemoveAll();
 			}
@@ -2194,13 +2480,13 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 		tagsList->AddTail(tag);
 	}
 
-	m_renderingCaches.SSATagsCache.SetAt(str, tagsList);
+	ctx.m_renderingCaches.SSATagsCache.SetAt(str, tagsList);
 
 	//return (nUnrecognizedTags < nTags);
 	return true; // there are people keeping comments inside {}, lets make them happy now
 }
 
-bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsList& tagsList,
+bool CRenderedTextSubtitle::CreateSubFromSSATag(CRenderingContext& ctx, CSubtitle* sub, const SSATagsList& tagsList,
 		STSStyle& style, STSStyle& org, bool bUseOriginal, bool bAnimate/* = false*/)
 {
 	if (!sub || !tagsList) {
@@ -2222,9 +2508,9 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 
 				if (!tag.paramsInt.IsEmpty() && !bUseOriginal) {
 					DWORD c = tag.paramsInt[0];
-					style.colors[k] = (((int)CalcAnimation(c & 0xff, style.colors[k] & 0xff, bAnimate)) & 0xff
-									   | ((int)CalcAnimation(c & 0xff00, style.colors[k] & 0xff00, bAnimate)) & 0xff00
-									   | ((int)CalcAnimation(c & 0xff0000, style.colors[k] & 0xff0000, bAnimate)) & 0xff0000);
+					style.colors[k] = (((int)CalcAnimation(ctx, c & 0xff, style.colors[k] & 0xff, bAnimate)) & 0xff
+									   | ((int)CalcAnimation(ctx, c & 0xff00, style.colors[k] & 0xff00, bAnimate)) & 0xff00
+									   | ((int)CalcAnimation(ctx, c & 0xff0000, style.colors[k] & 0xff0000, bAnimate)) & 0xff0000);
 				} else {
 					style.colors[k] = org.colors[k];
 				}
@@ -2237,14 +2523,14 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				int k = tag.cmd - SSA_1a;
 
 				style.alpha[k] = !tag.paramsInt.IsEmpty() && !bUseOriginal
-								 ? (BYTE)CalcAnimation(tag.paramsInt[0] & 0xff, style.alpha[k], bAnimate)
+								 ? (BYTE)CalcAnimation(ctx, tag.paramsInt[0] & 0xff, style.alpha[k], bAnimate)
 								 : org.alpha[k];
 			}
 			break;
 			case SSA_alpha:
 				for (ptrdiff_t k = 0; k < 4; k++) {
 					style.alpha[k] = !tag.paramsInt.IsEmpty() && !bUseOriginal
-									 ? (BYTE)CalcAnimation(tag.paramsInt[0] & 0xff, style.alpha[k], bAnimate)
+									 ? (BYTE)CalcAnimation(ctx, tag.paramsInt[0] & 0xff, style.alpha[k], bAnimate)
 									 : org.alpha[k];
 				}
 				break;
@@ -2264,7 +2550,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 			break;
 			case SSA_blur:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double n = CalcAnimation(tag.paramsReal[0], style.fGaussianBlur, bAnimate);
+					double n = CalcAnimation(ctx, tag.paramsReal[0], style.fGaussianBlur, bAnimate);
 					style.fGaussianBlur = (n < 0 ? 0 : n);
 				} else {
 					style.fGaussianBlur = org.fGaussianBlur;
@@ -2272,9 +2558,9 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_bord:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double nx = CalcAnimation(tag.paramsReal[0], style.outlineWidthX, bAnimate);
+					double nx = CalcAnimation(ctx, tag.paramsReal[0], style.outlineWidthX, bAnimate);
 					style.outlineWidthX = (nx < 0 ? 0 : nx);
-					double ny = CalcAnimation(tag.paramsReal[0], style.outlineWidthY, bAnimate);
+					double ny = CalcAnimation(ctx, tag.paramsReal[0], style.outlineWidthY, bAnimate);
 					style.outlineWidthY = (ny < 0 ? 0 : ny);
 				} else {
 					style.outlineWidthX = org.outlineWidthX;
@@ -2283,7 +2569,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_be:
 				style.fBlur = !tag.paramsInt.IsEmpty() && !bUseOriginal
-							  ? (int)(CalcAnimation(tag.paramsInt[0], style.fBlur, bAnimate) + 0.5)
+							  ? (int)(CalcAnimation(ctx, tag.paramsInt[0], style.fBlur, bAnimate) + 0.5)
 							  : org.fBlur;
 				break;
 			case SSA_b: {
@@ -2300,7 +2586,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				if (nParams == 1 && nParamsInt == 0 && !sub->m_pClipper) {
 					sub->m_pClipper = std::make_shared<CClipper>(tag.params[0], CSize(m_size.cx >> 3, m_size.cy >> 3), sub->m_scalex, sub->m_scaley,
 																 invert, (sub->m_relativeTo == 1) ? CPoint(m_vidrect.left, m_vidrect.top) : CPoint(0, 0),
-																 m_renderingCaches);
+																 ctx.m_renderingCaches);
 				} else if (nParams == 1 && nParamsInt == 1 && !sub->m_pClipper) {
 					long scale = tag.paramsInt[0];
 					if (scale < 1) {
@@ -2309,7 +2595,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 					sub->m_pClipper = std::make_shared<CClipper>(tag.params[0], CSize(m_size.cx >> 3, m_size.cy >> 3),
 																 sub->m_scalex / (1 << (scale - 1)), sub->m_scaley / (1 << (scale - 1)), invert,
 																 (sub->m_relativeTo == 1) ? CPoint(m_vidrect.left, m_vidrect.top) : CPoint(0, 0),
-																 m_renderingCaches);
+																 ctx.m_renderingCaches);
 				} else if (nParamsInt == 4) {
 					sub->m_clipInverse = invert;
 
@@ -2328,19 +2614,19 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 					}
 
 					sub->m_clip.SetRect(
-						static_cast<int>(CalcAnimation(dLeft, sub->m_clip.left, bAnimate)),
-						static_cast<int>(CalcAnimation(dTop, sub->m_clip.top, bAnimate)),
-						static_cast<int>(CalcAnimation(dRight, sub->m_clip.right, bAnimate)),
-						static_cast<int>(CalcAnimation(dBottom, sub->m_clip.bottom, bAnimate)));
+						static_cast<int>(CalcAnimation(ctx, dLeft, sub->m_clip.left, bAnimate)),
+						static_cast<int>(CalcAnimation(ctx, dTop, sub->m_clip.top, bAnimate)),
+						static_cast<int>(CalcAnimation(ctx, dRight, sub->m_clip.right, bAnimate)),
+						static_cast<int>(CalcAnimation(ctx, dBottom, sub->m_clip.bottom, bAnimate)));
 				}
 			}
 			break;
 			case SSA_c:
 				if (!tag.paramsInt.IsEmpty() && !bUseOriginal) {
 					DWORD c = tag.paramsInt[0];
-					style.colors[0] = (((int)CalcAnimation(c & 0xff, style.colors[0] & 0xff, bAnimate)) & 0xff
-									   | ((int)CalcAnimation(c & 0xff00, style.colors[0] & 0xff00, bAnimate)) & 0xff00
-									   | ((int)CalcAnimation(c & 0xff0000, style.colors[0] & 0xff0000, bAnimate)) & 0xff0000);
+					style.colors[0] = (((int)CalcAnimation(ctx, c & 0xff, style.colors[0] & 0xff, bAnimate)) & 0xff
+									   | ((int)CalcAnimation(ctx, c & 0xff00, style.colors[0] & 0xff00, bAnimate)) & 0xff00
+									   | ((int)CalcAnimation(ctx, c & 0xff0000, style.colors[0] & 0xff0000, bAnimate)) & 0xff0000);
 				} else {
 					style.colors[0] = org.colors[0];
 				}
@@ -2375,12 +2661,12 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 			break;
 			case SSA_fax:
 				style.fontShiftX = !tag.paramsReal.IsEmpty() && !bUseOriginal
-								   ? CalcAnimation(tag.paramsReal[0], style.fontShiftX, bAnimate)
+								   ? CalcAnimation(ctx, tag.paramsReal[0], style.fontShiftX, bAnimate)
 								   : org.fontShiftX;
 				break;
 			case SSA_fay:
 				style.fontShiftY = !tag.paramsReal.IsEmpty() && !bUseOriginal
-								   ? CalcAnimation(tag.paramsReal[0], style.fontShiftY, bAnimate)
+								   ? CalcAnimation(ctx, tag.paramsReal[0], style.fontShiftY, bAnimate)
 								   : org.fontShiftY;
 				break;
 			case SSA_fe:
@@ -2395,23 +2681,23 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_frx:
 				style.fontAngleX = !tag.paramsReal.IsEmpty() && !bUseOriginal
-								   ? CalcAnimation(tag.paramsReal[0], style.fontAngleX, bAnimate)
+								   ? CalcAnimation(ctx, tag.paramsReal[0], style.fontAngleX, bAnimate)
 								   : org.fontAngleX;
 				break;
 			case SSA_fry:
 				style.fontAngleY = !tag.paramsReal.IsEmpty() && !bUseOriginal
-								   ? CalcAnimation(tag.paramsReal[0], style.fontAngleY, bAnimate)
+								   ? CalcAnimation(ctx, tag.paramsReal[0], style.fontAngleY, bAnimate)
 								   : org.fontAngleY;
 				break;
 			case SSA_frz:
 			case SSA_fr:
 				style.fontAngleZ = !tag.paramsReal.IsEmpty() && !bUseOriginal
-								   ? CalcAnimation(tag.paramsReal[0], style.fontAngleZ, bAnimate)
+								   ? CalcAnimation(ctx, tag.paramsReal[0], style.fontAngleZ, bAnimate)
 								   : org.fontAngleZ;
 				break;
 			case SSA_fscx:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double n = CalcAnimation(tag.paramsReal[0], style.fontScaleX, bAnimate);
+					double n = CalcAnimation(ctx, tag.paramsReal[0], style.fontScaleX, bAnimate);
 					style.fontScaleX = (n < 0 ? 0 : n);
 				} else {
 					style.fontScaleX = org.fontScaleX;
@@ -2419,7 +2705,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_fscy:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double n = CalcAnimation(tag.paramsReal[0], style.fontScaleY, bAnimate);
+					double n = CalcAnimation(ctx, tag.paramsReal[0], style.fontScaleY, bAnimate);
 					style.fontScaleY = (n < 0 ? 0 : n);
 				} else {
 					style.fontScaleY = org.fontScaleY;
@@ -2431,16 +2717,16 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_fsp:
 				style.fontSpacing = !tag.paramsReal.IsEmpty() && !bUseOriginal
-									? CalcAnimation(tag.paramsReal[0], style.fontSpacing, bAnimate)
+									? CalcAnimation(ctx, tag.paramsReal[0], style.fontSpacing, bAnimate)
 									: org.fontSpacing;
 				break;
 			case SSA_fs:
 				if (!tag.paramsInt.IsEmpty() && !bUseOriginal) {
 					if (!tag.params.IsEmpty() && (tag.params[0][0] == L'-' || tag.params[0][0] == L'+')) {
-						double n = CalcAnimation(style.fontSize + style.fontSize * tag.paramsInt[0] / 10, style.fontSize, bAnimate);
+						double n = CalcAnimation(ctx, style.fontSize + style.fontSize * tag.paramsInt[0] / 10, style.fontSize, bAnimate);
 						style.fontSize = (n > 0) ? n : org.fontSize;
 					} else {
-						double n = CalcAnimation(tag.paramsInt[0], style.fontSize, bAnimate);
+						double n = CalcAnimation(ctx, tag.paramsInt[0], style.fontSize, bAnimate);
 						style.fontSize = (n > 0) ? n : org.fontSize;
 					}
 				} else {
@@ -2455,36 +2741,36 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 			case SSA_kt:
 				sub->m_bIsAnimated = true;
 
-				m_kstart = !tag.paramsInt.IsEmpty() && !bUseOriginal
+				ctx.m_kstart = !tag.paramsInt.IsEmpty() && !bUseOriginal
 						   ? tag.paramsInt[0] * 10
 						   : 0;
-				m_kend = m_kstart;
+				ctx.m_kend = ctx.m_kstart;
 				break;
 			case SSA_kf:
 			case SSA_K:
 				sub->m_bIsAnimated = true;
 
-				m_ktype = 1;
-				m_kstart = m_kend;
-				m_kend += !tag.paramsInt.IsEmpty() && !bUseOriginal
+				ctx.m_ktype = 1;
+				ctx.m_kstart = ctx.m_kend;
+				ctx.m_kend += !tag.paramsInt.IsEmpty() && !bUseOriginal
 						  ? tag.paramsInt[0] * 10
 						  : bUseOriginal ? 0 : 1000;
 				break;
 			case SSA_ko:
 				sub->m_bIsAnimated = true;
 
-				m_ktype = 2;
-				m_kstart = m_kend;
-				m_kend += !tag.paramsInt.IsEmpty() && !bUseOriginal
+				ctx.m_ktype = 2;
+				ctx.m_kstart = ctx.m_kend;
+				ctx.m_kend += !tag.paramsInt.IsEmpty() && !bUseOriginal
 						  ? tag.paramsInt[0] * 10
 						  : bUseOriginal ? 0 : 1000;
 				break;
 			case SSA_k:
 				sub->m_bIsAnimated = true;
 
-				m_ktype = 0;
-				m_kstart = m_kend;
-				m_kend += !tag.paramsInt.IsEmpty() && !bUseOriginal
+				ctx.m_ktype = 0;
+				ctx.m_kstart = ctx.m_kend;
+				ctx.m_kend += !tag.paramsInt.IsEmpty() && !bUseOriginal
 						  ? tag.paramsInt[0] * 10
 						  : bUseOriginal ? 0 : 1000;
 				break;
@@ -2525,7 +2811,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				}
 				break;
 			case SSA_pbo:
-				m_polygonBaselineOffset = !tag.paramsInt.IsEmpty() && !bUseOriginal ? tag.paramsInt[0] : 0;
+				ctx.m_polygonBaselineOffset = !tag.paramsInt.IsEmpty() && !bUseOriginal ? tag.paramsInt[0] : 0;
 				break;
 			case SSA_pos:
 #ifdef _VSMOD // patch m002. Z-coord
@@ -2552,7 +2838,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_p: {
 				int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : 0;
-				m_nPolygon = (n <= 0 ? 0 : n);
+				ctx.m_nPolygon = (n <= 0 ? 0 : n);
 			}
 			break;
 			case SSA_q: {
@@ -2569,9 +2855,9 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_shad:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double nx = CalcAnimation(tag.paramsReal[0], style.shadowDepthX, bAnimate);
+					double nx = CalcAnimation(ctx, tag.paramsReal[0], style.shadowDepthX, bAnimate);
 					style.shadowDepthX = (nx < 0 ? 0 : nx);
-					double ny = CalcAnimation(tag.paramsReal[0], style.shadowDepthY, bAnimate);
+					double ny = CalcAnimation(ctx, tag.paramsReal[0], style.shadowDepthY, bAnimate);
 					style.shadowDepthY = (ny < 0 ? 0 : ny);
 				} else {
 					style.shadowDepthX = org.shadowDepthX;
@@ -2587,22 +2873,22 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				if (tag.subTagsList) {
 					sub->m_bIsAnimated = true;
 
-					m_animStart = m_animEnd = 0;
-					m_animAccel = 1;
+					ctx.m_animStart = ctx.m_animEnd = 0;
+					ctx.m_animAccel = 1;
 
 					size_t nParams = tag.paramsInt.GetCount() + tag.paramsReal.GetCount();
 					if (nParams == 1) {
-						m_animAccel = tag.paramsReal[0];
+						ctx.m_animAccel = tag.paramsReal[0];
 					} else if (nParams == 2) {
-						m_animStart = (int)tag.paramsReal[0];
-						m_animEnd = (int)tag.paramsReal[1];
+						ctx.m_animStart = (int)tag.paramsReal[0];
+						ctx.m_animEnd = (int)tag.paramsReal[1];
 					} else if (nParams == 3) {
-						m_animStart = tag.paramsInt[0];
-						m_animEnd = tag.paramsInt[1];
-						m_animAccel = tag.paramsReal[0];
+						ctx.m_animStart = tag.paramsInt[0];
+						ctx.m_animEnd = tag.paramsInt[1];
+						ctx.m_animAccel = tag.paramsReal[0];
 					}
 
-					CreateSubFromSSATag(sub, tag.subTagsList, style, org, bUseOriginal, true);
+					CreateSubFromSSATag(ctx, sub, tag.subTagsList, style, org, bUseOriginal, true);
 
 					sub->m_fAnimated = true;
 				}
@@ -2614,7 +2900,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 			break;
 			case SSA_xbord:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double nx = CalcAnimation(tag.paramsReal[0], style.outlineWidthX, bAnimate);
+					double nx = CalcAnimation(ctx, tag.paramsReal[0], style.outlineWidthX, bAnimate);
 					style.outlineWidthX = (nx < 0 ? 0 : nx);
 				} else {
 					style.outlineWidthX = org.outlineWidthX;
@@ -2622,12 +2908,12 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_xshad:
 				style.shadowDepthX = !tag.paramsReal.IsEmpty() && !bUseOriginal
-									 ? CalcAnimation(tag.paramsReal[0], style.shadowDepthX, bAnimate)
+									 ? CalcAnimation(ctx, tag.paramsReal[0], style.shadowDepthX, bAnimate)
 									 : org.shadowDepthX;
 				break;
 			case SSA_ybord:
 				if (!tag.paramsReal.IsEmpty() && !bUseOriginal) {
-					double ny = CalcAnimation(tag.paramsReal[0], style.outlineWidthY, bAnimate);
+					double ny = CalcAnimation(ctx, tag.paramsReal[0], style.outlineWidthY, bAnimate);
 					style.outlineWidthY = (ny < 0 ? 0 : ny);
 				} else {
 					style.outlineWidthY = org.outlineWidthY;
@@ -2635,7 +2921,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				break;
 			case SSA_yshad:
 				style.shadowDepthY = !tag.paramsReal.IsEmpty() && !bUseOriginal
-									 ? CalcAnimation(tag.paramsReal[0], style.shadowDepthY, bAnimate)
+									 ? CalcAnimation(ctx, tag.paramsReal[0], style.shadowDepthY, bAnimate)
 									 : org.shadowDepthY;
 				break;
 #ifdef _VSMOD 
@@ -2644,7 +2930,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 			{
 				if (!tag.paramsReal.IsEmpty()) {
 					double dst = tag.paramsReal[0];
-					double nx = CalcAnimation(dst, style.mod_verticalSpace, bAnimate);
+					double nx = CalcAnimation(ctx, dst, style.mod_verticalSpace, bAnimate);
 					style.mod_verticalSpace = nx;
 				}
 				else
@@ -2658,7 +2944,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				if (!tag.paramsReal.IsEmpty())
 				{
 					double dst = tag.paramsReal[0] * 80;
-					double nx = CalcAnimation(dst, style.mod_z, bAnimate);
+					double nx = CalcAnimation(ctx, dst, style.mod_z, bAnimate);
 					style.mod_z = nx;
 				}
 				else
@@ -2672,7 +2958,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				if (!tag.paramsInt.IsEmpty())
 				{
 					double dst = tag.paramsInt[0];
-					double nx = CalcAnimation(dst, style.mod_rand.Seed, bAnimate);
+					double nx = CalcAnimation(ctx, dst, style.mod_rand.Seed, bAnimate);
 					style.mod_rand.Seed = nx;
 				}
 				else
@@ -2707,7 +2993,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 				double dst = tag.paramsReal[0] * 8;
 				for (int i = 0; i < target.size(); ++i)
 					if (!tag.paramsReal.IsEmpty())
-						*target[i] = CalcAnimation(dst, *target[i], bAnimate);
+						*target[i] = CalcAnimation(ctx, dst, *target[i], bAnimate);
 					else
 						*target[i] = *source[i];
 				break;
@@ -2719,7 +3005,7 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 	return true;
 }
 
-bool CRenderedTextSubtitle::ParseHtmlTag(CStringW str, STSStyle& style, const STSStyle& org, bool bUseOriginal)
+bool CRenderedTextSubtitle::ParseHtmlTag(CRenderingContext& ctx, CStringW str, STSStyle& style, const STSStyle& org, bool bUseOriginal)
 {
 	if (str.Find(L"!--") == 0) {
 		return true;
@@ -2816,9 +3102,9 @@ bool CRenderedTextSubtitle::ParseHtmlTag(CStringW str, STSStyle& style, const ST
 		}
 	} else if (tag == L"k" && attribs.GetCount() == 1 && attribs[0] == L"t") {
 		if (!bUseOriginal) {
-			m_ktype = 1;
-			m_kstart = m_kend;
-			m_kend += wcstol(params[0], NULL, 10);
+			ctx.m_ktype = 1;
+			ctx.m_kstart = ctx.m_kend;
+			ctx.m_kend += wcstol(params[0], NULL, 10);
 		}
 	} else {
 		return false;
@@ -2827,17 +3113,22 @@ bool CRenderedTextSubtitle::ParseHtmlTag(CStringW str, STSStyle& style, const ST
 	return true;
 }
 
-double CRenderedTextSubtitle::CalcAnimation(double dst, double src, bool fAnimate)
+double CRenderedTextSubtitle::CalcAnimation(CRenderingContext& ctx, double dst, double src, bool fAnimate)
 {
-	int s = m_animStart ? m_animStart : 0;
-	int e = m_animEnd ? m_animEnd : m_delay;
+	int s = ctx.m_animStart ? ctx.m_animStart : 0;
+	int e = ctx.m_animEnd ? ctx.m_animEnd : ctx.m_delay;
 
 	if (fabs(dst-src) >= 0.0001 && fAnimate) {
-		if (m_time < s) {
+		if (ctx.m_time < s) {
 			dst = src;
-		} else if (s <= m_time && m_time < e) {
-			double t = pow(1.0 * (m_time - s) / (e - s), m_animAccel);
+			ctx.m_animStableTo = std::min(ctx.m_animStableTo, s);
+		} else if (s <= ctx.m_time && ctx.m_time < e) {
+			double t = pow(1.0 * (ctx.m_time - s) / (e - s), ctx.m_animAccel);
 			dst = (1 - t) * src + t * dst;
+			ctx.m_animStableFrom = std::max(ctx.m_animStableFrom, ctx.m_time);
+			ctx.m_animStableTo = std::min(ctx.m_animStableTo, ctx.m_time + 1);
+		} else {
+			ctx.m_animStableFrom = std::max(ctx.m_animStableFrom, std::max(s, e));
 		}
 		//		else dst = dst;
 	}
@@ -2845,11 +3136,11 @@ double CRenderedTextSubtitle::CalcAnimation(double dst, double src, bool fAnimat
 	return dst;
 }
 
-CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
+CSubtitle* CRenderedTextSubtitle::GetSubtitle(CRenderingContext& ctx, int entry)
 {
 	CSubtitle* sub;
-	if (m_subtitleCache.Lookup(entry, sub)) {
-		if (sub->m_fAnimated) {
+	if (ctx.m_subtitleCache.Lookup(entry, sub)) {
+		if (sub->m_fAnimated && (ctx.m_delay != sub->m_animDelay || ctx.m_time < sub->m_animStableFrom || ctx.m_time >= sub->m_animStableTo)) {
 			delete sub;
 			sub = NULL;
 		} else {
@@ -2858,7 +3149,7 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 	}
 
 	try {
-		sub = DNew CSubtitle(m_renderingCaches);
+		sub = DNew CSubtitle(ctx.m_renderingCaches);
 	} catch (CMemoryException* e) {
 		e->Delete();
 		return NULL;
@@ -2978,11 +3269,13 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 		marginRect.bottom += m_size.cy - m_vidrect.bottom;
 	}
 
-	m_animStart = m_animEnd = 0;
-	m_animAccel = 1;
-	m_ktype = m_kstart = m_kend = 0;
-	m_nPolygon = 0;
-	m_polygonBaselineOffset = 0;
+	ctx.m_animStart = ctx.m_animEnd = 0;
+	ctx.m_animAccel = 1;
+	ctx.m_ktype = ctx.m_kstart = ctx.m_kend = 0;
+	ctx.m_nPolygon = 0;
+	ctx.m_polygonBaselineOffset = 0;
+	ctx.m_animStableFrom = INT_MIN;
+	ctx.m_animStableTo = INT_MAX;
 	ParseEffect(sub, GetAt(entry).effect);
 
 	while (!str.IsEmpty()) {
@@ -2992,13 +3285,13 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 
 		if (str[0] == '{' && (i = str.Find(L'}')) > 0) {
 			SSATagsList tagsList;
-			bParsed = ParseSSATag(tagsList, str.Mid(1, i - 1));
+			bParsed = ParseSSATag(ctx, tagsList, str.Mid(1, i - 1));
 			if (bParsed) {
-				CreateSubFromSSATag(sub, tagsList, stss, orgstss, m_bOverrideStyle);
+				CreateSubFromSSATag(ctx, sub, tagsList, stss, orgstss, m_bOverrideStyle);
 				str = str.Mid(i+1);
 			}
 		} else if (str[0] == '<' && (i = str.Find(L'>')) > 0) {
-			bParsed = ParseHtmlTag(str.Mid(1, i - 1), stss, orgstss, m_bOverrideStyle);
+			bParsed = ParseHtmlTag(ctx, str.Mid(1, i - 1), stss, orgstss, m_bOverrideStyle);
 			if (bParsed) {
 				str = str.Mid(i + 1);
 			}
@@ -3040,12 +3333,12 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 		tmp.shadowDepthX  *= (m_fScaledBAS ? sub->m_scalex : 1.0) * 8.0;
 		tmp.shadowDepthY  *= (m_fScaledBAS ? sub->m_scaley : 1.0) * 8.0;
 
-		if (m_nPolygon) {
+		if (ctx.m_nPolygon) {
 			if (!m_bOverrideStyle) {
-				ParsePolygon(sub, str.Left(i), tmp);
+				ParsePolygon(ctx, sub, str.Left(i), tmp);
 			}
 		} else {
-			ParseString(sub, str.Left(i), tmp);
+			ParseString(ctx, sub, str.Left(i), tmp);
 		}
 
 		str = str.Mid(i);
@@ -3062,15 +3355,21 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 	if (!m_bOverrideStyle &&
 			sub->m_effects[EF_ORG] && (sub->m_effects[EF_MOVE] || sub->m_effects[EF_BANNER] || sub->m_effects[EF_SCROLL])) {
 		sub->m_fAnimated = true;
+		ctx.m_animStableFrom = ctx.m_time;
+		ctx.m_animStableTo = ctx.m_time + 1;
 	}
 
+	sub->m_animStableFrom = ctx.m_animStableFrom;
+	sub->m_animStableTo = ctx.m_animStableTo;
+	sub->m_animDelay = ctx.m_delay;
+
 	sub->m_scrAlignment = abs(sub->m_scrAlignment);
 
 	sub->CreateClippers(m_size);
 
 	sub->MakeLines(m_size, marginRect);
 
-	m_subtitleCache[entry] = sub;
+	ctx.m_subtitleCache[entry] = sub;
 
 	return sub;
 }
@@ -3089,16 +3388,138 @@ struct LSub {
 	}
 };
 
+// whether Render() places s with the collision layout, the others are positioned by their effects
+static bool IsCollisionPlaced(const CSubtitle* s)
+{
+	return !s->m_fAnimated
+		   && !s->m_effects[EF_MOVE] && !s->m_effects[EF_ORG] && !s->m_effects[EF_BANNER] && !s->m_effects[EF_SCROLL];
+}
+
+// The subtitles of a segment that the collision layout places, in the order Render() draws them
+void CRenderedTextSubtitle::GetCollisionSubs(CRenderingContext& ctx, int segment, int t, double fps, std::vector<std::pair<int, CSubtitle*>>& subs)
+{
+	subs.clear();
+
+	const STSSegment* stss = GetSegment(segment);
+	if (!stss) {
+		return;
+	}
+
+	std::vector<LSub> lsubs;
+	for (size_t i = 0, j = stss->subs.GetCount(); i < j; i++) {
+		const auto idx = stss->subs[i];
+		const auto& sts_entry = GetAt(idx);
+		lsubs.push_back({ idx, sts_entry.layer, sts_entry.readorder });
+	}
+
+	std::sort(lsubs.begin(), lsubs.end());
+
+	for (const LSub& lsub : lsubs) {
+		const int start = TranslateStart(lsub.idx, fps);
+		ctx.m_time = t - start;
+		ctx.m_delay = TranslateEnd(lsub.idx, fps) - start;
+
+		CSubtitle* s = GetSubtitle(ctx, lsub.idx);
+		if (s && IsCollisionPlaced(s)) {
+			subs.emplace_back(lsub.idx, s);
+		}
+	}
+}
+
+// The layout of a segment keeps where the subtitles still shown from the segment before it were
+// placed. It is rebuilt from the last known layout, or from the segment where no placed subtitle
+// carries over, the same way playing every segment in order would have built it.
+void CRenderedTextSubtitle::GetLayout(CRenderingContext& ctx, int segment, int t, double fps, CScreenLayoutAllocator& sla)
+{
+	const size_t MAX_LAYOUTS = 1024;
+	// A subtitle shown over many segments would make every lookup replay all of them. The replay
+	// rather starts over at every MAX_REPLAY-th segment, like playback did after a seek, so a layout
+	// still only depends on its segment.
+	const int MAX_REPLAY = 64;
+	const int anchor = segment - segment % MAX_REPLAY;
+
+	auto SegmentTime = [&](int i) {
+		return i == segment ? t : TranslateSegmentStart(i, fps);
+	};
+
+	std::vector<std::pair<int, CSubtitle*>> subs;
+
+	int first = segment;
+	sla.Empty();
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutexLayouts);
+			auto it = m_layouts.find(first);
+			if (it != m_layouts.end()) {
+				sla = it->second;
+				first++;
+				break;
+			}
+		}
+
+		const STSSegment* prev = GetSegment(first - 1);
+		if (!prev || first == anchor) {
+			break;
+		}
+
+		GetCollisionSubs(ctx, first, SegmentTime(first), fps, subs);
+		const bool fCarriesOver = std::any_of(subs.begin(), subs.end(), [&](const auto& sub) {
+			for (size_t i = 0, j = prev->subs.GetCount(); i < j; i++) {
+				if (prev->subs[i] == sub.first) {
+					return true;
+				}
+			}
+			return false;
+		});
+		if (!fCarriesOver) {
+			break;
+		}
+
+		first--;
+	}
+
+	for (int i = first; i <= segment; i++) {
+		const STSSegment* stss = GetSegment(i);
+		if (!stss) {
+			continue;
+		}
+
+		sla.AdvanceToSegment(i, stss->subs);
+
+		GetCollisionSubs(ctx, i, SegmentTime(i), fps, subs);
+		for (const auto& sub : subs) {
+			sla.AllocRect(sub.second, i, sub.first, GetAt(sub.first).layer, m_collisions);
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutexLayouts);
+		m_layouts[i] = sla;
+		if (m_layouts.size() > MAX_LAYOUTS) {
+			// drop the layout farthest from the one in use, it can always be rebuilt
+			if (segment - m_layouts.begin()->first > m_layouts.rbegin()->first - segment) {
+				m_layouts.erase(m_layouts.begin());
+			} else {
+				m_layouts.erase(std::prev(m_layouts.end()));
+			}
+		}
+	}
+}
+
 const bool CRenderedTextSubtitle::GetText(const REFERENCE_TIME rt, const double fps, CString& text)
 {
-	std::unique_lock<std::mutex> lock(m_mutexRender);
+	std::shared_lock<std::shared_mutex> lock(m_mutexRender);
 
 	text.Empty();
 
 	const int t = (int)(rt / 10000);
+
+	CRenderingContextPtr pCtx = AcquireRenderingContext(t);
+	CRenderingContext& ctx = *pCtx;
+
 	int segment;
-	const STSSegment* stss = SearchSubs(t, fps, &segment);
+	const STSSegment* stss = SearchSubs(t, fps, &segment, NULL, &ctx.m_searchCursor);
 	if (!stss) {
+		ReleaseRenderingContext(std::move(pCtx));
 		return false;
 	}
 
@@ -3113,7 +3534,11 @@ const bool CRenderedTextSubtitle::GetText(const REFERENCE_TIME rt, const double
 
 	for (size_t i = 0, j = subs.GetCount(); i < j; i++) {
 		const int entry = subs[i].idx;
-		const CSubtitle* s = GetSubtitle(entry);
+		const int start = TranslateStart(entry, fps);
+		ctx.m_time = t - start;
+		ctx.m_delay = TranslateEnd(entry, fps) - start;
+
+		const CSubtitle* s = GetSubtitle(ctx, entry);
 		if (!s) {
 			continue;
 		}
@@ -3141,9 +3566,95 @@ const bool CRenderedTextSubtitle::GetText(const REFERENCE_TIME rt, const double
 		}
 	}
 
+	ReleaseRenderingContext(std::move(pCtx));
+
 	return !text.IsEmpty();
 }
 
+void CRenderedTextSubtitle::Warmup(REFERENCE_TIME rtStart, REFERENCE_TIME rtEnd, double fps, int iPart, int nParts, std::vector<BYTE>& bits)
+{
+	if (nParts < 1 || iPart < 0 || iPart >= nParts) {
+		return;
+	}
+
+	SubPicDesc spd;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_mutexRender);
+
+		spd.w = m_size.cx >> 3;
+		spd.h = m_size.cy >> 3;
+		spd.vidrect = CRect(m_vidrect.left >> 3, m_vidrect.top >> 3, m_vidrect.right >> 3, m_vidrect.bottom >> 3);
+	}
+
+	if (spd.w <= 0 || spd.h <= 0) {
+		return;
+	}
+
+	spd.type = MSP_RGB32;
+	spd.bpp = 32;
+	spd.pitch = spd.w * 4;
+	const CRect vidrect(spd.vidrect.left * 8, spd.vidrect.top * 8, spd.vidrect.right * 8, spd.vidrect.bottom * 8);
+
+	// Reload() and the streaming Add() change the entries and segments under the provider lock only,
+	// it is held for the lookup and for every frame, so the frames being rendered wait for one at most
+	const bool bLocked = SUCCEEDED(Lock());
+
+	// one frame per segment, the other frames of a segment reuse what it parsed and rasterized
+	std::vector<REFERENCE_TIME> times;
+	for (POSITION pos = GetStartPosition(rtStart, fps); pos; pos = GetNext(pos)) {
+		const REFERENCE_TIME rt = GetStart(pos, fps);
+		if (rt >= rtEnd) {
+			break;
+		}
+		times.push_back(std::max(rt, rtStart));
+	}
+
+	if (bLocked) {
+		Unlock();
+	}
+
+	if (times.empty()) {
+		return;
+	}
+
+	// contiguous runs per part, so every context warms the caches for one part of the window
+	const size_t first = times.size() * iPart / nParts;
+	const size_t last = times.size() * (iPart + 1) / nParts;
+	if (first == last) {
+		return;
+	}
+
+	const size_t size = (size_t)spd.pitch * spd.h;
+	if (bits.size() < size) {
+		bits.resize(size);
+	}
+	spd.bits = bits.data();
+
+	for (size_t i = first; i < last; i++) {
+		const bool bLocked = SUCCEEDED(Lock());
+
+		bool bResized;
+		{
+			// stop when the frame size changed, Render() would switch back to the old one
+			std::shared_lock<std::shared_mutex> lock(m_mutexRender);
+			bResized = (m_size != CSize(spd.w * 8, spd.h * 8) || m_vidrect != vidrect);
+		}
+
+		if (!bResized) {
+			RECT bbox;
+			Render(spd, times[i], fps, bbox);
+		}
+
+		if (bLocked) {
+			Unlock();
+		}
+
+		if (bResized) {
+			break;
+		}
+	}
+}
+
 //
 
 STDMETHODIMP CRenderedTextSubtitle::NonDelegatingQueryInterface(REFIID riid, void** ppv)
@@ -3155,6 +3666,7 @@ STDMETHODIMP CRenderedTextSubtitle::NonDelegatingQueryInterface(REFIID riid, voi
 		QI(IPersist)
 		QI(ISubStream)
 		QI(ISubPicProvider)
+		QI(ISubPicProviderRegion)
 		__super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -3167,7 +3679,7 @@ STDMETHODIMP_(POSITION) CRenderedTextSubtitle::GetStartPosition(REFERENCE_TIME r
 	}
 
 	int iSegment = -1;
-	SearchSubs((int)(rt / 10000), fps, &iSegment, NULL);
+	SearchSubs((int)(rt / 10000), fps, &iSegment, NULL, &m_positionCursor);
 
 	if (iSegment < 0) {
 		iSegment = 0;
@@ -3203,54 +3715,99 @@ STDMETHODIMP_(bool) CRenderedTextSubtitle::IsAnimated(POSITION pos)
 {
 	int iSegment = (int)pos - 1;
 
+	bool bIsAnimated = false;
+
 	const STSSegment* stss = GetSegment(iSegment);
 	if (stss) {
+		std::shared_lock<std::shared_mutex> lock(m_mutexRender);
+
+		CRenderingContextPtr pCtx = AcquireRenderingContext();
 		for (size_t i = 0, count = stss->subs.GetCount(); i < count; i++) {
-			CSubtitle* sub = GetSubtitle(stss->subs[i]);
+			CSubtitle* sub = GetSubtitle(*pCtx, stss->subs[i]);
 			if (sub && sub->m_bIsAnimated) {
-				return true;
+				bIsAnimated = true;
+				break;
 			}
 		}
+		ReleaseRenderingContext(std::move(pCtx));
 	}
 
-	return false;
+	return bIsAnimated;
 }
 
 STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox)
 {
-	std::unique_lock<std::mutex> lock(m_mutexRender);
+	return Render(spd, rt, fps, bbox, NULL);
+}
 
-	CRect bbox2;
+// ISubPicProviderRegion
+
+STDMETHODIMP CRenderedTextSubtitle::RenderRegion(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox, SubPicRegion& region)
+{
+	return Render(spd, rt, fps, bbox, &region);
+}
 
-	if (m_size != CSize(spd.w*8, spd.h*8) || m_vidrect != CRect(spd.vidrect.left*8, spd.vidrect.top*8, spd.vidrect.right*8, spd.vidrect.bottom*8)) {
-		Init(CSize(spd.w, spd.h), spd.vidrect);
+// private
+
+HRESULT CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox, SubPicRegion* pRegion)
+{
+	if (pRegion) {
+		pRegion->Clear();
+	}
+
+	const CSize size(spd.w*8, spd.h*8);
+	const CRect vidrect(spd.vidrect.left*8, spd.vidrect.top*8, spd.vidrect.right*8, spd.vidrect.bottom*8);
+
+	std::shared_lock<std::shared_mutex> lock(m_mutexRender);
+
+	while (m_size != size || m_vidrect != vidrect) {
+		lock.unlock();
+		{
+			std::unique_lock<std::shared_mutex> exclusiveLock(m_mutexRender);
+			if (m_size != size || m_vidrect != vidrect) {
+				Init(CSize(spd.w, spd.h), spd.vidrect);
+			}
+		}
+		lock.lock();
 	}
 
+	CRect bbox2;
+
 	int t = (int)(rt / 10000);
 
+	CRenderingContextPtr pCtx = AcquireRenderingContext(t);
+	CRenderingContext& ctx = *pCtx;
+
 	int segment;
-	const STSSegment* stss = SearchSubs(t, fps, &segment);
+	const STSSegment* stss = SearchSubs(t, fps, &segment, NULL, &ctx.m_searchCursor);
 	if (!stss) {
+		ReleaseRenderingContext(std::move(pCtx));
 		return S_FALSE;
 	}
 
+	ctx.m_renderedFrom = std::min(ctx.m_renderedFrom, t);
+	ctx.m_renderedTo = std::max(ctx.m_renderedTo, t);
+
+	const int nPhases = m_nSubpixelPhases;
+
 	// clear any cached subs that is behind current time
 	{
-		POSITION pos = m_subtitleCache.GetStartPosition();
+		POSITION pos = ctx.m_subtitleCache.GetStartPosition();
 		while (pos) {
 			int entry;
 			CSubtitle* pSub;
-			m_subtitleCache.GetNextAssoc(pos, entry, pSub);
+			ctx.m_subtitleCache.GetNextAssoc(pos, entry, pSub);
 
 			STSEntry& stse = GetAt(entry);
 			if (stse.end < t) {
 				delete pSub;
-				m_subtitleCache.RemoveKey(entry);
+				ctx.m_subtitleCache.RemoveKey(entry);
 			}
 		}
 	}
 
-	m_sla.AdvanceToSegment(segment, stss->subs);
+	CScreenLayoutAllocator sla;
+	GetLayout(ctx, segment, t, fps, sla);
 
 	CAtlArray<LSub> subs;
 
@@ -3269,11 +3826,11 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 
 		{
 			int start = TranslateStart(entry, fps);
-			m_time = t - start;
-			m_delay = TranslateEnd(entry, fps) - start;
+			ctx.m_time = t - start;
+			ctx.m_delay = TranslateEnd(entry, fps) - start;
 		}
 
-		CSubtitle* s = GetSubtitle(entry);
+		CSubtitle* s = GetSubtitle(ctx, entry);
 		if (!s) {
 			continue;
 		}
@@ -3291,7 +3848,12 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 		CPoint org2;
 
 		const auto& ptrAlphaMask = s->m_pClipper ? s->m_pClipper->GetAlphaMask(s->m_pClipper) : NULL;
-		BYTE* pAlphaMask = ptrAlphaMask ? ptrAlphaMask->get() : NULL;
+		AlphaMaskDesc alphaMask = {};
+		const AlphaMaskDesc* pAlphaMask = NULL;
+		if (ptrAlphaMask) {
+			alphaMask = ptrAlphaMask->GetDesc();
+			pAlphaMask = &alphaMask;
+		}
 
 		for (int k = 0; k < EF_NUMBEROFEFFECTS; k++) {
 			if (!s->m_effects[k]) {
@@ -3312,15 +3874,15 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 
 					if (t1 <= 0 && t2 <= 0) {
 						t1 = 0;
-						t2 = m_delay;
+						t2 = ctx.m_delay;
 					}
 
-					if (m_time <= t1) {
+					if (ctx.m_time <= t1) {
 						p = p1;
 					} else if (p1 == p2) {
 						p = p1;
-					} else if (t1 < m_time && m_time < t2) {
-						double t = 1.0*(m_time-t1)/(t2-t1);
+					} else if (t1 < ctx.m_time && ctx.m_time < t2) {
+						double t = 1.0*(ctx.m_time-t1)/(t2-t1);
 						p.x = (int)((1-t)*p1.x + t*p2.x);
 						p.y = (int)((1-t)*p1.y + t*p2.y);
 					} else {
@@ -3350,21 +3912,21 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 
 					if (t1 == -1 && t4 == -1) {
 						t1 = 0;
-						t3 = m_delay - t3;
-						t4 = m_delay;
+						t3 = ctx.m_delay - t3;
+						t4 = ctx.m_delay;
 					}
 
-					if (m_time < t1) {
+					if (ctx.m_time < t1) {
 						alpha = s->m_effects[k]->param[0];
-					} else if (m_time >= t1 && m_time < t2) {
-						double t = 1.0 * (m_time - t1) / (t2 - t1);
+					} else if (ctx.m_time >= t1 && ctx.m_time < t2) {
+						double t = 1.0 * (ctx.m_time - t1) / (t2 - t1);
 						alpha = (int)(s->m_effects[k]->param[0]*(1-t) + s->m_effects[k]->param[1]*t);
-					} else if (m_time >= t2 && m_time < t3) {
+					} else if (ctx.m_time >= t2 && ctx.m_time < t3) {
 						alpha = s->m_effects[k]->param[1];
-					} else if (m_time >= t3 && m_time < t4) {
-						double t = 1.0 * (m_time - t3) / (t4 - t3);
+					} else if (ctx.m_time >= t3 && ctx.m_time < t4) {
+						double t = 1.0 * (ctx.m_time - t3) / (t4 - t3);
 						alpha = (int)(s->m_effects[k]->param[1]*(1-t) + s->m_effects[k]->param[2]*t);
-					} else if (m_time >= t4) {
+					} else if (ctx.m_time >= t4) {
 						alpha = s->m_effects[k]->param[2];
 					}
 				}
@@ -3374,8 +3936,8 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 						right = s->m_relativeTo == 1 ? m_vidrect.right : m_size.cx;
 
 					r.left = !!s->m_effects[k]->param[1]
-							 ? (left/*marginRect.left*/ - spaceNeeded.cx) + (int)(m_time*8.0/s->m_effects[k]->param[0])
-							 : (right /*- marginRect.right*/) - (int)(m_time*8.0/s->m_effects[k]->param[0]);
+							 ? (left/*marginRect.left*/ - spaceNeeded.cx) + (int)(ctx.m_time*8.0/s->m_effects[k]->param[0])
+							 : (right /*- marginRect.right*/) - (int)(ctx.m_time*8.0/s->m_effects[k]->param[0]);
 
 					r.right = r.left + spaceNeeded.cx;
 
@@ -3386,8 +3948,8 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 				break;
 				case EF_SCROLL: { // Scroll up/down(toptobottom=param[3]);top=param[0];bottom=param[1];delay=param[2][;fadeawayheight=param[4]]
 					r.top = !!s->m_effects[k]->param[3]
-							? s->m_effects[k]->param[0] + (int)(m_time*8.0/s->m_effects[k]->param[2]) - spaceNeeded.cy
-							: s->m_effects[k]->param[1] - (int)(m_time*8.0/s->m_effects[k]->param[2]);
+							? s->m_effects[k]->param[0] + (int)(ctx.m_time*8.0/s->m_effects[k]->param[2]) - spaceNeeded.cy
+							: s->m_effects[k]->param[1] - (int)(ctx.m_time*8.0/s->m_effects[k]->param[2]);
 
 					r.bottom = r.top + spaceNeeded.cy;
 
@@ -3411,8 +3973,9 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 			}
 		}
 
-		if (!fPosOverride && !fOrgOverride && !s->m_fAnimated) {
-			r = m_sla.AllocRect(s, segment, entry, stse.layer, m_collisions);
+		if (IsCollisionPlaced(s)) {
+			// the layout of the segment placed it already
+			r = sla.AllocRect(s, segment, entry, stse.layer, m_collisions);
 		}
 
 		CPoint org;
@@ -3426,12 +3989,9 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 		CPoint p, p2(0, r.top);
 		p = p2;
 
-		// Rectangles for inverse clip
-		CRect iclipRect[4];
-		iclipRect[0] = CRect(0, 0, spd.w, clipRect.top);
-		iclipRect[1] = CRect(0, clipRect.top, clipRect.left, clipRect.bottom);
-		iclipRect[2] = CRect(clipRect.right, clipRect.top, spd.w, clipRect.bottom);
-		iclipRect[3] = CRect(0, clipRect.bottom, spd.w, spd.h);
+		// the shadows, outlines and bodies of all lines, blended together below
+		std::vector<CRasterizerDraw>& draws = ctx.m_draws;
+		draws.clear();
 
 		POSITION pos = s->GetHeadPosition();
 		while (pos) {
@@ -3440,14 +4000,7 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 			p.x = (s->m_scrAlignment % 3) == 1 ? org.x
 				: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
 				:                                org.x - (l->m_width / 2);
-			if (s->m_clipInverse) {
-				bbox2 |= l->PaintShadow(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintShadow(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintShadow(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintShadow(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
-			} else {
-				bbox2 |= l->PaintShadow(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
-			}
+			l->PaintShadow(draws, p, org2, ctx.m_time, alpha, nPhases);
 			p.y += l->m_ascent + l->m_descent;
 		}
 
@@ -3459,14 +4012,7 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 			p.x = (s->m_scrAlignment % 3) == 1 ? org.x
 				: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
 				:                                org.x - (l->m_width / 2);
-			if (s->m_clipInverse) {
-				bbox2 |= l->PaintOutline(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintOutline(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintOutline(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintOutline(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
-			} else {
-				bbox2 |= l->PaintOutline(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
-			}
+			l->PaintOutline(draws, p, org2, ctx.m_time, alpha, nPhases);
 			p.y += l->m_ascent + l->m_descent;
 		}
 
@@ -3478,18 +4024,20 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 			p.x = (s->m_scrAlignment % 3) == 1 ? org.x
 				: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
 				:                                org.x - (l->m_width / 2);
-			if (s->m_clipInverse) {
-				bbox2 |= l->PaintBody(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintBody(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintBody(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintBody(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
-			} else {
-				bbox2 |= l->PaintBody(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
-			}
+			l->PaintBody(draws, p, org2, ctx.m_time, alpha, nPhases);
 			p.y += l->m_ascent + l->m_descent;
 		}
+
+		const CRect rcDrawn = Rasterizer::DrawBatch(spd, clipRect, s->m_clipInverse, pAlphaMask, draws);
+		bbox2 |= rcDrawn;
+		if (pRegion) {
+			pRegion->Add(rcDrawn);
+		}
+		draws.clear();
 	}
 
+	ReleaseRenderingContext(std::move(pCtx));
+
 	bbox = bbox2;
 
 	return (subs.GetCount() && !bbox2.IsRectEmpty()) ? S_OK : S_FALSE;
@@ -22,12 +22,16 @@
 #pragma once
 
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <vector>
 #include "STS.h"
 #include "Rasterizer.h"
 #include "../SubPic/SubPicProviderImpl.h"
 #include "RenderingCache.h"
+#include "GlyphOutlineProvider.h"
 
 class Effect;
 struct CTextDims;
@@ -37,6 +41,13 @@ struct CPolygonPath {
 	CSize size;
 };
 
+// outline of a single glyph as the font engine returns it, before any CWord transformation
+struct CGlyphOutline {
+	CAtlArray<BYTE> types;
+	CAtlArray<POINT> points;
+	int advance;
+};
+
 struct CAlphaMask;
 
 struct alpha_mask_deleter {
@@ -57,11 +68,19 @@ struct CAlphaMask final : std::unique_ptr<BYTE[]> {
 
 	size_t m_size;
 
+	// the part of the frame stored and the value of the rest, see AlphaMaskDesc
+	CRect m_rect;
+	BYTE m_outside = 0;
+
 	explicit CAlphaMask(size_t size)
 		: std::unique_ptr<BYTE[]>(std::make_unique<BYTE[]>(size))
 		, m_size(size) {
 	}
 
+	AlphaMaskDesc GetDesc() const {
+		return { get(), m_rect, m_outside };
+	}
+
 	static std::shared_ptr<CAlphaMask> Alloc(std::list<CAlphaMask>& alphaMaskPool, size_t size) {
 		for (auto it = alphaMaskPool.begin(); it != alphaMaskPool.end(); ++it) {
 			auto& am = *it;
@@ -76,12 +95,21 @@ struct CAlphaMask final : std::unique_ptr<BYTE[]> {
 };
 
 typedef std::shared_ptr<CPolygonPath> CPolygonPathSharedPtr;
+typedef std::shared_ptr<CGlyphOutline> CGlyphOutlineSharedPtr;
 struct SSATag;
 typedef std::shared_ptr<CAtlList<SSATag>> SSATagsList;
 typedef std::shared_ptr<CAlphaMask> CAlphaMaskSharedPtr;
 
+template<> struct CRenderingCacheSizeTraits<CPolygonPathSharedPtr> { static size_t GetSize(const CPolygonPathSharedPtr& v); };
+template<> struct CRenderingCacheSizeTraits<CGlyphOutlineSharedPtr> { static size_t GetSize(const CGlyphOutlineSharedPtr& v); };
+template<> struct CRenderingCacheSizeTraits<SSATagsList> { static size_t GetSize(const SSATagsList& v); };
+template<> struct CRenderingCacheSizeTraits<COutlineDataSharedPtr> { static size_t GetSize(const COutlineDataSharedPtr& v); };
+template<> struct CRenderingCacheSizeTraits<COverlayDataSharedPtr> { static size_t GetSize(const COverlayDataSharedPtr& v); };
+template<> struct CRenderingCacheSizeTraits<CAlphaMaskSharedPtr> { static size_t GetSize(const CAlphaMaskSharedPtr& v); };
+
 typedef CRenderingCache<CTextDimsKey, CTextDims, CKeyTraits<CTextDimsKey>> CTextDimsCache;
 typedef CRenderingCache<CPolygonPathKey, CPolygonPathSharedPtr, CKeyTraits<CPolygonPathKey>> CPolygonCache;
+typedef CRenderingCache<CGlyphOutlineKey, CGlyphOutlineSharedPtr, CKeyTraits<CGlyphOutlineKey>> CGlyphOutlineCache;
 typedef CRenderingCache<CStringW, SSATagsList, CStringElementTraits<CStringW>> CSSATagsCache;
 typedef CRenderingCache<CEllipseKey, CEllipseSharedPtr, CKeyTraits<CEllipseKey>> CEllipseCache;
 typedef CRenderingCache<COutlineKey, COutlineDataSharedPtr, CKeyTraits<COutlineKey>> COutlineCache;
@@ -89,8 +117,12 @@ typedef CRenderingCache<COverlayKey, COverlayDataSharedPtr, CKeyTraits<COverlayK
 typedef CRenderingCache<CClipperKey, CAlphaMaskSharedPtr, CKeyTraits<CClipperKey>> CAlphaMaskCache;
 
 struct RenderingCaches {
+	// how the words using these caches are rasterized, set by the subtitle owning them
+	Rasterizer::Options rasterizerOptions;
+
 	CTextDimsCache textDimsCache;
 	CPolygonCache polygonCache;
+	CGlyphOutlineCache glyphOutlineCache;
 	CSSATagsCache SSATagsCache;
 	CEllipseCache ellipseCache;
 	COutlineCache outlineCache;
@@ -99,22 +131,34 @@ struct RenderingCaches {
 	std::list<CAlphaMask> alphaMaskPool;
 	CAlphaMaskCache alphaMaskCache;
 
+	enum {
+		TEXTDIMS,
+		POLYGON,
+		GLYPHOUTLINE,
+		SSATAGS,
+		ELLIPSE,
+		OUTLINE,
+		OVERLAY,
+		ALPHAMASK,
+		COUNT
+	};
+
+	static LPCWSTR GetName(int cache);
+
 	RenderingCaches()
 		: textDimsCache(2048)
 		, polygonCache(2048)
+		, glyphOutlineCache(4096)
 		, SSATagsCache(2048)
 		, ellipseCache(64)
 		, outlineCache(128)
 		, overlayCache(128)
 	, alphaMaskCache(128) {}
-};
-
-class CMyFont : public CFont
-{
-public:
-	int m_ascent, m_descent;
 
-	CMyFont(STSStyle& style);
+	// Splits nBytes between the caches, most of it goes to the overlays, outlines and masks.
+	// 0 removes the byte limits, the entry count limits above always apply.
+	void SetMemoryBudget(size_t nBytes);
+	void GetStats(CRenderingCacheStats stats[COUNT]) const;
 };
 
 struct CTextDims {
@@ -168,6 +212,8 @@ public:
 
 class CText : public CWord
 {
+	CGlyphOutlineSharedPtr GetGlyphOutline(IGlyphOutlineProvider* pProvider, LPCWSTR c);
+
 protected:
 	virtual bool CreatePath();
 
@@ -287,9 +333,9 @@ public:
 
 	void Compact();
 
-	CRect PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha);
-	CRect PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha);
-	CRect PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha);
+	void PaintShadow(std::vector<CRasterizerDraw>& draws, CPoint p, CPoint org, int time, int alpha, int nPhases);
+	void PaintOutline(std::vector<CRasterizerDraw>& draws, CPoint p, CPoint org, int time, int alpha, int nPhases);
+	void PaintBody(std::vector<CRasterizerDraw>& draws, CPoint p, CPoint org, int time, int alpha, int nPhases);
 };
 
 enum SSATagCmd {
@@ -412,6 +458,10 @@ public:
 	int m_wrapStyle;
 	bool m_fAnimated;
 	bool m_bIsAnimated;
+	// an animated subtitle is only parsed again when the time leaves this range
+	// or when it is shown for another duration than m_animDelay, the one it was parsed for
+	int m_animStableFrom, m_animStableTo;
+	int m_animDelay;
 	int m_relativeTo;
 
 	Effect* m_effects[EF_NUMBEROFEFFECTS];
@@ -441,10 +491,11 @@ class CScreenLayoutAllocator
 {
 	struct SubRect {
 		CRect r;
-		int segment, entry, layer;
+		int segment, entry;
 	};
 
-	CAtlList<SubRect> m_subrects;
+	// the placed rects by layer, subtitles only collide with the ones of their own layer
+	std::map<int, std::vector<SubRect>> m_layers;
 
 public:
 	/*virtual*/
@@ -454,48 +505,114 @@ public:
 	CRect AllocRect(const CSubtitle* s, int segment, int entry, int layer, int collisions);
 };
 
-class __declspec(uuid("537DCACA-2812-4a4f-B2C6-1A34C17ADEB0"))
-	CRenderedTextSubtitle : public CSimpleTextSubtitle, public CSubPicProviderImpl, public ISubStream
+// Everything a single Render() call modifies. The parsed script (entries, styles, segments)
+// is shared read-only, so each concurrent Render() works on its own context.
+class CRenderingContext
 {
-	static CAtlMap<CStringW, SSATagCmd, CStringElementTraits<CStringW>> s_SSATagCmds;
+public:
+	RenderingCaches m_renderingCaches;
 	CAtlMap<int, CSubtitle*> m_subtitleCache;
 
-	RenderingCaches m_renderingCaches;
+	// temp variables, used when parsing the script
+	int m_time = 0, m_delay = 0;
+	int m_animStart = 0, m_animEnd = 0;
+	double m_animAccel = 0.0;
+	int m_ktype = 0, m_kstart = 0, m_kend = 0;
+	int m_nPolygon = 0;
+	int m_polygonBaselineOffset = 0;
+	// times between which the animated values computed so far stay the same
+	int m_animStableFrom = INT_MIN, m_animStableTo = INT_MAX;
+
+	// times rendered with this context since it was emptied, its caches hold what is shown there
+	int m_renderedFrom = INT_MAX, m_renderedTo = INT_MIN;
+
+	// where this context's last segment lookup ended
+	STSSearchCursor m_searchCursor;
+
+	// word draws of the subtitle being rendered, kept to reuse the allocation
+	std::vector<CRasterizerDraw> m_draws;
+
+	// the statistics of the caches last added to the totals of the subtitle, see UpdateCacheStats()
+	CRenderingCacheStats m_reportedStats[RenderingCaches::COUNT];
 
-	CScreenLayoutAllocator m_sla;
+	~CRenderingContext();
 
+	void Empty();
+};
+
+typedef std::unique_ptr<CRenderingContext> CRenderingContextPtr;
+
+class __declspec(uuid("537DCACA-2812-4a4f-B2C6-1A34C17ADEB0"))
+	CRenderedTextSubtitle : public CSimpleTextSubtitle, public CSubPicProviderImpl, public ISubPicProviderRegion, public ISubStream
+{
 	CSize m_size;
 	CRect m_vidrect;
 
-	// temp variables, used when parsing the script
-	int m_time, m_delay;
-	int m_animStart, m_animEnd;
-	double m_animAccel;
-	int m_ktype, m_kstart, m_kend;
-	int m_nPolygon;
-	int m_polygonBaselineOffset;
 	STSStyle m_styleOverride; // the app can decide to use this style instead of a built-in one
 	bool m_bOverrideStyle;
 	bool m_bOverridePlacement;
 	CSize m_overridePlacement;
 
 	void ParseEffect(CSubtitle* sub, CString str);
-	void ParseString(CSubtitle* sub, CStringW str, STSStyle& style);
-	void ParsePolygon(CSubtitle* sub, CStringW str, STSStyle& style);
-	bool ParseSSATag(SSATagsList& tagsList, const CStringW& str);
-	bool CreateSubFromSSATag(CSubtitle* sub, const SSATagsList& tagsList, STSStyle& style, STSStyle& org, bool bUseOriginal, bool bAnimate = false);
-	bool ParseHtmlTag(CStringW str, STSStyle& style, const STSStyle& org, bool bUseOriginal);
+	void ParseString(CRenderingContext& ctx, CSubtitle* sub, CStringW str, STSStyle& style);
+	void ParsePolygon(CRenderingContext& ctx, CSubtitle* sub, CStringW str, STSStyle& style);
+	bool ParseSSATag(CRenderingContext& ctx, SSATagsList& tagsList, const CStringW& str);
+	bool CreateSubFromSSATag(CRenderingContext& ctx, CSubtitle* sub, const SSATagsList& tagsList, STSStyle& style, STSStyle& org, bool bUseOriginal, bool bAnimate = false);
+	bool ParseHtmlTag(CRenderingContext& ctx, CStringW str, STSStyle& style, const STSStyle& org, bool bUseOriginal);
 
-	double CalcAnimation(double dst, double src, bool fAnimate);
+	double CalcAnimation(CRenderingContext& ctx, double dst, double src, bool fAnimate);
 
-	CSubtitle* GetSubtitle(int entry);
+	CSubtitle* GetSubtitle(CRenderingContext& ctx, int entry);
 
 	bool m_bForced = false;
 
-	std::mutex m_mutexRender;
+	// segment lookups of GetStartPosition(), the subpic queue walks the script forward with it
+	STSSearchCursor m_positionCursor;
+
+	// subpixel positions per pixel the words are drawn at, see SetSubpixelPhases()
+	int m_nSubpixelPhases = 8;
+
+	// Render() holds it shared, anything that changes m_size or the rendering contexts holds it exclusively
+	std::shared_mutex m_mutexRender;
+
+	// idle rendering contexts, a Render() call takes one and gives it back when done
+	std::vector<CRenderingContextPtr> m_renderingContexts;
+	std::mutex m_mutexRenderingContexts;
+
+	// memory budget of the caches of all rendering contexts together, see SetCacheBudget()
+	size_t m_cacheBudget = 0;
+	// given to the caches of every rendering context, see SetRasterizerType(), SetGaussianBlurType() and SetBorderType()
+	Rasterizer::Options m_rasterizerOptions;
+
+	// rendering contexts alive, idle or rendering, each gets an equal share of m_cacheBudget
+	size_t m_nRenderingContexts = 0;
+
+	size_t GetContextCacheBudget() const {
+		return m_nRenderingContexts > 1 ? m_cacheBudget / m_nRenderingContexts : m_cacheBudget;
+	}
+
+	// statistics of the caches of all rendering contexts as of when each was last given back
+	CRenderingCacheStats m_cacheStats[RenderingCaches::COUNT];
+	void UpdateCacheStats(CRenderingContext& ctx, bool fDropped);
+
+	// The collision layout after each segment. It only depends on the segment, it is replayed
+	// from where the subtitles on screen appeared, so any context and thread gets the same one.
+	std::map<int, CScreenLayoutAllocator> m_layouts;
+	std::mutex m_mutexLayouts;
+
+	CRenderingContextPtr AcquireRenderingContext(int t = INT_MIN);
+	void ReleaseRenderingContext(CRenderingContextPtr ctx);
+	void EmptyRenderingContexts();
+
+	void GetCollisionSubs(CRenderingContext& ctx, int segment, int t, double fps, std::vector<std::pair<int, CSubtitle*>>& subs);
+	void GetLayout(CRenderingContext& ctx, int segment, int t, double fps, CScreenLayoutAllocator& sla);
+
+	// Render() and RenderRegion(), pRegion gets the area of each subtitle when not NULL
+	HRESULT Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox, SubPicRegion* pRegion);
 
 protected:
 	virtual void OnChanged();
+	virtual void OnSegmentsChanged();
 
 public:
 	CRenderedTextSubtitle(CCritSec* pLock);
@@ -515,10 +632,62 @@ public:
 		m_overridePlacement.SetSize(lHorPos, lVerPos);
 	}
 
+	// Snaps the words to 1, 2, 4 or 8 (default, no snapping) subpixel positions per pixel.
+	// Moving text then hits the overlay cache much more often at the price of a coarser motion.
+	void SetSubpixelPhases(int nPhases) {
+		m_nSubpixelPhases = (nPhases == 1 || nPhases == 2 || nPhases == 4) ? nPhases : 8;
+	}
+
+	int GetSubpixelPhases() const {
+		return m_nSubpixelPhases;
+	}
+
+	// Picks how the words are turned into coverage, both types give the same overlay
+	void SetRasterizerType(Rasterizer::RasterizerType type);
+
+	Rasterizer::RasterizerType GetRasterizerType() const {
+		return m_rasterizerOptions.rasterizerType;
+	}
+
+	// Picks how \blur is computed, the caches are emptied since the boxes give another overlay
+	void SetGaussianBlurType(Rasterizer::GaussianBlurType type);
+
+	Rasterizer::GaussianBlurType GetGaussianBlurType() const {
+		return m_rasterizerOptions.gaussianBlurType;
+	}
+
+	// Picks how the outlines are grown into borders, all types give the same border
+	void SetBorderType(Rasterizer::BorderType type);
+
+	Rasterizer::BorderType GetBorderType() const {
+		return m_rasterizerOptions.borderType;
+	}
+
+	// Limits the bytes held by the caches of all rendering contexts together, it is split evenly
+	// between them and re-split when one is added or dropped. 0 (default) leaves only the entry
+	// count limits.
+	void SetCacheBudget(size_t nBytes);
+
+	size_t GetCacheBudget() const {
+		return m_cacheBudget;
+	}
+
+	// Statistics of the caches summed over all rendering contexts, as of when each finished its last Render().
+	// It does not wait for the running ones.
+	void GetCacheStats(CRenderingCacheStats stats[RenderingCaches::COUNT]);
+
 	void SetName(const CString name);
 
 	const bool GetText(const REFERENCE_TIME rt, const double fps, CString& text);
 
+	// Parses and rasterizes the subtitles shown between rtStart and rtEnd into a scratch surface,
+	// so the next Render() calls there find them in the caches. The window is split into nParts
+	// contiguous runs, one per thread calling this with its iPart, each warming its own rendering
+	// context. bits is the surface, the caller keeps it across calls so it is allocated once.
+	// Takes the provider lock for every frame, the caller must not hold it.
+	// Does nothing before the first Render(), the frame size is not known until then.
+	void Warmup(REFERENCE_TIME rtStart, REFERENCE_TIME rtEnd, double fps, int iPart, int nParts, std::vector<BYTE>& bits);
+
 public:
 	bool Init(CSize size, const CRect& vidrect); // will call Deinit()
 	void Deinit();
@@ -536,6 +705,9 @@ public:
 
 	STDMETHODIMP_(SUBTITLE_TYPE) GetType() { return ST_TEXT; };
 
+	// ISubPicProviderRegion
+	STDMETHODIMP RenderRegion(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox, SubPicRegion& region);
+
 	// IPersist
 	STDMETHODIMP GetClassID(CLSID* pClassID);
 
@@ -43,6 +43,12 @@ Rasterizer::Rasterizer()
 	, mpScanBuffer(NULL)
 {
 	m_bUseAVX2 = CPUInfo::HaveAVX2();
+
+#ifdef _DEBUG
+	// the \be kernels must give the bytes of the plain loop, checked once
+	static const bool fBeFilterOK = CheckBeFilter(m_bUseAVX2);
+	ASSERT(fBeFilterOK);
+#endif
 }
 
 Rasterizer::~Rasterizer()
@@ -233,100 +239,6 @@ void Rasterizer::_EvaluateLine(int x0, int y0, int x1, int y1)
 	}
 }
 
-bool Rasterizer::BeginPath(HDC hdc)
-{
-	_TrashPath();
-
-	return !!::BeginPath(hdc);
-}
-
-bool Rasterizer::EndPath(HDC hdc)
-{
-	::CloseFigure(hdc);
-
-	if (::EndPath(hdc)) {
-		mPathPoints = GetPath(hdc, NULL, NULL, 0);
-
-		if (!mPathPoints) {
-			return true;
-		}
-
-		mpPathTypes = (BYTE*)malloc(sizeof(BYTE) * mPathPoints);
-		mpPathPoints = (POINT*)malloc(sizeof(POINT) * mPathPoints);
-
-		if (mPathPoints == GetPath(hdc, mpPathPoints, mpPathTypes, mPathPoints)) {
-			return true;
-		}
-	}
-
-	::AbortPath(hdc);
-
-	return false;
-}
-
-bool Rasterizer::PartialBeginPath(HDC hdc, bool bClearPath)
-{
-	if (bClearPath) {
-		_TrashPath();
-	}
-
-	return !!::BeginPath(hdc);
-}
-
-bool Rasterizer::PartialEndPath(HDC hdc, long dx, long dy)
-{
-	::CloseFigure(hdc);
-
-	if (::EndPath(hdc)) {
-		int nPoints;
-		BYTE* pNewTypes;
-		POINT* pNewPoints;
-
-		nPoints = GetPath(hdc, NULL, NULL, 0);
-
-		if (!nPoints) {
-			return true;
-		}
-
-		pNewTypes = (BYTE*)realloc(mpPathTypes, (mPathPoints + nPoints) * sizeof(BYTE));
-		pNewPoints = (POINT*)realloc(mpPathPoints, (mPathPoints + nPoints) * sizeof(POINT));
-
-		if (pNewTypes) {
-			mpPathTypes = pNewTypes;
-		}
-
-		if (pNewPoints) {
-			mpPathPoints = pNewPoints;
-		}
-
-		BYTE* pTypes = DNew BYTE[nPoints];
-		POINT* pPoints = DNew POINT[nPoints];
-
-		if (pNewTypes && pNewPoints && nPoints == GetPath(hdc, pPoints, pTypes, nPoints)) {
-			for (ptrdiff_t i = 0; i < nPoints; ++i) {
-				mpPathPoints[mPathPoints + i].x = pPoints[i].x + dx;
-				mpPathPoints[mPathPoints + i].y = pPoints[i].y + dy;
-				mpPathTypes[mPathPoints + i] = pTypes[i];
-			}
-
-			mPathPoints += nPoints;
-
-			delete[] pTypes;
-			delete[] pPoints;
-			return true;
-		} else {
-			DebugBreak();
-		}
-
-		delete[] pTypes;
-		delete[] pPoints;
-	}
-
-	::AbortPath(hdc);
-
-	return false;
-}
-
 bool Rasterizer::ScanConvert()
 {
 	try {
@@ -655,7 +567,7 @@ void Rasterizer::_OverlapRegion(tSpanBuffer& dst, const tSpanBuffer& src, int dx
 	}
 }
 
-bool Rasterizer::CreateWidenedRegion(int rx, int ry)
+bool Rasterizer::CreateWidenedRegion(int rx, int ry, const Options& options)
 {
 	if (m_pOutlineData->mOutline.empty()) {
 		return true;
@@ -671,7 +583,26 @@ bool Rasterizer::CreateWidenedRegion(int rx, int ry)
 	m_pOutlineData->mWideBorder = std::max(rx, ry);
 
 	if (m_pEllipse) {
-		CreateWidenedRegionFast(rx, ry);
+		BorderType type = options.borderType;
+		if (type == BORDER_AUTO) {
+			// the ellipse groups cost about (2 * ry + 1) per span, the distance
+			// about the area of the body plus the one of the widened region
+			const tSpanBuffer& outline = m_pOutlineData->mOutline;
+			__int64 rows = __int64(outline.back().first >> 32) - __int64(outline.front().first >> 32) + 1;
+			int xmin = INT_MAX, xmax = INT_MIN;
+			for (const auto& span : outline) {
+				xmin = std::min(xmin, int(span.first));
+				xmax = std::max(xmax, int(span.second));
+			}
+			__int64 width = __int64(xmax) - xmin + 2 * rx;
+			type = (__int64(outline.size()) * (2 * ry + 1) > width * (2 * rows + 2 * ry)) ? BORDER_DISTANCE : BORDER_ELLIPSE;
+		}
+
+		if (type == BORDER_DISTANCE) {
+			CreateWidenedRegionDistance(rx, ry);
+		} else {
+			CreateWidenedRegionFast(rx, ry);
+		}
 	} else if (ry > 0) {
 		// Do a half circle.
 		// _OverlapRegion mirrors this so both halves are done.
@@ -773,7 +704,364 @@ void Rasterizer::CreateWidenedRegionFast(int rx, int ry)
 	flushLines(yPrec - ry, yPrec + ry + 1, m_pOutlineData->mWideOutline);
 }
 
-bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
+// Same region as CreateWidenedRegionFast() without walking the ellipse for every span.
+// A cell at horizontal distance d from the body on row yb is covered by the ellipse of
+// that row on all the rows yb-h(d)..yb+h(d), h(d) being the last dy with GetArc(dy) >= d.
+// The distances are computed per row with two sweeps and the row intervals are summed
+// per column with a difference array, the work per cell does not depend on the radius.
+// The columns are done in strips to keep the counters small.
+void Rasterizer::CreateWidenedRegionDistance(int rx, int ry)
+{
+	const tSpanBuffer& outline = m_pOutlineData->mOutline;
+	tSpanBuffer& wideOutline = m_pOutlineData->mWideOutline;
+
+	const int y0 = int(outline.front().first >> 32);
+	const int y1 = int(outline.back().first >> 32);
+	const int bodyRows = y1 - y0 + 1;
+	const int rows = bodyRows + 2 * ry;
+
+	int xmin = INT_MAX, xmax = INT_MIN;
+	std::vector<size_t> rowStart(bodyRows + 1, 0);
+	for (const auto& span : outline) {
+		xmin = std::min(xmin, int(span.first));
+		xmax = std::max(xmax, int(span.second));
+		rowStart[int(span.first >> 32) - y0 + 1]++;
+	}
+	for (int i = 0; i < bodyRows; i++) {
+		rowStart[i + 1] += rowStart[i];
+	}
+
+	// h(d) for the distances which can reach another row
+	std::vector<int> reach(rx + 1);
+	for (int d = 0, dy = ry; d <= rx; d++) {
+		while (dy > 0 && m_pEllipse->GetArc(dy) < d) {
+			dy--;
+		}
+		reach[d] = dy;
+	}
+
+	const int STRIP = 64;
+	const int INF = INT_MAX / 2;
+	std::vector<int> counts((rows + 1) * STRIP);
+	std::vector<int> dist(STRIP);
+	std::vector<size_t> cursor(rowStart.cbegin(), rowStart.cend() - 1);
+	std::vector<std::vector<std::pair<int, int>>> wideRows(rows);
+
+	for (int sx = xmin - rx; sx < xmax + rx; sx += STRIP) {
+		const int sxEnd = sx + STRIP;
+
+		for (int i = 0; i < bodyRows; i++) {
+			size_t cur = cursor[i];
+			const size_t end = rowStart[i + 1];
+			if (rowStart[i] == end) {
+				continue;
+			}
+
+			while (cur < end && int(outline[cur].second) <= sx) {
+				cur++;
+			}
+			cursor[i] = cur;
+
+			// closest covered cells on both sides of the strip
+			int left = INT_MIN;
+			if (cur < end && int(outline[cur].first) < sx) {
+				left = sx - 1;
+			} else if (cur > rowStart[i]) {
+				left = int(outline[cur - 1].second) - 1;
+			}
+
+			std::fill(dist.begin(), dist.end(), INF);
+			size_t j = cur;
+			for (; j < end && int(outline[j].first) < sxEnd; j++) {
+				int a = std::max(int(outline[j].first), sx);
+				int b = std::min(int(outline[j].second), sxEnd);
+				std::fill(dist.begin() + (a - sx), dist.begin() + (b - sx), 0);
+			}
+
+			int right = INT_MAX;
+			if (j > cur && int(outline[j - 1].second) > sxEnd) {
+				right = sxEnd;
+			} else if (j < end) {
+				right = int(outline[j].first);
+			}
+
+			// too far from the strip to reach it
+			if (j == cur && (left == INT_MIN || sx - left > rx) && (right == INT_MAX || right - sxEnd + 1 > rx)) {
+				continue;
+			}
+
+			int carry = (left == INT_MIN) ? INF : sx - 1 - left;
+			for (int k = 0; k < STRIP; k++) {
+				carry = dist[k] ? std::min(carry + 1, INF) : 0;
+				dist[k] = carry;
+			}
+			carry = (right == INT_MAX) ? INF : right - sxEnd;
+			for (int k = STRIP - 1; k >= 0; k--) {
+				carry = dist[k] ? std::min(carry + 1, INF) : 0;
+				dist[k] = std::min(dist[k], carry);
+			}
+
+			for (int k = 0; k < STRIP; k++) {
+				if (dist[k] <= rx) {
+					const int h = reach[dist[k]];
+					counts[(i + ry - h) * STRIP + k]++;
+					counts[(i + ry + h + 1) * STRIP + k]--;
+				}
+			}
+		}
+
+		for (int r = 0; r < rows; r++) {
+			int* row = &counts[r * STRIP];
+			if (r > 0) {
+				const int* prev = row - STRIP;
+				for (int k = 0; k < STRIP; k++) {
+					row[k] += prev[k];
+				}
+			}
+
+			auto& wideRow = wideRows[r];
+			for (int k = 0; k < STRIP; k++) {
+				if (row[k] > 0) {
+					int k2 = k + 1;
+					while (k2 < STRIP && row[k2] > 0) {
+						k2++;
+					}
+					if (!wideRow.empty() && wideRow.back().second == sx + k) {
+						wideRow.back().second = sx + k2;
+					} else {
+						wideRow.emplace_back(sx + k, sx + k2);
+					}
+					k = k2;
+				}
+			}
+		}
+
+		std::fill(counts.begin(), counts.end(), 0);
+	}
+
+	size_t count = 0;
+	for (const auto& wideRow : wideRows) {
+		count += wideRow.size();
+	}
+	wideOutline.reserve(wideOutline.size() + count);
+
+	for (int r = 0; r < rows; r++) {
+		const unsigned __int64 y = unsigned __int64(y0 - ry + r) << 32;
+		for (const auto& span : wideRows[r]) {
+			wideOutline.emplace_back(y | unsigned int(span.first), y | unsigned int(span.second));
+		}
+	}
+}
+
+void Rasterizer::_FillSpans(byte* buffer, int pitch, const tSpanBuffer& spans, int xsub, int ysub)
+{
+	auto it		= spans.cbegin();
+	auto itEnd	= spans.cend();
+
+	for (; it != itEnd; ++it) {
+		unsigned __int64 f = (*it).first;
+		unsigned int y = (f >> 32) - 0x40000000 + ysub;
+		unsigned int x1 = (f & 0xffffffff) - 0x40000000 + xsub;
+
+		unsigned __int64 s = (*it).second;
+		unsigned int x2 = (s & 0xffffffff) - 0x40000000 + xsub;
+
+		if (x2 > x1) {
+			unsigned int first = x1 >> 3;
+			unsigned int last = (x2-1) >> 3;
+			byte* dst = buffer + pitch * (y >> 3) + first;
+
+			if (first == last) {
+				*dst += byte(x2-x1);
+			} else {
+				*dst += byte(((first+1)<<3) - x1);
+				++dst;
+
+				while (++first < last) {
+					*dst += 0x08;
+					++dst;
+				}
+
+				*dst += byte(x2 - (last<<3));
+			}
+		}
+	}
+}
+
+static __forceinline __m128i PrefixSum_epi16(__m128i v, __m128i carry)
+{
+	v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+	v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+	v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+	return _mm_add_epi16(v, carry);
+}
+
+static __forceinline __m128i BroadcastLast_epi16(__m128i v)
+{
+	v = _mm_shufflehi_epi16(v, 0xff);
+	return _mm_unpackhi_epi64(v, v);
+}
+
+// Same on 16 values, the sum of the low lane is carried into the high lane
+static __forceinline __m256i PrefixSum_epi16(__m256i v, __m256i carry)
+{
+	v = _mm256_add_epi16(v, _mm256_slli_si256(v, 2));
+	v = _mm256_add_epi16(v, _mm256_slli_si256(v, 4));
+	v = _mm256_add_epi16(v, _mm256_slli_si256(v, 8));
+	__m256i last = _mm256_shufflehi_epi16(v, 0xff);
+	last = _mm256_unpackhi_epi64(last, last);
+	v = _mm256_add_epi16(v, _mm256_permute2x128_si256(last, last, 0x08));
+	return _mm256_add_epi16(v, carry);
+}
+
+static __forceinline __m256i BroadcastLast_epi16(__m256i v)
+{
+	v = _mm256_shufflehi_epi16(v, 0xff);
+	v = _mm256_unpackhi_epi64(v, v);
+	return _mm256_permute2x128_si256(v, v, 0x11);
+}
+
+// Gathers the 8 subpixel lines of an overlay row before touching the buffer.
+// The partial pixels at the span ends go to 'cover', the pixels fully inside a span
+// are only marked by a +8/-8 step which is integrated while the row is written.
+// Tiles of 16 pixels where no span starts or ends are either empty (skipped) or
+// have the same level on all pixels (solid fill), so long spans cost nothing per pixel.
+void Rasterizer::_FillTiles(byte* buffer, int pitch, const tSpanBuffer& spans, int xsub, int ysub, bool bUseAVX2)
+{
+	if (spans.empty()) {
+		return;
+	}
+
+	// one tile of padding, a step can be set right after the last pixel
+	const size_t count = pitch + 16;
+	short* cover = (short*)_aligned_malloc(count * 2 * sizeof(short), 32);
+	if (!cover) {
+		_FillSpans(buffer, pitch, spans, xsub, ysub);
+		return;
+	}
+	short* steps = cover + count;
+	ZeroMemory(cover, count * 2 * sizeof(short));
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowbyte = _mm_set1_epi16(0xff);
+
+	auto it		= spans.cbegin();
+	auto itEnd	= spans.cend();
+
+	while (it != itEnd) {
+		const unsigned int row = ((unsigned int)((*it).first >> 32) - 0x40000000 + ysub) >> 3;
+		unsigned int minx = UINT_MAX, maxx = 0;
+
+		for (; it != itEnd; ++it) {
+			unsigned __int64 f = (*it).first;
+			unsigned int y = (f >> 32) - 0x40000000 + ysub;
+			if ((y >> 3) != row) {
+				break;
+			}
+			unsigned int x1 = (f & 0xffffffff) - 0x40000000 + xsub;
+
+			unsigned __int64 s = (*it).second;
+			unsigned int x2 = (s & 0xffffffff) - 0x40000000 + xsub;
+
+			if (x2 > x1) {
+				unsigned int first = x1 >> 3;
+				unsigned int last = (x2-1) >> 3;
+
+				if (first == last) {
+					cover[first] += short(x2-x1);
+				} else {
+					cover[first] += short(((first+1)<<3) - x1);
+					cover[last] += short(x2 - (last<<3));
+					steps[first+1] += 8;
+					steps[last] -= 8;
+				}
+
+				minx = std::min(minx, first);
+				maxx = std::max(maxx, last);
+			}
+		}
+
+		if (minx > maxx) {
+			continue;
+		}
+
+		byte* dst = buffer + pitch * row;
+
+		if (bUseAVX2) {
+			const __m256i zero256 = _mm256_setzero_si256();
+			const __m256i lowbyte256 = _mm256_set1_epi16(0xff);
+			__m256i carry = zero256;
+
+			for (unsigned int t = minx & ~15; t <= maxx; t += 16) {
+				__m256i c = _mm256_load_si256((__m256i*)(cover + t));
+				__m256i st = _mm256_load_si256((__m256i*)(steps + t));
+
+				if (_mm256_testz_si256(_mm256_or_si256(c, st), _mm256_or_si256(c, st))) {
+					const int level = _mm_cvtsi128_si32(_mm256_castsi256_si128(carry)) & 0xff;
+					if (level) {
+						__m128i d = _mm_load_si128((__m128i*)(dst + t));
+						_mm_store_si128((__m128i*)(dst + t), _mm_add_epi8(d, _mm_set1_epi8((char)level)));
+					}
+					continue;
+				}
+
+				st = PrefixSum_epi16(st, carry);
+				carry = BroadcastLast_epi16(st);
+
+				__m256i v = _mm256_and_si256(_mm256_add_epi16(st, c), lowbyte256);
+
+				__m128i d = _mm_load_si128((__m128i*)(dst + t));
+				__m128i b = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+				_mm_store_si128((__m128i*)(dst + t), _mm_add_epi8(d, b));
+
+				_mm256_store_si256((__m256i*)(cover + t), zero256);
+				_mm256_store_si256((__m256i*)(steps + t), zero256);
+			}
+
+			continue;
+		}
+
+		__m128i carry = zero;
+
+		for (unsigned int t = minx & ~15; t <= maxx; t += 16) {
+			__m128i c0 = _mm_load_si128((__m128i*)(cover + t));
+			__m128i c1 = _mm_load_si128((__m128i*)(cover + t + 8));
+			__m128i s0 = _mm_load_si128((__m128i*)(steps + t));
+			__m128i s1 = _mm_load_si128((__m128i*)(steps + t + 8));
+
+			__m128i any = _mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(s0, s1));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(any, zero)) == 0xffff) {
+				const int level = _mm_cvtsi128_si32(carry) & 0xff;
+				if (level) {
+					__m128i d = _mm_load_si128((__m128i*)(dst + t));
+					_mm_store_si128((__m128i*)(dst + t), _mm_add_epi8(d, _mm_set1_epi8((char)level)));
+				}
+				continue;
+			}
+
+			s0 = PrefixSum_epi16(s0, carry);
+			carry = BroadcastLast_epi16(s0);
+			s1 = PrefixSum_epi16(s1, carry);
+			carry = BroadcastLast_epi16(s1);
+
+			// keep the byte wrap-around of the span path
+			__m128i v0 = _mm_and_si128(_mm_add_epi16(s0, c0), lowbyte);
+			__m128i v1 = _mm_and_si128(_mm_add_epi16(s1, c1), lowbyte);
+
+			__m128i d = _mm_load_si128((__m128i*)(dst + t));
+			_mm_store_si128((__m128i*)(dst + t), _mm_add_epi8(d, _mm_packus_epi16(v0, v1)));
+
+			_mm_store_si128((__m128i*)(cover + t), zero);
+			_mm_store_si128((__m128i*)(cover + t + 8), zero);
+			_mm_store_si128((__m128i*)(steps + t), zero);
+			_mm_store_si128((__m128i*)(steps + t + 8), zero);
+		}
+	}
+
+	_aligned_free(cover);
+}
+
+bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur, const Options& options)
 {
 	m_pOverlayData = std::make_shared<COverlayData>();
 
@@ -832,39 +1120,15 @@ bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
 	// Are we doing a border?
 
 	const tSpanBuffer* pOutline[2] = {&m_pOutlineData->mOutline, &m_pOutlineData->mWideOutline};
+	const bool bTiles = (options.rasterizerType == RASTERIZER_TILES);
 
 	for (ptrdiff_t i = _countof(pOutline)-1; i >= 0; i--) {
-		auto it		= pOutline[i]->cbegin();
-		auto itEnd	= pOutline[i]->cend();
 		byte* buffer = (i == 0) ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
 
-		for (; it != itEnd; ++it) {
-			unsigned __int64 f = (*it).first;
-			unsigned int y = (f >> 32) - 0x40000000 + ysub;
-			unsigned int x1 = (f & 0xffffffff) - 0x40000000 + xsub;
-
-			unsigned __int64 s = (*it).second;
-			unsigned int x2 = (s & 0xffffffff) - 0x40000000 + xsub;
-
-			if (x2 > x1) {
-				unsigned int first = x1 >> 3;
-				unsigned int last = (x2-1) >> 3;
-				byte* dst = buffer + m_pOverlayData->mOverlayPitch * (y >> 3) + first;
-
-				if (first == last) {
-					*dst += byte(x2-x1);
-				} else {
-					*dst += byte(((first+1)<<3) - x1);
-					++dst;
-
-					while (++first < last) {
-						*dst += 0x08;
-						++dst;
-					}
-
-					*dst += byte(x2 - (last<<3));
-				}
-			}
+		if (bTiles) {
+			_FillTiles(buffer, m_pOverlayData->mOverlayPitch, *pOutline[i], xsub, ysub, m_bUseAVX2);
+		} else {
+			_FillSpans(buffer, m_pOverlayData->mOverlayPitch, *pOutline[i], xsub, ysub);
 		}
 	}
 
@@ -874,50 +1138,51 @@ bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
 		if (m_pOverlayData->mOverlayWidth >= filter.width && m_pOverlayData->mOverlayHeight >= filter.width) {
 			size_t pitch = m_pOverlayData->mOverlayPitch;
 
-			byte *tmp = (byte*)_aligned_malloc(pitch * m_pOverlayData->mOverlayHeight * sizeof(byte), 16);
-			if (!tmp) {
-				return false;
-			}
-
 			byte* src = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
 
-			SeparableFilterX_SSE2(src, tmp, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-								  filter.kernel, filter.width, filter.divisor);
-			SeparableFilterY_SSE2(tmp, src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-								  filter.kernel, filter.width, filter.divisor);
+			// above this width the kernel costs more than the boxes
+			const int maxKernelWidth = 15;
+			const GaussianBlurType type = options.gaussianBlurType;
+			BoxBlurKernel boxes(filter);
+
+			if ((type == GAUSSIAN_BLUR_BOXES || (type == GAUSSIAN_BLUR_AUTO && filter.width > maxKernelWidth)) && !boxes.IsEmpty()) {
+				if (!BoxBlur(src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch, boxes, m_bUseAVX2)) {
+					return false;
+				}
+			} else {
+				byte *tmp = (byte*)_aligned_malloc(pitch * m_pOverlayData->mOverlayHeight * sizeof(byte), 16);
+				if (!tmp) {
+					return false;
+				}
 
-			_aligned_free(tmp);
+				SeparableFilterX_SSE2(src, tmp, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
+									  filter.kernel, filter.width, filter.divisor);
+				SeparableFilterY_SSE2(tmp, src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
+									  filter.kernel, filter.width, filter.divisor);
+
+				_aligned_free(tmp);
+			}
 		}
 	}
 
 	// If we're blurring, do a 3x3 box blur
 	// Can't do it on subpictures smaller than 3x3 pixels
-	for (int pass = 0; pass < fBlur; pass++) {
-		if (m_pOverlayData->mOverlayWidth >= 3 && m_pOverlayData->mOverlayHeight >= 3) {
-			int pitch = m_pOverlayData->mOverlayPitch;
-
-			byte* tmp = DNew byte[pitch * m_pOverlayData->mOverlayHeight];
-			if (!tmp) {
-				return false;
-			}
-
-			byte* buffer = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
-			memcpy(tmp, buffer, pitch * m_pOverlayData->mOverlayHeight);
+	// Each pass rounds down, so the passes are run one after another
+	if (fBlur && m_pOverlayData->mOverlayWidth >= 3 && m_pOverlayData->mOverlayHeight >= 3) {
+		int pitch = m_pOverlayData->mOverlayPitch;
 
-			// This could be done in a separated way and win some speed
-			for (ptrdiff_t j = 1; j < m_pOverlayData->mOverlayHeight-1; j++) {
-				byte* src = tmp + pitch*j + 1;
-				byte* dst = buffer + pitch * j + 1;
+		unsigned short* tmp = (unsigned short*)_aligned_malloc(3 * pitch * sizeof(unsigned short), 32);
+		if (!tmp) {
+			return false;
+		}
 
-				for (ptrdiff_t i = 1; i < m_pOverlayData->mOverlayWidth-1; i++, src++, dst++) {
-					*dst = (src[-1-pitch] + (src[-pitch] << 1) + src[+1 - pitch]
-							+ (src[-1] << 1) + (src[0] << 2) + (src[+1] << 1)
-							+ src[-1 +pitch] + (src[+pitch] << 1) + src[+1 +pitch]) >> 4;
-				}
-			}
+		byte* buffer = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
 
-			delete [] tmp;
+		for (int pass = 0; pass < fBlur; pass++) {
+			BeFilter(buffer, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch, tmp, m_bUseAVX2);
 		}
+
+		_aligned_free(tmp);
 	}
 
 	return true;
@@ -1631,11 +1896,11 @@ namespace
 		const int len_bytes = len * sizeof(DWORD);
 
 		while (height--) {
-			VER::pix_mix_row(dst, alpha, len, switchpts[0], srcBorder, srcBody);
+			VER::pix_mix_row(dst, alpha, len, switchpts[0], srcBorder, srcBody, alpha_mask);
 			dst += len_bytes;
 			alpha += len;
 			alpha_mask += len;
-			VER::pix_mix_row(dst, alpha, len1, switchpts[2], srcBorder, srcBody);
+			VER::pix_mix_row(dst, alpha, len1, switchpts[2], srcBorder, srcBody, alpha_mask);
 			dst += pitch - len_bytes;
 			alpha += overlay_pitch - len;
 			alpha_mask += alpha_pitch - len;
@@ -1690,130 +1955,228 @@ namespace
 	}
 }
 
+namespace
+{
+	// Draw() of overlay, only the part inside of band is blended
+	CRect DrawOverlay(const COverlayData& overlay, bool bUseAVX2, SubPicDesc& spd, const CRect& band,
+					  const CRect& clipRect, bool fClipInverse, const AlphaMaskDesc* pAlphaMask, int xsub, int ysub,
+					  const DWORD* switchpts, bool fBody, bool fBorder)
+	{
+		CRect bbox(0, 0, 0, 0);
+
+		// Remember that all subtitle coordinates are specified in 1/8 pixels
+		// (x+4)>>3 rounds to nearest whole pixel.
+		// ??? What is xsub, ysub, mOffsetX and mOffsetY ?
+		const int x = (xsub + overlay.mOffsetX + 4)>>3;
+		const int y = (ysub + overlay.mOffsetY + 4)>>3;
+
+		// Limit drawn area to intersection of the band of the rendering surface and overlay
+		CRect ro(x, y, x + overlay.mOverlayWidth, y + overlay.mOverlayHeight);
+		ro &= band;
+
+		// Check if there's actually anything to render
+		if (ro.IsRectEmpty()) {
+			return bbox;
+		}
+
+		enum {
+			NONE = 0,
+			ALPHA = 1,
+			BODY = 1 << 1,
+			SWITCHPOINT = 1 << 2,
+		};
+
+		// draws the part rd of the area, am points at the mask value of its top left pixel or is NULL
+		auto DrawPart = [&](const CRect& rd, const BYTE* am, int amPitch) {
+			const int xo = rd.left - x;
+			const int yo = rd.top - y;
+			const int w = rd.Width();
+			const int h = rd.Height();
+
+			BYTE* srcBody = overlay.mpOverlayBufferBody + overlay.mOverlayPitch * yo + xo;
+			BYTE* srcBorder = overlay.mpOverlayBufferBorder + overlay.mOverlayPitch * yo + xo;
+			const BYTE* alphaMask = am;
+			BYTE* dst = (BYTE*)((DWORD*)((BYTE*)spd.bits + spd.pitch * rd.top) + rd.left);
+			BYTE* s = fBorder ? srcBorder : srcBody;
+
+			int draw_op = 0;
+			draw_op |= am ? ALPHA : 0;
+			draw_op |= fBody ? BODY : 0;
+			draw_op |= switchpts[1] != DWORD_MAX ? SWITCHPOINT : 0;
+
+			switch (draw_op) {
+				case BODY:
+					// Draw single color fill or shadow
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts);
+					break;
+				case NONE:
+					// Draw single color border
+					ASSERT(s == srcBorder);
+					__assume(s == srcBorder);
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, srcBorder,
+								 srcBody);
+					break;
+				case BODY | SWITCHPOINT:
+					// Draw multi color fill or shadow
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, xo);
+					break;
+				case SWITCHPOINT:
+					// Draw multi color border
+					ASSERT(s == srcBorder);
+					__assume(s == srcBorder);
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, srcBorder,
+								 srcBody, xo);
+					break;
+				case ALPHA:
+					// Draw single color border with alpha mask
+					ASSERT(s == srcBorder);
+					__assume(s == srcBorder);
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, srcBorder,
+								 srcBody, alphaMask, amPitch);
+					break;
+				case ALPHA | BODY:
+					// Draw single color fill or shadow with alpha mask
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, alphaMask,
+								 amPitch);
+					break;
+				case ALPHA | SWITCHPOINT:
+					// Draw multi color border with alpha mask
+					ASSERT(s == srcBorder);
+					__assume(s == srcBorder);
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, srcBorder,
+								 srcBody, alphaMask, amPitch, xo);
+					break;
+				case ALPHA | BODY | SWITCHPOINT:
+					// Draw multi color fill or shadow with alpha mask
+					DrawInternal(bUseAVX2, dst, spd.pitch, s, overlay.mOverlayPitch, w, h, switchpts, alphaMask,
+								 amPitch, xo);
+					break;
+				default:
+					ASSERT(FALSE);
+			}
+		};
+
+		// draws the part rd of the area with the mask
+		auto DrawMasked = [&](const CRect& rd) {
+			if (!pAlphaMask) {
+				DrawPart(rd, NULL, 0);
+				return;
+			}
+
+			// The mask only covers pAlphaMask->rect. Outside of it a value of 0 draws nothing
+			// and 0x40 draws exactly what no mask does, so those parts go without a mask.
+			CRect rm = rd & pAlphaMask->rect;
+			if (!rm.IsRectEmpty()) {
+				const int amPitch = pAlphaMask->rect.Width();
+				DrawPart(rm, pAlphaMask->bits + amPitch * (rm.top - pAlphaMask->rect.top) + (rm.left - pAlphaMask->rect.left), amPitch);
+			}
+
+			if (pAlphaMask->outside) {
+				if (rm.IsRectEmpty()) {
+					rm.SetRect(rd.left, rd.top, rd.left, rd.top);
+				}
+
+				const CRect parts[] = {
+					CRect(rd.left, rd.top, rd.right, rm.top),
+					CRect(rd.left, rm.top, rm.left, rm.bottom),
+					CRect(rm.right, rm.top, rd.right, rm.bottom),
+					CRect(rd.left, rm.bottom, rd.right, rd.bottom),
+				};
+
+				for (const auto& part : parts) {
+					if (!part.IsRectEmpty()) {
+						DrawPart(part, NULL, 0);
+					}
+				}
+			}
+		};
+
+		// draws the area inside of the rectangular clip r
+		auto DrawClipped = [&](const CRect& r) {
+			CRect rd = ro & r;
+			if (!rd.IsRectEmpty()) {
+				bbox |= rd;
+				DrawMasked(rd);
+			}
+		};
+
+		if (fClipInverse) {
+			// the spans above, left, right and below of the clip, same as four separate clips
+			DrawClipped(CRect(0, 0, spd.w, clipRect.top));
+			DrawClipped(CRect(0, clipRect.top, clipRect.left, clipRect.bottom));
+			DrawClipped(CRect(clipRect.right, clipRect.top, spd.w, clipRect.bottom));
+			DrawClipped(CRect(0, clipRect.bottom, spd.w, spd.h));
+		} else {
+			DrawClipped(clipRect);
+		}
+
+		return bbox;
+	}
+}
+
 // Render a subpicture onto a surface.
 // spd is the surface to render on.
 // clipRect is a rectangular clip region to render inside.
+// fClipInverse renders outside of clipRect instead.
 // pAlphaMask is an alpha clipping mask.
 // xsub and ysub ???
 // switchpts seems to be an array of fill colours interlaced with coordinates.
 //	switchpts[i*2] contains a colour and switchpts[i*2+1] contains the coordinate to use that colour from
 // fBody tells whether to render the body of the subs.
 // fBorder tells whether to render the border of the subs.
-CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int xsub, int ysub,
+CRect Rasterizer::Draw(SubPicDesc& spd, const CRect& clipRect, bool fClipInverse, const AlphaMaskDesc* pAlphaMask, int xsub, int ysub,
 					   const DWORD* switchpts, bool fBody, bool fBorder) const
 {
-	CRect bbox(0, 0, 0, 0);
-
 	if (!m_pOverlayData || !switchpts || (!fBody && !fBorder)) {
-		return bbox;
+		return CRect(0, 0, 0, 0);
 	}
 
-	// Limit drawn area to intersection of rendering surface and rectangular clip area
-	CRect r(0, 0, spd.w, spd.h);
-	r &= clipRect;
-
-	// Remember that all subtitle coordinates are specified in 1/8 pixels
-	// (x+4)>>3 rounds to nearest whole pixel.
-	// ??? What is xsub, ysub, mOffsetX and mOffsetY ?
-	int x = (xsub + m_pOverlayData->mOffsetX + 4)>>3;
-	int y = (ysub + m_pOverlayData->mOffsetY + 4)>>3;
-	int w = m_pOverlayData->mOverlayWidth;
-	int h = m_pOverlayData->mOverlayHeight;
-	int xo = 0, yo = 0;
-
-	// Again, limiting?
-	if (x < r.left) {
-		xo = r.left-x;
-		w -= r.left-x;
-		x = r.left;
-	}
-	if (y < r.top) {
-		yo = r.top-y;
-		h -= r.top-y;
-		y = r.top;
-	}
-	if (x+w > r.right) {
-		w = r.right-x;
-	}
-	if (y+h > r.bottom) {
-		h = r.bottom-y;
-	}
+	return DrawOverlay(*m_pOverlayData, m_bUseAVX2, spd, CRect(0, 0, spd.w, spd.h),
+					   clipRect, fClipInverse, pAlphaMask, xsub, ysub, switchpts, fBody, fBorder);
+}
 
-	// Check if there's actually anything to render
-	if (w <= 0 || h <= 0) {
-		return bbox;
+void Rasterizer::AddDraw(std::vector<CRasterizerDraw>& draws, int xsub, int ysub, const DWORD* switchpts, bool fBody, bool fBorder) const
+{
+	if (!m_pOverlayData || !switchpts || (!fBody && !fBorder)) {
+		return;
 	}
 
-	bbox.SetRect(x, y, x+w, y+h);
-	bbox &= CRect(0, 0, spd.w, spd.h);
+	CRasterizerDraw d = { m_pOverlayData, m_bUseAVX2, xsub, ysub, {}, fBody, fBorder };
+	// the shadow and outline switchpts end at their second entry
+	memcpy(d.switchpts, switchpts, (switchpts[1] == DWORD_MAX ? 2 : _countof(d.switchpts)) * sizeof(DWORD));
+	draws.push_back(std::move(d));
+}
 
-	BYTE* srcBody = m_pOverlayData->mpOverlayBufferBody + m_pOverlayData->mOverlayPitch * yo + xo;
-	BYTE* srcBorder = m_pOverlayData->mpOverlayBufferBorder + m_pOverlayData->mOverlayPitch * yo + xo;
-	BYTE* alphaMask = pAlphaMask + spd.w * y + x;
-	BYTE* dst = (BYTE*)((DWORD*)((BYTE*)spd.bits + spd.pitch * y) + x);
-	BYTE* s = fBorder ? srcBorder : srcBody;
+// bytes of the destination blended together by DrawBatch(), kept well inside the L2 cache
+static const int DRAW_BAND_SIZE = 64 * 1024;
 
-	enum {
-		NONE = 0,
-		ALPHA = 1,
-		BODY = 1 << 1,
-		SWITCHPOINT = 1 << 2,
-	};
+// Blends the draws in order like one Draw() each, but a band of rows at a time.
+// Every pixel gets the same blends in the same order, the band just stays in the cache
+// between them instead of streaming the whole area once per draw.
+CRect Rasterizer::DrawBatch(SubPicDesc& spd, const CRect& clipRect, bool fClipInverse, const AlphaMaskDesc* pAlphaMask,
+							const std::vector<CRasterizerDraw>& draws)
+{
+	CRect bbox(0, 0, 0, 0);
+
+	// rows covered by any of the overlays
+	int top = INT_MAX, bottom = INT_MIN;
+	for (const auto& d : draws) {
+		const int y = (d.ysub + d.pOverlayData->mOffsetY + 4)>>3;
+		top = std::min(top, y);
+		bottom = std::max(bottom, y + d.pOverlayData->mOverlayHeight);
+	}
+	top = std::max(top, 0);
+	bottom = std::min(bottom, spd.h);
+
+	const int bandHeight = std::max(1, DRAW_BAND_SIZE / std::max(1, abs(spd.pitch)));
 
-	int draw_op = 0;
-	draw_op |= pAlphaMask ? ALPHA : 0;
-	draw_op |= fBody ? BODY : 0;
-	draw_op |= switchpts[1] != DWORD_MAX ? SWITCHPOINT : 0;
-
-	switch (draw_op) {
-		case BODY:
-			// Draw single color fill or shadow
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts);
-			break;
-		case NONE:
-			// Draw single color border
-			ASSERT(s == srcBorder);
-			__assume(s == srcBorder);
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
-						 srcBody);
-			break;
-		case BODY | SWITCHPOINT:
-			// Draw multi color fill or shadow
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, xo);
-			break;
-		case SWITCHPOINT:
-			// Draw multi color border
-			ASSERT(s == srcBorder);
-			__assume(s == srcBorder);
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
-						 srcBody, xo);
-			break;
-		case ALPHA:
-			// Draw single color border with alpha mask
-			ASSERT(s == srcBorder);
-			__assume(s == srcBorder);
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
-						 srcBody, alphaMask, spd.w);
-			break;
-		case ALPHA | BODY:
-			// Draw single color fill or shadow with alpha mask
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, alphaMask,
-						 spd.w);
-			break;
-		case ALPHA | SWITCHPOINT:
-			// Draw multi color border with alpha mask
-			ASSERT(s == srcBorder);
-			__assume(s == srcBorder);
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
-						 srcBody, alphaMask, spd.w, xo);
-			break;
-		case ALPHA | BODY | SWITCHPOINT:
-			// Draw multi color fill or shadow with alpha mask
-			DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, alphaMask,
-						 spd.w, xo);
-			break;
-		default:
-			ASSERT(FALSE);
+	for (int y = top; y < bottom; y += bandHeight) {
+		const CRect band(0, y, spd.w, std::min(y + bandHeight, bottom));
+
+		for (const auto& d : draws) {
+			bbox |= DrawOverlay(*d.pOverlayData, d.bUseAVX2, spd, band,
+								clipRect, fClipInverse, pAlphaMask, d.xsub, d.ysub, d.switchpts, d.fBody, d.fBorder);
+		}
 	}
 
 	return bbox;
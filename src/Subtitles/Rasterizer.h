@@ -51,6 +51,14 @@ struct COutlineData {
 
 typedef std::shared_ptr<COutlineData> COutlineDataSharedPtr;
 
+// Alpha clipping mask (0 - 0x40) of a frame. Only rect is stored, with a pitch of rect.Width(),
+// all the other pixels of the frame have the value outside (0 for \clip, 0x40 for \iclip).
+struct AlphaMaskDesc {
+	const BYTE* bits;
+	CRect rect;
+	BYTE outside;
+};
+
 struct COverlayData {
 	int mOffsetX, mOffsetY;
 	int mOverlayWidth, mOverlayHeight, mOverlayPitch;
@@ -129,6 +137,15 @@ struct COverlayData {
 
 typedef std::shared_ptr<COverlayData> COverlayDataSharedPtr;
 
+// A Draw() of an overlay, recorded by Rasterizer::AddDraw() and blended by Rasterizer::DrawBatch()
+struct CRasterizerDraw {
+	COverlayDataSharedPtr pOverlayData;
+	bool bUseAVX2;
+	int xsub, ysub;
+	DWORD switchpts[6];
+	bool fBody, fBorder;
+};
+
 class Rasterizer
 {
 	bool fFirstSet;
@@ -170,21 +187,52 @@ private:
 	// The following function is templated and forcingly inlined for performance sake
 	template<int flag> __forceinline void _EvaluateLine(int x0, int y0, int x1, int y1);
 	static void _OverlapRegion(tSpanBuffer& dst, const tSpanBuffer& src, int dx, int dy);
+	static void _FillSpans(byte* buffer, int pitch, const tSpanBuffer& spans, int xsub, int ysub);
+	static void _FillTiles(byte* buffer, int pitch, const tSpanBuffer& spans, int xsub, int ysub, bool bUseAVX2);
 	void CreateWidenedRegionFast(int borderX, int borderY);
+	void CreateWidenedRegionDistance(int borderX, int borderY);
 
 public:
+	// How Rasterize() turns the spans into coverage, both give the same overlay
+	enum RasterizerType {
+		RASTERIZER_SPANS,	// one span at a time
+		RASTERIZER_TILES	// one overlay row at a time, in 16 pixel tiles
+	};
+
+	// How \blur is computed, the default is GAUSSIAN_BLUR_KERNEL. The boxes do not give
+	// the same overlay, see BoxBlurKernel for the tolerance.
+	enum GaussianBlurType {
+		GAUSSIAN_BLUR_AUTO,		// kernel for small radii, boxes otherwise
+		GAUSSIAN_BLUR_KERNEL,	// exact, the cost grows with the radius
+		GAUSSIAN_BLUR_BOXES		// stacked box blurs, the cost does not depend on the radius
+	};
+
+	// How CreateWidenedRegion() grows the outline, all give the same region
+	enum BorderType {
+		BORDER_AUTO,		// whichever should be cheaper for the outline
+		BORDER_ELLIPSE,		// ellipse center groups, the cost grows with the radius
+		BORDER_DISTANCE		// distance to the body, the cost grows with the area
+	};
+
+	// How a word is rasterized, every subtitle has its own, see CRenderedTextSubtitle::SetRasterizerType()
+	struct Options {
+		RasterizerType rasterizerType = RASTERIZER_TILES;
+		GaussianBlurType gaussianBlurType = GAUSSIAN_BLUR_KERNEL;
+		BorderType borderType = BORDER_AUTO;
+	};
+
 	Rasterizer();
 	virtual ~Rasterizer();
 
-	bool BeginPath(HDC hdc);
-	bool EndPath(HDC hdc);
-	bool PartialBeginPath(HDC hdc, bool bClearPath);
-	bool PartialEndPath(HDC hdc, long dx, long dy);
 	bool ScanConvert();
-	bool CreateWidenedRegion(int borderX, int borderY);
-	bool Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur);
+	bool CreateWidenedRegion(int borderX, int borderY, const Options& options);
+	bool Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur, const Options& options);
 	int getOverlayWidth() const;
 
-	CRect Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int xsub, int ysub, const DWORD* switchpts, bool fBody, bool fBorder) const;
+	CRect Draw(SubPicDesc& spd, const CRect& clipRect, bool fClipInverse, const AlphaMaskDesc* pAlphaMask, int xsub, int ysub, const DWORD* switchpts, bool fBody, bool fBorder) const;
+	// records what Draw() would blend with the current overlay, switchpts has up to 6 entries
+	void AddDraw(std::vector<CRasterizerDraw>& draws, int xsub, int ysub, const DWORD* switchpts, bool fBody, bool fBorder) const;
+	static CRect DrawBatch(SubPicDesc& spd, const CRect& clipRect, bool fClipInverse, const AlphaMaskDesc* pAlphaMask,
+						   const std::vector<CRasterizerDraw>& draws);
 	void FillSolidRect(SubPicDesc& spd, int x, int y, int nWidth, int nHeight, DWORD lColor) const;
 };
@@ -76,6 +76,50 @@ bool CTextDimsKey::operator==(const CTextDimsKey& textDimsKey) const
 		   && m_style->fStrikeOut == textDimsKey.m_style->fStrikeOut;
 }
 
+CGlyphOutlineKey::CGlyphOutlineKey(WCHAR c, const STSStyle& style)
+	: m_char(c)
+	, m_fontName(style.fontName)
+	, m_fontSize(style.fontSize)
+	, m_fontWeight(style.fontWeight)
+	, m_charSet(style.charSet)
+	, m_fItalic(!!style.fItalic)
+	, m_fUnderline(!!style.fUnderline)
+	, m_fStrikeOut(!!style.fStrikeOut)
+{
+	UpdateHash();
+}
+
+void CGlyphOutlineKey::UpdateHash()
+{
+	m_hash  = m_char;
+	m_hash += m_hash << 5;
+	m_hash += m_charSet;
+	m_hash += m_hash << 5;
+	m_hash += CStringElementTraits<CString>::Hash(m_fontName);
+	m_hash += m_hash << 5;
+	m_hash += int(m_fontSize);
+	m_hash += m_hash << 5;
+	m_hash += m_fontWeight;
+	m_hash += m_hash << 5;
+	m_hash += m_fItalic;
+	m_hash += m_hash << 5;
+	m_hash += m_fUnderline;
+	m_hash += m_hash << 5;
+	m_hash += m_fStrikeOut;
+}
+
+bool CGlyphOutlineKey::operator==(const CGlyphOutlineKey& glyphOutlineKey) const
+{
+	return m_char == glyphOutlineKey.m_char
+		   && m_charSet == glyphOutlineKey.m_charSet
+		   && m_fontName == glyphOutlineKey.m_fontName
+		   && NEARLY_EQ(m_fontSize, glyphOutlineKey.m_fontSize, 1e-6)
+		   && m_fontWeight == glyphOutlineKey.m_fontWeight
+		   && m_fItalic == glyphOutlineKey.m_fItalic
+		   && m_fUnderline == glyphOutlineKey.m_fUnderline
+		   && m_fStrikeOut == glyphOutlineKey.m_fStrikeOut;
+}
+
 CPolygonPathKey::CPolygonPathKey(const CStringW& str, double scalex, double scaley)
 	: m_str(str)
 	, m_scalex(scalex)
@@ -234,3 +278,112 @@ bool CClipperKey::operator==(const CClipperKey& clipperKey) const
 	}
 	return false;
 }
+
+// byte sizes of the cached values
+
+size_t CRenderingCacheSizeTraits<CPolygonPathSharedPtr>::GetSize(const CPolygonPathSharedPtr& v)
+{
+	if (!v) {
+		return 0;
+	}
+
+	return sizeof(CPolygonPath) + v->typesOrg.GetCount() * sizeof(BYTE) + v->pointsOrg.GetCount() * sizeof(CPoint);
+}
+
+size_t CRenderingCacheSizeTraits<CGlyphOutlineSharedPtr>::GetSize(const CGlyphOutlineSharedPtr& v)
+{
+	if (!v) {
+		return 0;
+	}
+
+	return sizeof(CGlyphOutline) + v->types.GetCount() * sizeof(BYTE) + v->points.GetCount() * sizeof(POINT);
+}
+
+size_t CRenderingCacheSizeTraits<SSATagsList>::GetSize(const SSATagsList& v)
+{
+	if (!v) {
+		return 0;
+	}
+
+	size_t size = sizeof(CAtlList<SSATag>);
+	POSITION pos = v->GetHeadPosition();
+	while (pos) {
+		const SSATag& tag = v->GetNext(pos);
+		size += sizeof(SSATag) + tag.params.GetCount() * sizeof(CStringW)
+				+ tag.paramsInt.GetCount() * sizeof(int) + tag.paramsReal.GetCount() * sizeof(double);
+		if (tag.subTagsList) {
+			size += GetSize(tag.subTagsList);
+		}
+	}
+	return size;
+}
+
+size_t CRenderingCacheSizeTraits<COutlineDataSharedPtr>::GetSize(const COutlineDataSharedPtr& v)
+{
+	if (!v) {
+		return 0;
+	}
+
+	return sizeof(COutlineData)
+		   + (v->mOutline.capacity() + v->mWideOutline.capacity()) * sizeof(tSpanBuffer::value_type);
+}
+
+size_t CRenderingCacheSizeTraits<COverlayDataSharedPtr>::GetSize(const COverlayDataSharedPtr& v)
+{
+	if (!v) {
+		return 0;
+	}
+
+	// body and border planes
+	return sizeof(COverlayData) + size_t(v->mOverlayPitch) * v->mOverlayHeight * 2;
+}
+
+size_t CRenderingCacheSizeTraits<CAlphaMaskSharedPtr>::GetSize(const CAlphaMaskSharedPtr& v)
+{
+	if (!v) {
+		return 0;
+	}
+
+	return sizeof(CAlphaMask) + v->m_size;
+}
+
+// RenderingCaches
+
+LPCWSTR RenderingCaches::GetName(int cache)
+{
+	static const LPCWSTR names[COUNT] = {
+		L"textdims", L"polygon", L"glyphoutline", L"ssatags", L"ellipse", L"outline", L"overlay", L"alphamask"
+	};
+	return (cache >= 0 && cache < COUNT) ? names[cache] : L"";
+}
+
+void RenderingCaches::SetMemoryBudget(size_t nBytes)
+{
+	// percent of the budget per cache, in the order of the enum
+	static const size_t shares[COUNT] = { 2, 4, 5, 3, 1, 20, 45, 20 };
+
+	auto share = [&](int cache) {
+		return nBytes ? std::max<size_t>(1, nBytes / 100 * shares[cache]) : 0;
+	};
+
+	textDimsCache.SetMaxBytes(share(TEXTDIMS));
+	polygonCache.SetMaxBytes(share(POLYGON));
+	glyphOutlineCache.SetMaxBytes(share(GLYPHOUTLINE));
+	SSATagsCache.SetMaxBytes(share(SSATAGS));
+	ellipseCache.SetMaxBytes(share(ELLIPSE));
+	outlineCache.SetMaxBytes(share(OUTLINE));
+	overlayCache.SetMaxBytes(share(OVERLAY));
+	alphaMaskCache.SetMaxBytes(share(ALPHAMASK));
+}
+
+void RenderingCaches::GetStats(CRenderingCacheStats stats[COUNT]) const
+{
+	stats[TEXTDIMS] = textDimsCache.GetStats();
+	stats[POLYGON] = polygonCache.GetStats();
+	stats[GLYPHOUTLINE] = glyphOutlineCache.GetStats();
+	stats[SSATAGS] = SSATagsCache.GetStats();
+	stats[ELLIPSE] = ellipseCache.GetStats();
+	stats[OUTLINE] = outlineCache.GetStats();
+	stats[OVERLAY] = overlayCache.GetStats();
+	stats[ALPHAMASK] = alphaMaskCache.GetStats();
+}
@@ -22,19 +22,68 @@
 
 #include <atlcoll.h>
 
-template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>>
+// Bytes held by a cached value, values owning more memory than themselves specialize it.
+template<typename V>
+struct CRenderingCacheSizeTraits {
+	static size_t GetSize(const V&) { return sizeof(V); }
+};
+
+struct CRenderingCacheStats {
+	size_t nHits = 0, nMisses = 0, nEvictions = 0;
+	size_t nEntries = 0, nBytes = 0;
+
+	CRenderingCacheStats& operator+=(const CRenderingCacheStats& stats) {
+		nHits += stats.nHits;
+		nMisses += stats.nMisses;
+		nEvictions += stats.nEvictions;
+		nEntries += stats.nEntries;
+		nBytes += stats.nBytes;
+		return *this;
+	}
+
+	CRenderingCacheStats& operator-=(const CRenderingCacheStats& stats) {
+		nHits -= stats.nHits;
+		nMisses -= stats.nMisses;
+		nEvictions -= stats.nEvictions;
+		nEntries -= stats.nEntries;
+		nBytes -= stats.nBytes;
+		return *this;
+	}
+};
+
+// LRU cache limited to maxSize entries and, when set, maxBytes bytes of values.
+template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>, class VSizeTraits = CRenderingCacheSizeTraits<V>>
 class CRenderingCache : private CAtlMap<K, POSITION, KTraits>
 {
 private:
 	size_t m_maxSize;
+	size_t m_maxBytes; // 0 is no limit
+	size_t m_nBytes;
+	size_t m_nHits, m_nMisses, m_nEvictions;
 	struct CPositionValue {
 		POSITION pos;
 		V value;
+		size_t size;
 	};
 	CAtlList<CPositionValue> m_list;
 
+	void RemoveTail() {
+		const CPositionValue& posVal = m_list.GetTail();
+		m_nBytes -= posVal.size;
+		__super::RemoveAtPos(posVal.pos);
+		m_list.RemoveTailNoReturn();
+		m_nEvictions++;
+	}
+
+	// keeps the most recently used entry even if it alone is over the limit
+	void Trim() {
+		while (m_list.GetCount() > 1 && m_maxBytes && m_nBytes > m_maxBytes) {
+			RemoveTail();
+		}
+	}
+
 public:
-	CRenderingCache(size_t maxSize) : m_maxSize(maxSize) {};
+	CRenderingCache(size_t maxSize) : m_maxSize(maxSize), m_maxBytes(0), m_nBytes(0), m_nHits(0), m_nMisses(0), m_nEvictions(0) {};
 
 	bool Lookup(typename KTraits::INARGTYPE key, _Out_ typename VTraits::OUTARGTYPE value) {
 		POSITION pos;
@@ -43,12 +92,17 @@ public:
 		if (bFound) {
 			m_list.MoveToHead(pos);
 			value = m_list.GetHead().value;
+			m_nHits++;
+		} else {
+			m_nMisses++;
 		}
 
 		return bFound;
 	};
 
 	POSITION SetAt(typename KTraits::INARGTYPE key, typename VTraits::INARGTYPE value) {
+		const size_t size = VSizeTraits::GetSize(value);
+
 		POSITION pos;
 		bool bFound = __super::Lookup(key, pos);
 
@@ -57,15 +111,23 @@ public:
 			CPositionValue& posVal = m_list.GetHead();
 			pos = posVal.pos;
 			posVal.value = value;
+			m_nBytes += size - posVal.size;
+			posVal.size = size;
+			Trim();
 		} else {
-			if (m_list.GetCount() >= m_maxSize) {
-				__super::RemoveAtPos(m_list.GetTail().pos);
-				m_list.RemoveTailNoReturn();
+			if (m_maxBytes && size > m_maxBytes) {
+				// would push everything else out and still not fit
+				return NULL;
+			}
+			while (m_list.GetCount() && (m_list.GetCount() >= m_maxSize || (m_maxBytes && m_nBytes + size > m_maxBytes))) {
+				RemoveTail();
 			}
 			pos = __super::SetAt(key, m_list.AddHead());
 			CPositionValue& posVal = m_list.GetHead();
 			posVal.pos = pos;
 			posVal.value = value;
+			posVal.size = size;
+			m_nBytes += size;
 		}
 
 		return pos;
@@ -74,6 +136,28 @@ public:
 	void Clear() {
 		m_list.RemoveAll();
 		__super::RemoveAll();
+		m_nBytes = 0;
+	}
+
+	void SetMaxBytes(size_t maxBytes) {
+		m_maxBytes = maxBytes;
+		Trim();
+		if (m_maxBytes && m_nBytes > m_maxBytes) {
+			RemoveTail();
+		}
+	}
+
+	size_t GetHitCount() const { return m_nHits; }
+	size_t GetMissCount() const { return m_nMisses; }
+
+	CRenderingCacheStats GetStats() const {
+		CRenderingCacheStats stats;
+		stats.nHits = m_nHits;
+		stats.nMisses = m_nMisses;
+		stats.nEvictions = m_nEvictions;
+		stats.nEntries = m_list.GetCount();
+		stats.nBytes = m_nBytes;
+		return stats;
 	}
 };
 
@@ -112,6 +196,30 @@ public:
 	bool operator==(const CTextDimsKey& textDimsKey) const;
 };
 
+// The font of a single character, the spacing only moves the glyph so it is not part of the key
+class CGlyphOutlineKey
+{
+private:
+	ULONG m_hash;
+
+protected:
+	WCHAR m_char;
+	CString m_fontName;
+	double m_fontSize;
+	LONG m_fontWeight;
+	int m_charSet;
+	bool m_fItalic, m_fUnderline, m_fStrikeOut;
+
+public:
+	CGlyphOutlineKey(WCHAR c, const STSStyle& style);
+
+	ULONG GetHash() const { return m_hash; };
+
+	void UpdateHash();
+
+	bool operator==(const CGlyphOutlineKey& glyphOutlineKey) const;
+};
+
 class CPolygonPathKey
 {
 private:
@@ -2063,6 +2063,9 @@ CSimpleTextSubtitle::CSimpleTextSubtitle()
 CSimpleTextSubtitle::~CSimpleTextSubtitle()
 {
 	Empty();
+
+	DLog(L"CSimpleTextSubtitle : %Iu segment searches, %Iu cursor hits, %Iu index builds",
+		 GetSearchCount(), GetSearchCursorHitCount(), GetSegmentIndexBuildCount());
 }
 /*
 CSimpleTextSubtitle::CSimpleTextSubtitle(CSimpleTextSubtitle& sts)
@@ -2168,9 +2171,20 @@ void CSimpleTextSubtitle::Empty()
 	m_dstScreenSize = CSize(0, 0);
 	m_styles.Free();
 	m_segments.RemoveAll();
+	InvalidateSegmentIndex();
 	RemoveAll();
 }
 
+void CSimpleTextSubtitle::OnChanged()
+{
+	InvalidateSegmentIndex();
+}
+
+void CSimpleTextSubtitle::OnSegmentsChanged()
+{
+	InvalidateSegmentIndex();
+}
+
 static bool SegmentCompStart(const STSSegment& segment, int start)
 {
 	return (segment.start < start);
@@ -2204,6 +2218,10 @@ void CSimpleTextSubtitle::Add(CStringW str, bool fUnicode, int start, int end, C
 
 	int n = (int)__super::Add(sub);
 
+	if (m_bBulkLoad) {
+		return;
+	}
+
 	// Entries with a null duration don't belong to any segments since
 	// they are not to be rendered. We choose not to skip them completely
 	// so that they are not lost when saving a subtitle file from MPC-BE
@@ -2213,6 +2231,8 @@ void CSimpleTextSubtitle::Add(CStringW str, bool fUnicode, int start, int end, C
 		return;
 	}
 
+	OnSegmentsChanged();
+
 	size_t segmentsCount = m_segments.GetCount();
 
 	if (segmentsCount == 0) { // First segment
@@ -2490,71 +2510,83 @@ int CSimpleTextSubtitle::SearchSub(int t, double fps)
 	return ret;
 }
 
-const STSSegment* CSimpleTextSubtitle::SearchSubs(int t, double fps, /*[out]*/ int* iSegment, int* nSegments)
+std::shared_ptr<const STSSegmentIndex> CSimpleTextSubtitle::GetSegmentIndex(double fps)
 {
-	int i = 0, j = (int)m_segments.GetCount() - 1, ret = -1;
-
-	if (nSegments) {
-		*nSegments = j+1;
-	}
+	std::shared_ptr<const STSSegmentIndex> pIndex = std::atomic_load(&m_pSegmentIndex);
 
-	// last segment
-	if (j >= 0 && t >= TranslateSegmentStart(j, fps) && t < TranslateSegmentEnd(j, fps)) {
-		if (iSegment) {
-			*iSegment = j;
+	if (!pIndex || pIndex->starts.size() != m_segments.GetCount() || (m_mode == FRAME && pIndex->fps != fps)) {
+		auto pNewIndex = std::make_shared<STSSegmentIndex>();
+		pNewIndex->fps = fps;
+		pNewIndex->starts.resize(m_segments.GetCount());
+		pNewIndex->ends.resize(m_segments.GetCount());
+		for (int i = 0, n = (int)m_segments.GetCount(); i < n; i++) {
+			pNewIndex->starts[i] = TranslateSegmentStart(i, fps);
+			pNewIndex->ends[i] = TranslateSegmentEnd(i, fps);
 		}
-		return &m_segments[j];
+
+		m_nSegmentIndexBuilds++;
+
+		pIndex = std::move(pNewIndex);
+		std::atomic_store(&m_pSegmentIndex, pIndex);
 	}
 
-	// after last segment
-	if (j >= 0 && t >= TranslateSegmentEnd(j, fps)) {
-		if (iSegment) {
-			*iSegment = j+1;
-		}
-		return NULL;
+	return pIndex;
+}
+
+void CSimpleTextSubtitle::InvalidateSegmentIndex()
+{
+	std::atomic_store(&m_pSegmentIndex, std::shared_ptr<const STSSegmentIndex>());
+}
+
+const STSSegment* CSimpleTextSubtitle::SearchSubs(int t, double fps, /*[out]*/ int* iSegment, int* nSegments, STSSearchCursor* pCursor)
+{
+	const int n = (int)m_segments.GetCount();
+
+	if (nSegments) {
+		*nSegments = n;
 	}
 
-	// before first segment
-	if (j > 0 && t < TranslateSegmentStart(i, fps)) {
-		if (iSegment) {
-			*iSegment = -1;
-		}
+	if (n == 0) {
 		return NULL;
 	}
 
-	while (i < j) {
-		int mid = (i + j) >> 1;
+	m_nSearches++;
 
-		int midt = TranslateSegmentStart(mid, fps);
+	const std::shared_ptr<const STSSegmentIndex> pIndex = GetSegmentIndex(fps);
+	const int* starts = pIndex->starts.data();
+	const int* ends = pIndex->ends.data();
 
-		if (t == midt) {
-			ret = mid;
-			break;
-		} else if (t < midt) {
-			ret = -1;
-			if (j == mid) {
-				mid--;
-			}
-			j = mid;
-		} else if (t > midt) {
-			ret = mid;
-			if (i == mid) {
-				mid++;
-			}
-			i = mid;
+	// i is the last segment starting at or before t, -1 before the first segment and n after the last one
+	auto IsSegmentOf = [&](int i) {
+		return i < 0 ? t < starts[0]
+			   : i >= n ? t >= ends[n - 1]
+			   : starts[i] <= t && t < (i + 1 < n ? starts[i + 1] : ends[n - 1]);
+	};
+
+	int i = pCursor ? pCursor->segment.load(std::memory_order_relaxed) : INT_MIN;
+
+	if (i >= -1 && i <= n && IsSegmentOf(i)) {
+		m_nSearchCursorHits++;
+	} else if (i >= -1 && i < n && IsSegmentOf(i + 1)) {
+		m_nSearchCursorHits++;
+		i++;
+	} else {
+		i = int(std::upper_bound(starts, starts + n, t) - starts) - 1;
+		if (i == n - 1 && t >= ends[n - 1]) {
+			i = n;
 		}
 	}
 
-	if (0 <= ret && (size_t)ret < m_segments.GetCount()) {
-		if (iSegment) {
-			*iSegment = ret;
-		}
+	if (pCursor) {
+		pCursor->segment.store(i, std::memory_order_relaxed);
 	}
 
-	if (0 <= ret && (size_t)ret < m_segments.GetCount()
-			&& !m_segments[ret].subs.IsEmpty()
-			&& TranslateSegmentStart(ret, fps) <= t && t < TranslateSegmentEnd(ret, fps)) {
-		return &m_segments[ret];
+	if (iSegment) {
+		*iSegment = i;
+	}
+
+	if (0 <= i && i < n && t < ends[i] && (i == n - 1 || !m_segments[i].subs.IsEmpty())) {
+		return &m_segments[i];
 	}
 
 	return NULL;
@@ -2842,6 +2874,19 @@ static int BreakpointComp(const void* e1, const void* e2)
 	return (bp1->t - bp2->t);
 }
 
+void CSimpleTextSubtitle::BeginBulkLoad()
+{
+	m_bBulkLoad = true;
+}
+
+void CSimpleTextSubtitle::EndBulkLoad()
+{
+	if (m_bBulkLoad) {
+		m_bBulkLoad = false;
+		CreateSegments();
+	}
+}
+
 void CSimpleTextSubtitle::CreateSegments()
 {
 	m_segments.RemoveAll();
@@ -2850,8 +2895,11 @@ void CSimpleTextSubtitle::CreateSegments()
 
 	for (size_t i = 0; i < GetCount(); i++) {
 		STSEntry& stse = GetAt(i);
-		breakpoints.Add(Breakpoint(stse.start, true));
-		breakpoints.Add(Breakpoint(stse.end, false));
+		// entries with a null duration don't split segments, see Add()
+		if (stse.start < stse.end) {
+			breakpoints.Add(Breakpoint(stse.start, true));
+			breakpoints.Add(Breakpoint(stse.end, false));
+		}
 	}
 
 	qsort(breakpoints.GetData(), breakpoints.GetCount(), sizeof(Breakpoint), BreakpointComp);
@@ -2864,13 +2912,23 @@ void CSimpleTextSubtitle::CreateSegments()
 		}
 	}
 
+	// visit the entries by readorder so the subs of every segment end up sorted like Add() keeps them
+	CAtlArray<int> entries;
+	entries.SetCount(GetCount());
+	for (size_t i = 0; i < GetCount(); i++) {
+		entries[i] = int(i);
+	}
+	std::stable_sort(entries.GetData(), entries.GetData() + entries.GetCount(), [this](int a, int b) {
+		return GetAt(a).readorder < GetAt(b).readorder;
+	});
+
 	STSSegment* segmentsStart = m_segments.GetData();
 	STSSegment* segmentsEnd   = segmentsStart + m_segments.GetCount();
-	for (size_t i = 0; i < GetCount(); i++) {
-		const STSEntry& stse = GetAt(i);
+	for (size_t i = 0; i < entries.GetCount(); i++) {
+		const STSEntry& stse = GetAt(entries[i]);
 		STSSegment* segment = std::lower_bound(segmentsStart, segmentsEnd, stse.start, SegmentCompStart);
 		for (size_t j = segment - segmentsStart; j < m_segments.GetCount() && m_segments[j].end <= stse.end; j++) {
-			m_segments[j].subs.Add(int(i));
+			m_segments[j].subs.Add(entries[i]);
 		}
 	}
 
@@ -2922,6 +2980,8 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, int CharSet, CString name)
 
 	ULONGLONG pos = f->GetPosition();
 
+	BeginBulkLoad();
+
 	for (const auto& OpenFunct : s_OpenFuncts) {
 		if (!OpenFunct.open(f, *this, CharSet)) {
 			if (!IsEmpty()) {
@@ -2945,7 +3005,8 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, int CharSet, CString name)
 		m_encoding     = f->GetEncoding();
 		m_path         = f->GetFilePath();
 
-		// No need to call Sort() or CreateSegments(), everything is done on the fly
+		// No need to call Sort(), only the segments were left for the end
+		EndBulkLoad();
 
 		CWebTextFile f2(CTextFile::UTF8);
 		if (f2.Open(f->GetFilePath() + L".style")) {
@@ -2965,6 +3026,8 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, int CharSet, CString name)
 		return true;
 	}
 
+	m_bBulkLoad = false;
+
 	f->Close();
 	return false;
 }
@@ -21,6 +21,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <vector>
 #include <atlcoll.h>
 #include <BaseClasses/wxutil.h>
 #include "TextFile.h"
@@ -141,13 +144,34 @@ public:
 	}
 };
 
+// Segment times already translated to ms for one fps, laid out for the SearchSubs() lookups.
+struct STSSegmentIndex {
+	double fps = 0.0;
+	std::vector<int> starts, ends;
+};
+
+// Where the last SearchSubs() of one consumer ended. During sequential playback the next
+// lookup is answered from here without a binary search. It is only a hint, so sharing is safe.
+struct STSSearchCursor {
+	std::atomic<int> segment{-1};
+};
+
 class CSimpleTextSubtitle : public CAtlArray<STSEntry>
 {
 	friend class CSubtitleEditorDlg;
 
+	std::shared_ptr<const STSSegmentIndex> m_pSegmentIndex;
+	std::atomic<size_t> m_nSearches{0}, m_nSearchCursorHits{0}, m_nSegmentIndexBuilds{0};
+
+	std::shared_ptr<const STSSegmentIndex> GetSegmentIndex(double fps);
+	void InvalidateSegmentIndex();
+
 protected:
 	CAtlArray<STSSegment> m_segments;
-	virtual void OnChanged() {}
+	bool m_bBulkLoad = false;
+	virtual void OnChanged();
+	// Add() split or extended the segments, the entries are unchanged
+	virtual void OnSegmentsChanged();
 
 public:
 	CString m_name;
@@ -188,6 +212,11 @@ public:
 	void Sort(bool fRestoreReadorder = false);
 	void CreateSegments();
 
+	// Between these Add() only appends the entries, the segments are built at once at the end.
+	// Used when a whole file is parsed, streamed subtitles keep updating them on every Add().
+	void BeginBulkLoad();
+	void EndBulkLoad();
+
 	void Append(CSimpleTextSubtitle& sts, int timeoff = -1);
 
 	bool Open(CString fn, int CharSet, CString name = L"", CString videoName = L"");
@@ -213,11 +242,22 @@ public:
 
 	int TranslateSegmentStart(int i, double fps);
 	int TranslateSegmentEnd(int i, double fps);
-	const STSSegment* SearchSubs(int t, double fps, /*[out]*/ int* iSegment = NULL, int* nSegments = NULL);
+	const STSSegment* SearchSubs(int t, double fps, /*[out]*/ int* iSegment = NULL, int* nSegments = NULL, STSSearchCursor* pCursor = NULL);
 	const STSSegment* GetSegment(int iSegment) {
 		return iSegment >= 0 && iSegment < (int)m_segments.GetCount() ? &m_segments[iSegment] : NULL;
 	}
 
+	// SearchSubs() calls, the ones a cursor answered and the rebuilds of the segment index
+	size_t GetSearchCount() const {
+		return m_nSearches;
+	}
+	size_t GetSearchCursorHitCount() const {
+		return m_nSearchCursorHits;
+	}
+	size_t GetSegmentIndexBuildCount() const {
+		return m_nSegmentIndexBuilds;
+	}
+
 	STSStyle* GetStyle(int i);
 	bool GetStyle(int i, STSStyle& stss);
 	bool GetStyle(CString styleName, STSStyle& stss);
@@ -329,6 +329,138 @@ void SeparableFilterY_SSE2(unsigned char* src, unsigned char* dst, int width, in
 	_aligned_free(tmp);
 }
 
+// Horizontal [1 2 1] sums of the inner pixels of a row
+static __forceinline void BeFilterX(const unsigned char* in, unsigned short* out, int width, bool bUseAVX2)
+{
+	int x = 1;
+	if (bUseAVX2) {
+		for (; x + 16 <= width - 1; x += 16) {
+			__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x - 1]));
+			__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x]));
+			__m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x + 1]));
+			_mm256_storeu_si256((__m256i*)&out[x], _mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1)));
+		}
+	}
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= width - 1; x += 8) {
+		__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)&in[x - 1]), zero);
+		__m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)&in[x]), zero);
+		__m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)&in[x + 1]), zero);
+		_mm_storeu_si128((__m128i*)&out[x], _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1)));
+	}
+	for (; x < width - 1; x++) {
+		out[x] = in[x - 1] + (in[x] << 1) + in[x + 1];
+	}
+}
+
+// Vertical [1 2 1] sum of three rows of horizontal sums, divided by 16
+static __forceinline void BeFilterY(const unsigned short* h0, const unsigned short* h1, const unsigned short* h2,
+									unsigned char* out, int width, bool bUseAVX2)
+{
+	int x = 1;
+	if (bUseAVX2) {
+		for (; x + 16 <= width - 1; x += 16) {
+			__m256i a = _mm256_loadu_si256((__m256i*)&h0[x]);
+			__m256i b = _mm256_loadu_si256((__m256i*)&h1[x]);
+			__m256i c = _mm256_loadu_si256((__m256i*)&h2[x]);
+			__m256i v = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1)), 4);
+			_mm_storeu_si128((__m128i*)&out[x], _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+		}
+	}
+	for (; x + 8 <= width - 1; x += 8) {
+		__m128i a = _mm_loadu_si128((__m128i*)&h0[x]);
+		__m128i b = _mm_loadu_si128((__m128i*)&h1[x]);
+		__m128i c = _mm_loadu_si128((__m128i*)&h2[x]);
+		__m128i v = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1)), 4);
+		_mm_storel_epi64((__m128i*)&out[x], _mm_packus_epi16(v, v));
+	}
+	for (; x < width - 1; x++) {
+		out[x] = (unsigned char)((h0[x] + (h1[x] << 1) + h2[x]) >> 4);
+	}
+}
+
+// One \be pass: the 3x3 [1 2 1] box blur done in place as two separable passes.
+// The outermost rows and columns are left as they are. The horizontal sums of the
+// previous, current and next rows are kept in tmp (3 * stride shorts, reused between
+// passes), so every row is read once and still gives the exact result of the 3x3 kernel.
+void BeFilter(unsigned char* buffer, int width, int height, ptrdiff_t stride, unsigned short* tmp, bool bUseAVX2)
+{
+	if (width < 3 || height < 3) {
+		return;
+	}
+
+	unsigned short* h[3] = {tmp, tmp + stride, tmp + 2 * stride};
+
+	BeFilterX(buffer, h[0], width, bUseAVX2);
+	BeFilterX(buffer + stride, h[1], width, bUseAVX2);
+
+	for (int y = 1; y < height - 1; y++) {
+		// the next row is still unchanged, the current one was already summed
+		BeFilterX(buffer + (y + 1) * stride, h[2], width, bUseAVX2);
+		BeFilterY(h[0], h[1], h[2], buffer + y * stride, width, bUseAVX2);
+
+		unsigned short* prev = h[0];
+		h[0] = h[1];
+		h[1] = h[2];
+		h[2] = prev;
+	}
+}
+
+#ifdef _DEBUG
+// The 3x3 loop BeFilter() replaced, see CheckBeFilter()
+static void BeFilter_C(unsigned char* buffer, int width, int height, ptrdiff_t stride)
+{
+	if (width < 3 || height < 3) {
+		return;
+	}
+
+	std::vector<unsigned char> tmp(buffer, buffer + stride * height);
+
+	for (ptrdiff_t j = 1; j < height - 1; j++) {
+		const unsigned char* src = tmp.data() + stride * j + 1;
+		unsigned char* dst = buffer + stride * j + 1;
+
+		for (ptrdiff_t i = 1; i < width - 1; i++, src++, dst++) {
+			*dst = (src[-1 - stride] + (src[-stride] << 1) + src[+1 - stride]
+					+ (src[-1] << 1) + (src[0] << 2) + (src[+1] << 1)
+					+ src[-1 + stride] + (src[+stride] << 1) + src[+1 + stride]) >> 4;
+		}
+	}
+}
+
+// Compares up to three BeFilter() passes with the loop on random overlays. The widths
+// are not multiples of the vector sizes, so the C tails of the kernels run too.
+static bool CheckBeFilter(bool bHaveAVX2)
+{
+	unsigned int seed = 1;
+
+	for (int width = 3; width <= 75; width += 4) {
+		for (int height = 3; height <= 9; height += 3) {
+			const ptrdiff_t stride = (width + 31) & ~31;
+			std::vector<unsigned char> overlay(stride * height);
+			for (auto& b : overlay) {
+				seed = seed * 1103515245 + 12345;
+				b = (unsigned char)(seed >> 16);
+			}
+			std::vector<unsigned short> tmp(3 * stride);
+
+			for (int avx2 = 0; avx2 <= (bHaveAVX2 ? 1 : 0); avx2++) {
+				std::vector<unsigned char> a = overlay, b = overlay;
+				for (int pass = 0; pass < 3; pass++) {
+					BeFilter(a.data(), width, height, stride, tmp.data(), !!avx2);
+					BeFilter_C(b.data(), width, height, stride);
+					if (a != b) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+#endif
+
 static inline double NormalDist(double sigma, double x)
 {
 	if (sigma <= 0.0 && x == 0.0) {
@@ -368,3 +500,185 @@ struct GaussianKernel {
 		delete [] kernel;
 	}
 };
+
+// Gaussian blur approximated by two stacked box blurs whose total variance matches
+// the one of GaussianKernel, so the cost per pixel does not depend on the radius.
+// Edges are zero padded like SeparableFilterX/Y. Intermediate values keep 6 fractional bits.
+// On coverage overlays (0..64) the result differs from the kernel by at most 8 (sigma 1, where
+// the boxes are coarsest), at most 5 above it and by less than 1 on average for sigma 0.5 to 50.
+// Below sigma 1 the boxes are empty and the kernel is used. The boxes cost about the same for
+// every sigma and break even with the kernel around a kernel width of 15 (sigma 5).
+// More passes get closer to a true gaussian but further from GaussianKernel, which is cut at 1.5 sigma.
+struct BoxBlurKernel {
+	enum { PASSES = 2 };
+	int radius[PASSES];
+
+	inline BoxBlurKernel(const GaussianKernel& kernel) {
+		// variance of the discrete kernel, it is truncated so it is smaller than sigma^2
+		double variance = 0.0;
+		for (int i = 0; i < kernel.width; i++) {
+			double d = i - kernel.width / 2;
+			variance += kernel.kernel[i] * d * d;
+		}
+		variance /= kernel.divisor;
+
+		// a box of width w has a variance of (w*w-1)/12, use m boxes of wl and the rest of wl+2
+		int wl = (int)sqrt(12.0 * variance / PASSES + 1.0);
+		if (!(wl & 1)) {
+			wl--;
+		}
+		int m = (int)floor((12.0 * variance - PASSES * wl * wl - 4.0 * PASSES * wl - 3.0 * PASSES) / (-4.0 * wl - 4.0) + 0.5);
+		m = std::max(0, std::min<int>(m, PASSES));
+		for (int i = 0; i < PASSES; i++) {
+			radius[i] = ((i < m ? wl : wl + 2) - 1) / 2;
+		}
+	}
+
+	inline bool IsEmpty() const {
+		for (int i = 0; i < PASSES; i++) {
+			if (radius[i] > 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+static void BoxBlurRow(const unsigned short* in, unsigned short* out, int width, int radius)
+{
+	const float scale = 1.0f / (2 * radius + 1);
+	unsigned int sum = 0;
+
+	for (int x = 0; x < radius && x < width; x++) {
+		sum += in[x];
+	}
+	for (int x = 0; x < width; x++) {
+		if (x + radius < width) {
+			sum += in[x + radius];
+		}
+		out[x] = (unsigned short)(sum * scale + 0.5f);
+		if (x - radius >= 0) {
+			sum -= in[x - radius];
+		}
+	}
+}
+
+// One vertical box pass, sum holds the running column sums. Every column rounds like BoxBlurRow(),
+// x + 0.5 truncated, so the result does not depend on which code path a column went through.
+static void BoxBlurColumns(const unsigned short* src, unsigned short* dst, unsigned int* sum, int width, int height, ptrdiff_t stride, int radius, bool bUseAVX2)
+{
+	const float scale = 1.0f / (2 * radius + 1);
+
+	ZeroMemory(sum, stride * sizeof(unsigned int));
+	for (int y = 0; y < radius && y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			sum[x] += src[y * stride + x];
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		const unsigned short* add = (y + radius < height) ? src + (y + radius) * stride : NULL;
+		const unsigned short* sub = (y - radius >= 0) ? src + (y - radius) * stride : NULL;
+		unsigned short* out = dst + y * stride;
+
+		int x = 0;
+		if (bUseAVX2) {
+			const __m256 scale8 = _mm256_set1_ps(scale);
+			const __m256 half8 = _mm256_set1_ps(0.5f);
+			for (; x + 8 <= width; x += 8) {
+				__m256i s = _mm256_loadu_si256((__m256i*)&sum[x]);
+				if (add) {
+					s = _mm256_add_epi32(s, _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)&add[x])));
+				}
+				__m256i v = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(s), scale8), half8));
+				_mm_storeu_si128((__m128i*)&out[x], _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+				if (sub) {
+					s = _mm256_sub_epi32(s, _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)&sub[x])));
+				}
+				_mm256_storeu_si256((__m256i*)&sum[x], s);
+			}
+		}
+		const __m128 scale4 = _mm_set1_ps(scale);
+		const __m128 half4 = _mm_set1_ps(0.5f);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 8 <= width; x += 8) {
+			__m128i s0 = _mm_loadu_si128((__m128i*)&sum[x]);
+			__m128i s1 = _mm_loadu_si128((__m128i*)&sum[x + 4]);
+			if (add) {
+				__m128i a = _mm_loadu_si128((__m128i*)&add[x]);
+				s0 = _mm_add_epi32(s0, _mm_unpacklo_epi16(a, zero));
+				s1 = _mm_add_epi32(s1, _mm_unpackhi_epi16(a, zero));
+			}
+			__m128i v0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(s0), scale4), half4));
+			__m128i v1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(s1), scale4), half4));
+			_mm_storeu_si128((__m128i*)&out[x], _mm_packs_epi32(v0, v1));
+			if (sub) {
+				__m128i b = _mm_loadu_si128((__m128i*)&sub[x]);
+				s0 = _mm_sub_epi32(s0, _mm_unpacklo_epi16(b, zero));
+				s1 = _mm_sub_epi32(s1, _mm_unpackhi_epi16(b, zero));
+			}
+			_mm_storeu_si128((__m128i*)&sum[x], s0);
+			_mm_storeu_si128((__m128i*)&sum[x + 4], s1);
+		}
+		for (; x < width; x++) {
+			if (add) {
+				sum[x] += add[x];
+			}
+			out[x] = (unsigned short)(sum[x] * scale + 0.5f);
+			if (sub) {
+				sum[x] -= sub[x];
+			}
+		}
+	}
+}
+
+// Blurs buffer in place, returns false when out of memory
+bool BoxBlur(unsigned char* buffer, int width, int height, ptrdiff_t stride, const BoxBlurKernel& kernel, bool bUseAVX2)
+{
+	const size_t size = stride * height;
+	unsigned short* tmp = (unsigned short*)_aligned_malloc((size * 2 + stride * 2) * sizeof(unsigned short) + stride * sizeof(unsigned int), 32);
+	if (!tmp) {
+		return false;
+	}
+	unsigned short* tmp2 = tmp + size;
+	unsigned short* row = tmp2 + size;
+	unsigned short* row2 = row + stride;
+	unsigned int* sum = (unsigned int*)(row2 + stride);
+
+	for (int y = 0; y < height; y++) {
+		const unsigned char* in = buffer + y * stride;
+		unsigned short* a = row;
+		unsigned short* b = row2;
+		for (int x = 0; x < width; x++) {
+			a[x] = in[x] << 6;
+		}
+		for (int i = 0; i < BoxBlurKernel::PASSES; i++) {
+			if (kernel.radius[i] > 0) {
+				BoxBlurRow(a, b, width, kernel.radius[i]);
+				std::swap(a, b);
+			}
+		}
+		memcpy(tmp + y * stride, a, width * sizeof(unsigned short));
+	}
+
+	unsigned short* a = tmp;
+	unsigned short* b = tmp2;
+	for (int i = 0; i < BoxBlurKernel::PASSES; i++) {
+		if (kernel.radius[i] > 0) {
+			BoxBlurColumns(a, b, sum, width, height, stride, kernel.radius[i], bUseAVX2);
+			std::swap(a, b);
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		const unsigned short* in = a + y * stride;
+		unsigned char* out = buffer + y * stride;
+		for (int x = 0; x < width; x++) {
+			out[x] = (unsigned char)std::min((in[x] + 32) >> 6, 255);
+		}
+	}
+
+	_aligned_free(tmp);
+
+	return true;
+}
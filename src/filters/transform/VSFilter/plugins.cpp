@@ -19,8 +19,13 @@
  *
  */
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "stdafx.h"
 #include <afxdlgs.h>
@@ -56,10 +61,16 @@ namespace Plugin
 		CComPtr<ISubPicQueue> m_pSubPicQueue;
 		CComPtr<ISubPicProvider> m_pSubPicProvider;
 		DWORD_PTR m_SubPicProviderId;
+		int m_yuvMatrix;
+		bool m_fYUVFullRange;
+		std::atomic<unsigned> m_nReloads;
 
 	public:
-		CFilter() : m_fps(-1), m_SubPicProviderId(0) {
-			CAMThread::Create();
+		// without fWatchFile the subtitles are only reloaded by calling Reload()
+		CFilter(bool fWatchFile = true) : m_fps(-1), m_SubPicProviderId(0), m_yuvMatrix(MSP_BT601), m_fYUVFullRange(false), m_nReloads(0) {
+			if (fWatchFile) {
+				CAMThread::Create();
+			}
 		}
 		virtual ~CFilter() {
 			CAMThread::CallWorker(0);
@@ -74,6 +85,17 @@ namespace Plugin
 			m_fn = fn;
 		}
 
+		// matrix and range of the yuv frames passed to Render(), see CMemSubPicAllocator::SetYUVMatrix()
+		void SetYUVMatrix(int matrix, bool fFullRange) {
+			if (matrix != m_yuvMatrix || fFullRange != m_fYUVFullRange) {
+				m_yuvMatrix = matrix;
+				m_fYUVFullRange = fFullRange;
+				// the queued subpictures were converted with the old one
+				m_pSubPicQueue = nullptr;
+				m_SubPicProviderId = 0;
+			}
+		}
+
 		bool Render(SubPicDesc& dst, REFERENCE_TIME rt, float fps) {
 			if (!m_pSubPicProvider) {
 				return false;
@@ -82,7 +104,9 @@ namespace Plugin
 			CSize size(dst.w, dst.h);
 
 			if (!m_pSubPicQueue) {
-				CComPtr<ISubPicAllocator> pAllocator = DNew CMemSubPicAllocator(dst.type, size);
+				CMemSubPicAllocator* pMemSubPicAllocator = DNew CMemSubPicAllocator(dst.type, size);
+				pMemSubPicAllocator->SetYUVMatrix(m_yuvMatrix, m_fYUVFullRange);
+				CComPtr<ISubPicAllocator> pAllocator = pMemSubPicAllocator;
 
 				HRESULT hr;
 				if (!(m_pSubPicQueue = DNew CSubPicQueueNoThread(false, pAllocator, &hr)) || FAILED(hr)) {
@@ -110,9 +134,31 @@ namespace Plugin
 
 			pSubPic->AlphaBlt(r, r, &dst);
 
+			OnRendered(rt, fps);
+
 			return true;
 		}
 
+		// called after every frame Render() drew
+		virtual void OnRendered(REFERENCE_TIME rt, float fps) {}
+
+		// statistics of the rendering caches, false if the subtitles have none
+		virtual bool GetCacheStats(CRenderingCacheStats stats[RenderingCaches::COUNT]) {
+			return false;
+		}
+
+		// how many times the subtitles were reloaded from the file
+		unsigned GetReloadCount() const {
+			return m_nReloads;
+		}
+		void Reload(unsigned nReloads) {
+			if (CComQIPtr<ISubStream> pSubStream = m_pSubPicProvider) {
+				CAutoLock cAutoLock(&m_csSubLock);
+				pSubStream->Reload();
+			}
+			m_nReloads = nReloads;
+		}
+
 		DWORD ThreadProc() {
 			SetThreadPriority(m_hThread, THREAD_PRIORITY_LOWEST);
 
@@ -138,11 +184,7 @@ namespace Plugin
 
 						if (fs.m_mtime < fs2.m_mtime) {
 							fs.m_mtime = fs2.m_mtime;
-
-							if (CComQIPtr<ISubStream> pSubStream = m_pSubPicProvider) {
-								CAutoLock cAutoLock(&m_csSubLock);
-								pSubStream->Reload();
-							}
+							Reload(m_nReloads + 1);
 						}
 					}
 				} else if (WAIT_TIMEOUT == i) {
@@ -199,10 +241,176 @@ namespace Plugin
 		}
 	};
 
+	// the values of the TextSub rasterizer option
+	static bool ParseRasterizerType(const char* str, Rasterizer::RasterizerType& type)
+	{
+		if (!_stricmp(str, "tiles")) {
+			type = Rasterizer::RASTERIZER_TILES;
+		} else if (!_stricmp(str, "spans")) {
+			type = Rasterizer::RASTERIZER_SPANS;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// the values of the TextSub blur option
+	static bool ParseGaussianBlurType(const char* str, Rasterizer::GaussianBlurType& type)
+	{
+		if (!_stricmp(str, "kernel")) {
+			type = Rasterizer::GAUSSIAN_BLUR_KERNEL;
+		} else if (!_stricmp(str, "boxes")) {
+			type = Rasterizer::GAUSSIAN_BLUR_BOXES;
+		} else if (!_stricmp(str, "auto")) {
+			type = Rasterizer::GAUSSIAN_BLUR_AUTO;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// the values of the TextSub border option
+	static bool ParseBorderType(const char* str, Rasterizer::BorderType& type)
+	{
+		if (!_stricmp(str, "auto")) {
+			type = Rasterizer::BORDER_AUTO;
+		} else if (!_stricmp(str, "ellipse")) {
+			type = Rasterizer::BORDER_ELLIPSE;
+		} else if (!_stricmp(str, "distance")) {
+			type = Rasterizer::BORDER_DISTANCE;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
 	class CTextSubFilter : virtual public CFilter
 	{
 		int m_CharSet;
 
+		// background warm-up of the next m_rtWarmup of subtitles, see SetWarmup()
+		REFERENCE_TIME m_rtWarmup = 0;
+		int m_nWarmupThreads = 1;
+		std::thread m_warmupThread;
+		std::mutex m_mutexWarmup;
+		std::condition_variable m_condWarmup;
+		REFERENCE_TIME m_rtWarmupRequest = -1;
+		float m_warmupFps = 0;
+		bool m_bWarmupExit = false;
+
+		// the other m_nWarmupThreads - 1 threads render their part of every chunk, see WarmupHelperProc()
+		std::vector<std::thread> m_warmupHelpers;
+		std::condition_variable m_condChunk;
+		std::condition_variable m_condChunkDone;
+		CComPtr<ISubPicProvider> m_pChunkProvider;
+		REFERENCE_TIME m_rtChunkFrom = 0, m_rtChunkTo = 0;
+		float m_chunkFps = 0;
+		unsigned m_nChunk = 0;
+		int m_nChunkPending = 0;
+
+		// see SetCacheBudget()
+		size_t m_cacheBudget = 0;
+
+		// see SetSubpixelPhases()
+		int m_nSubpixelPhases = 8;
+
+		// see SetRasterizerType()
+		Rasterizer::RasterizerType m_rasterizerType = Rasterizer::RASTERIZER_TILES;
+
+		// see SetGaussianBlurType()
+		Rasterizer::GaussianBlurType m_gaussianBlurType = Rasterizer::GAUSSIAN_BLUR_KERNEL;
+
+		// see SetBorderType()
+		Rasterizer::BorderType m_borderType = Rasterizer::BORDER_AUTO;
+
+		void WarmupThreadProc() {
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+			REFERENCE_TIME rtWarmedFrom = 0, rtWarmedTo = 0;
+			std::vector<BYTE> bits;
+
+			std::unique_lock<std::mutex> lock(m_mutexWarmup);
+			for (;;) {
+				m_condWarmup.wait(lock, [this] { return m_bWarmupExit || m_rtWarmupRequest >= 0; });
+				if (m_bWarmupExit) {
+					break;
+				}
+
+				const REFERENCE_TIME rt = m_rtWarmupRequest;
+				const float fps = m_warmupFps;
+				m_rtWarmupRequest = -1;
+
+				// continue where the last window ended unless the frame is outside of it (seek)
+				if (rt < rtWarmedFrom || rt > rtWarmedTo) {
+					rtWarmedFrom = rtWarmedTo = rt;
+				}
+
+				// one second at a time, so a new request or a seek is picked up quickly
+				while (rtWarmedTo < rt + m_rtWarmup && !m_bWarmupExit && m_rtWarmupRequest < 0) {
+					const REFERENCE_TIME rtFrom = rtWarmedTo;
+					const REFERENCE_TIME rtTo = std::min(rtFrom + 10000000i64, rt + m_rtWarmup);
+					lock.unlock();
+
+					// not held across the chunk, Warmup() takes the subtitle lock for one frame at a time
+					CComPtr<ISubPicProvider> pSubPicProvider;
+					{
+						CAutoLock cAutoLock(&m_csSubLock);
+						pSubPicProvider = m_pSubPicProvider;
+					}
+
+					lock.lock();
+					if (pSubPicProvider) {
+						m_pChunkProvider = pSubPicProvider;
+						m_rtChunkFrom = rtFrom;
+						m_rtChunkTo = rtTo;
+						m_chunkFps = fps;
+						m_nChunkPending = (int)m_warmupHelpers.size();
+						m_nChunk++;
+						m_condChunk.notify_all();
+						lock.unlock();
+
+						static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)pSubPicProvider)->Warmup(rtFrom, rtTo, fps, 0, m_nWarmupThreads, bits);
+
+						lock.lock();
+						m_condChunkDone.wait(lock, [this] { return m_bWarmupExit || m_nChunkPending == 0; });
+						m_pChunkProvider.Release();
+					}
+					rtWarmedTo = rtTo;
+				}
+			}
+		}
+
+		// Renders part iPart of every chunk WarmupThreadProc() hands out, with a surface kept across chunks
+		void WarmupHelperProc(int iPart) {
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+			std::vector<BYTE> bits;
+			unsigned nChunk = 0;
+
+			std::unique_lock<std::mutex> lock(m_mutexWarmup);
+			for (;;) {
+				m_condChunk.wait(lock, [this, &nChunk] { return m_bWarmupExit || m_nChunk != nChunk; });
+				if (m_bWarmupExit) {
+					break;
+				}
+
+				nChunk = m_nChunk;
+				CComPtr<ISubPicProvider> pSubPicProvider = m_pChunkProvider;
+				const REFERENCE_TIME rtFrom = m_rtChunkFrom;
+				const REFERENCE_TIME rtTo = m_rtChunkTo;
+				const float fps = m_chunkFps;
+				lock.unlock();
+
+				static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)pSubPicProvider)->Warmup(rtFrom, rtTo, fps, iPart, m_nWarmupThreads, bits);
+				pSubPicProvider.Release();
+
+				lock.lock();
+				if (--m_nChunkPending == 0) {
+					m_condChunkDone.notify_one();
+				}
+			}
+		}
+
 	public:
 		CTextSubFilter(CString fn = L"", int CharSet = DEFAULT_CHARSET, float fps = -1)
 			: m_CharSet(CharSet) {
@@ -211,6 +419,99 @@ namespace Plugin
 				Open(fn, CharSet);
 			}
 		}
+		virtual ~CTextSubFilter() {
+			if (m_warmupThread.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutexWarmup);
+					m_bWarmupExit = true;
+				}
+				m_condWarmup.notify_one();
+				m_condChunk.notify_all();
+				m_condChunkDone.notify_one();
+				m_warmupThread.join();
+				for (auto& helper : m_warmupHelpers) {
+					helper.join();
+				}
+			}
+		}
+
+		// Renders the subtitles of the next 'seconds' on a background thread after every frame,
+		// so events are parsed and rasterized before they are shown. 0 turns it off.
+		void SetWarmup(float seconds, int nThreads) {
+			if (seconds > 0 && !m_warmupThread.joinable()) {
+				m_rtWarmup = REFERENCE_TIME(seconds * 10000000.0);
+				m_nWarmupThreads = std::max(nThreads, 1);
+				for (int i = 1; i < m_nWarmupThreads; i++) {
+					m_warmupHelpers.emplace_back(&CTextSubFilter::WarmupHelperProc, this, i);
+				}
+				m_warmupThread = std::thread(&CTextSubFilter::WarmupThreadProc, this);
+			}
+		}
+
+		void OnRendered(REFERENCE_TIME rt, float fps) override {
+			if (m_warmupThread.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutexWarmup);
+					m_rtWarmupRequest = rt;
+					m_warmupFps = fps;
+				}
+				m_condWarmup.notify_one();
+			}
+		}
+
+		// Limits the memory held by all the rendering caches of the subtitle together, 0 is no limit.
+		void SetCacheBudget(size_t nBytes) {
+			CAutoLock cAutoLock(&m_csSubLock);
+			m_cacheBudget = nBytes;
+			if (m_pSubPicProvider) {
+				static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)m_pSubPicProvider)->SetCacheBudget(m_cacheBudget);
+			}
+		}
+
+		// Snaps the words to 1, 2, 4 or 8 (default) subpixel positions per pixel, see CRenderedTextSubtitle::SetSubpixelPhases().
+		void SetSubpixelPhases(int nPhases) {
+			CAutoLock cAutoLock(&m_csSubLock);
+			m_nSubpixelPhases = nPhases;
+			if (m_pSubPicProvider) {
+				static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)m_pSubPicProvider)->SetSubpixelPhases(m_nSubpixelPhases);
+			}
+		}
+
+		// Picks how the words are turned into coverage, see CRenderedTextSubtitle::SetRasterizerType().
+		void SetRasterizerType(Rasterizer::RasterizerType type) {
+			CAutoLock cAutoLock(&m_csSubLock);
+			m_rasterizerType = type;
+			if (m_pSubPicProvider) {
+				static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)m_pSubPicProvider)->SetRasterizerType(m_rasterizerType);
+			}
+		}
+
+		// Picks how \blur is computed, see CRenderedTextSubtitle::SetGaussianBlurType().
+		void SetGaussianBlurType(Rasterizer::GaussianBlurType type) {
+			CAutoLock cAutoLock(&m_csSubLock);
+			m_gaussianBlurType = type;
+			if (m_pSubPicProvider) {
+				static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)m_pSubPicProvider)->SetGaussianBlurType(m_gaussianBlurType);
+			}
+		}
+
+		// Picks how the outlines are grown into borders, see CRenderedTextSubtitle::SetBorderType().
+		void SetBorderType(Rasterizer::BorderType type) {
+			CAutoLock cAutoLock(&m_csSubLock);
+			m_borderType = type;
+			if (m_pSubPicProvider) {
+				static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)m_pSubPicProvider)->SetBorderType(m_borderType);
+			}
+		}
+
+		bool GetCacheStats(CRenderingCacheStats stats[RenderingCaches::COUNT]) override {
+			CAutoLock cAutoLock(&m_csSubLock);
+			if (!m_pSubPicProvider) {
+				return false;
+			}
+			static_cast<CRenderedTextSubtitle*>((ISubPicProvider*)m_pSubPicProvider)->GetCacheStats(stats);
+			return true;
+		}
 
 		int GetCharSet() {
 			return(m_CharSet);
@@ -224,6 +525,11 @@ namespace Plugin
 				if (CRenderedTextSubtitle* rts = DNew CRenderedTextSubtitle(&m_csSubLock)) {
 					m_pSubPicProvider = (ISubPicProvider*)rts;
 					if (rts->Open(CString(fn), CharSet)) {
+						rts->SetCacheBudget(m_cacheBudget);
+						rts->SetSubpixelPhases(m_nSubpixelPhases);
+						rts->SetRasterizerType(m_rasterizerType);
+						rts->SetGaussianBlurType(m_gaussianBlurType);
+						rts->SetBorderType(m_borderType);
 						SetFileName(fn);
 					} else {
 						m_pSubPicProvider = nullptr;
@@ -965,12 +1271,63 @@ namespace Plugin
 
 		class CTextSubAvisynthFilter : public CTextSubFilter, public CAvisynthFilter
 		{
+			// names of the VSFilter_<cache>_<stat> globals set after every frame, empty unless requested
+			std::vector<const char*> m_cacheStatsVars;
+
 		public:
-			CTextSubAvisynthFilter(PClip c, IScriptEnvironment* env, const char* fn, int CharSet = DEFAULT_CHARSET, float fps = -1, VFRTranslator *vfr = 0) //vfr patch
+			CTextSubAvisynthFilter(PClip c, IScriptEnvironment* env, const char* fn, int CharSet = DEFAULT_CHARSET, float fps = -1, VFRTranslator *vfr = 0, float warmup = 0, int cacheBudget = 0, bool bCacheStats = false, int subpixelPhases = 8, const char* rasterizer = "tiles", const char* blur = "kernel", const char* border = "auto") //vfr patch
 				: CTextSubFilter(CString(fn), CharSet, fps)
 				, CAvisynthFilter(c, env, vfr) {
 				if (!m_pSubPicProvider)
 					env->ThrowError("TextSub: Can't open \"%s\"", fn);
+				if (cacheBudget < 0)
+					env->ThrowError("TextSub: cachebudget must not be negative");
+				SetCacheBudget(size_t(cacheBudget) << 20);
+				if (subpixelPhases != 1 && subpixelPhases != 2 && subpixelPhases != 4 && subpixelPhases != 8)
+					env->ThrowError("TextSub: subpixelphases must be 1, 2, 4 or 8");
+				SetSubpixelPhases(subpixelPhases);
+				Rasterizer::RasterizerType rasterizerType;
+				if (!ParseRasterizerType(rasterizer, rasterizerType))
+					env->ThrowError("TextSub: rasterizer must be tiles or spans");
+				SetRasterizerType(rasterizerType);
+				Rasterizer::GaussianBlurType gaussianBlurType;
+				if (!ParseGaussianBlurType(blur, gaussianBlurType))
+					env->ThrowError("TextSub: blur must be kernel, boxes or auto");
+				SetGaussianBlurType(gaussianBlurType);
+				Rasterizer::BorderType borderType;
+				if (!ParseBorderType(border, borderType))
+					env->ThrowError("TextSub: border must be auto, ellipse or distance");
+				SetBorderType(borderType);
+				SetWarmup(warmup, std::thread::hardware_concurrency());
+
+				if (bCacheStats) {
+					static const char* stats[] = { "hits", "misses", "evictions", "entries", "kbytes" };
+					for (int i = 0; i < RenderingCaches::COUNT; i++) {
+						for (const char* stat : stats) {
+							CStringA name;
+							name.Format("VSFilter_%S_%s", RenderingCaches::GetName(i), stat);
+							m_cacheStatsVars.push_back(env->SaveString(name));
+						}
+					}
+				}
+			}
+
+			PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) {
+				PVideoFrame frame = CAvisynthFilter::GetFrame(n, env);
+
+				CRenderingCacheStats stats[RenderingCaches::COUNT];
+				if (!m_cacheStatsVars.empty() && GetCacheStats(stats)) {
+					auto var = m_cacheStatsVars.cbegin();
+					for (const auto& cs : stats) {
+						env->SetGlobalVar(*var++, int(cs.nHits));
+						env->SetGlobalVar(*var++, int(cs.nMisses));
+						env->SetGlobalVar(*var++, int(cs.nEvictions));
+						env->SetGlobalVar(*var++, int(cs.nEntries));
+						env->SetGlobalVar(*var++, int(cs.nBytes >> 10));
+					}
+				}
+
+				return(frame);
 			}
 		};
 
@@ -989,7 +1346,14 @@ namespace Plugin
 					   args[1].AsString(),
 					   args[2].AsInt(DEFAULT_CHARSET),
 					   args[3].AsFloat(-1),
-					   vfr));
+					   vfr,
+					   (float)args[5].AsFloat(0),
+					   args[6].AsInt(0),
+					   args[7].AsBool(false),
+					   args[8].AsInt(8),
+					   args[9].AsString("tiles"),
+					   args[10].AsString("kernel"),
+					   args[11].AsString("auto")));
 		}
 
 		AVSValue __cdecl TextSubSwapUV(AVSValue args, void* user_data, IScriptEnvironment* env)
@@ -1042,14 +1406,14 @@ namespace Plugin
 		{
 #ifdef _VSMOD
 			env->AddFunction("VobSub", "cs", VobSubCreateS, 0);
-			env->AddFunction("TextSubMod", "c[file]s[charset]i[fps]f[vfr]s", TextSubCreateGeneral, 0);
+			env->AddFunction("TextSubMod", "c[file]s[charset]i[fps]f[vfr]s[warmup]f[cachebudget]i[cachestats]b[subpixelphases]i[rasterizer]s[blur]s[border]s", TextSubCreateGeneral, 0);
 			env->AddFunction("TextSubSwapUVMod", "b", TextSubSwapUV, 0);
 			env->AddFunction("MaskSubMod", "[file]s[width]i[height]i[fps]f[length]i[charset]i[vfr]s", MaskSubCreate, 0);
 			env->SetVar(env->SaveString("RGBA"), false);
 			return(nullptr);
 #else
 			env->AddFunction("VobSub", "cs", VobSubCreateS, 0);
-			env->AddFunction("TextSub", "c[file]s[charset]i[fps]f[vfr]s", TextSubCreateGeneral, 0);
+			env->AddFunction("TextSub", "c[file]s[charset]i[fps]f[vfr]s[warmup]f[cachebudget]i[cachestats]b[subpixelphases]i[rasterizer]s[blur]s[border]s", TextSubCreateGeneral, 0);
 			env->AddFunction("TextSubSwapUV", "b", TextSubSwapUV, 0);
 			env->AddFunction("MaskSub", "[file]s[width]i[height]i[fps]f[length]i[charset]i[vfr]s", MaskSubCreate, 0);
 			env->SetVar(env->SaveString("RGBA"),false);
@@ -1068,14 +1432,21 @@ namespace Plugin
 
         class CTextSubVapourSynthFilter : public CTextSubFilter {
         public:
-            CTextSubVapourSynthFilter(const wchar_t * file, const int charset, const float fps, int * error) : CTextSubFilter(CString(file), charset, fps) {
+            CTextSubVapourSynthFilter(const wchar_t * file, const int charset, const float fps, const bool watchFile, const float warmup, const size_t cacheBudget, const int subpixelPhases, const Rasterizer::RasterizerType rasterizerType, const Rasterizer::GaussianBlurType gaussianBlurType, const Rasterizer::BorderType borderType, int * error) : CFilter(watchFile), CTextSubFilter(CString(file), charset, fps) {
                 *error = !m_pSubPicProvider ? 1 : 0;
+                SetCacheBudget(cacheBudget);
+                SetSubpixelPhases(subpixelPhases);
+                SetRasterizerType(rasterizerType);
+                SetGaussianBlurType(gaussianBlurType);
+                SetBorderType(borderType);
+                // only one instance of the pool gets a warm-up, see createRenderer()
+                SetWarmup(warmup, 1);
             }
         };
 
         class CVobSubVapourSynthFilter : public CVobSubFilter {
         public:
-            CVobSubVapourSynthFilter(const wchar_t * file, int * error) : CVobSubFilter(CString(file)) {
+            CVobSubVapourSynthFilter(const wchar_t * file, const bool watchFile, int * error) : CFilter(watchFile), CVobSubFilter(CString(file)) {
                 *error = !m_pSubPicProvider ? 1 : 0;
             }
         };
@@ -1085,11 +1456,94 @@ namespace Plugin
             const VSVideoInfo * vi;
             float fps;
             VFRTranslator * vfr;
-            std::unique_ptr<CTextSubVapourSynthFilter> textsub;
-            std::unique_ptr<CVobSubVapourSynthFilter> vobsub;
-            VSFrameRef * buffer;
+
+            // what is needed to load another renderer instance on demand
+            bool textsub;
+            std::wstring file;
+            int charset;
+            float subFps;
+            float warmup;
+            size_t cacheBudget;
+            int subpixelPhases;
+            Rasterizer::RasterizerType rasterizerType;
+            Rasterizer::GaussianBlurType gaussianBlurType;
+            Rasterizer::BorderType borderType;
+
+            // attach the VSFilterCache* statistics of the renderer to every frame
+            bool cacheStats;
+
+            // every renderer renders one frame at a time, up to 'threads' of them are loaded from the same script
+            int threads;
+            int instances;
+            std::vector<std::unique_ptr<CFilter>> renderers;
+            // the first instance, the only one watching the file
+            CFilter * watcher;
+            std::vector<CFilter *> idle;
+            std::mutex mutex;
+            std::condition_variable cond;
         };
 
+        // The instances of the pool share nothing, each would warm the same window ahead into caches of
+        // its own with threads * a full cache set. Only the first instance gets the warm-up, and only it
+        // watches the file, the others reload when they are acquired after it did, see syncRenderer().
+        // The cache budget is for the whole script, every instance gets its share of it, taken under d->mutex.
+        static std::unique_ptr<CFilter> createRenderer(const VSFilterData * d, bool first, size_t cacheBudget) {
+            int err{};
+            std::unique_ptr<CFilter> renderer;
+
+            if (d->textsub)
+                renderer = std::make_unique<CTextSubVapourSynthFilter>(d->file.c_str(), d->charset, d->subFps, first, first ? d->warmup : 0.0f, cacheBudget, d->subpixelPhases, d->rasterizerType, d->gaussianBlurType, d->borderType, &err);
+            else
+                renderer = std::make_unique<CVobSubVapourSynthFilter>(d->file.c_str(), first, &err);
+
+            if (err)
+                renderer.reset();
+            return renderer;
+        }
+
+        static CFilter * acquireRenderer(VSFilterData * d) {
+            std::unique_lock<std::mutex> lock(d->mutex);
+
+            while (d->idle.empty()) {
+                if (d->instances < d->threads) {
+                    d->instances++;
+                    const size_t cacheBudget = d->cacheBudget / d->threads;
+                    lock.unlock();
+                    std::unique_ptr<CFilter> renderer = createRenderer(d, false, cacheBudget);
+                    lock.lock();
+
+                    if (renderer) {
+                        d->renderers.push_back(std::move(renderer));
+                        return d->renderers.back().get();
+                    }
+
+                    // the script can't be loaded again, make do with the instances we already have
+                    d->threads = --d->instances;
+                } else {
+                    d->cond.wait(lock);
+                }
+            }
+
+            CFilter * renderer = d->idle.back();
+            d->idle.pop_back();
+            return renderer;
+        }
+
+        // catch up with the reloads of the watcher, the renderer is acquired so nothing else uses it
+        static void syncRenderer(const VSFilterData * d, CFilter * renderer) {
+            const unsigned reloads = d->watcher->GetReloadCount();
+            if (renderer->GetReloadCount() != reloads)
+                renderer->Reload(reloads);
+        }
+
+        static void releaseRenderer(VSFilterData * d, CFilter * renderer) {
+            {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                d->idle.push_back(renderer);
+            }
+            d->cond.notify_one();
+        }
+
         static inline __m128i _MM_PACKUS_EPI32(const __m128i & low, const __m128i & high) noexcept {
             const __m128i val_32 = _mm_set1_epi32(0x8000);
             const __m128i val_16 = _mm_set1_epi16(0x8000);
@@ -1104,7 +1558,7 @@ namespace Plugin
         }
 
         static const VSFrameRef * VS_CC vsfilterGetFrame(int n, int activationReason, void ** instanceData, void ** frameData, VSFrameContext * frameCtx, VSCore * core, const VSAPI * vsapi) {
-            const VSFilterData * d = static_cast<const VSFilterData *>(*instanceData);
+            VSFilterData * d = static_cast<VSFilterData *>(*instanceData);
 
             if (activationReason == arInitial) {
                 vsapi->requestFrameFilter(n, d->node, frameCtx);
@@ -1112,6 +1566,7 @@ namespace Plugin
                 const VSFrameRef * src = vsapi->getFrameFilter(n, d->node, frameCtx);
                 VSFrameRef * dst = vsapi->copyFrame(src, core);
                 VSFrameRef * bgr = nullptr;
+                VSFrameRef * buffer = nullptr;
 
                 SubPicDesc subpic;
                 subpic.w = d->vi->width;
@@ -1126,17 +1581,19 @@ namespace Plugin
                     subpic.bpp = 8;
                     subpic.type = MSP_YV12;
                 } else if (d->vi->format->id == pfYUV420P16) {
+                    buffer = vsapi->newVideoFrame(vsapi->getFormatPreset(pfGray16, core), d->vi->width, d->vi->height + d->vi->height / 2, nullptr, core);
+
                     const int uvWidth = vsapi->getFrameWidth(src, 1);
                     const int uvWidthMod8 = uvWidth / 8 * 8;
                     const int uvStride = vsapi->getStride(src, 1) / sizeof(uint16_t);
-                    const int bufStride = vsapi->getStride(d->buffer, 0);
+                    const int bufStride = vsapi->getStride(buffer, 0);
                     const uint16_t * srcpY = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(src, 0));
                     const uint16_t * srcpU = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(src, 1));
                     const uint16_t * srcpV = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(src, 2));
-                    uint8_t * VS_RESTRICT buffer = vsapi->getWritePtr(d->buffer, 0);
+                    uint8_t * VS_RESTRICT bufp = vsapi->getWritePtr(buffer, 0);
 
-                    vs_bitblt(buffer, bufStride, srcpY, vsapi->getStride(src, 0), d->vi->width * sizeof(uint16_t), d->vi->height);
-                    buffer += bufStride * d->vi->height;
+                    vs_bitblt(bufp, bufStride, srcpY, vsapi->getStride(src, 0), d->vi->width * sizeof(uint16_t), d->vi->height);
+                    bufp += bufStride * d->vi->height;
 
                     for (int y = 0; y < vsapi->getFrameHeight(src, 1); y++) {
                         for (int x = 0; x < uvWidthMod8; x += 8) {
@@ -1144,22 +1601,22 @@ namespace Plugin
                             const __m128i v = _mm_load_si128(reinterpret_cast<const __m128i *>(srcpV + x));
 
                             const __m128i uvLow = _mm_unpacklo_epi16(u, v);
-                            _mm_stream_si128(reinterpret_cast<__m128i *>(reinterpret_cast<uint32_t *>(buffer) + x), uvLow);
+                            _mm_stream_si128(reinterpret_cast<__m128i *>(reinterpret_cast<uint32_t *>(bufp) + x), uvLow);
 
                             const __m128i uvHigh = _mm_unpackhi_epi16(u, v);
-                            _mm_stream_si128(reinterpret_cast<__m128i *>(reinterpret_cast<uint32_t *>(buffer) + x + 4), uvHigh);
+                            _mm_stream_si128(reinterpret_cast<__m128i *>(reinterpret_cast<uint32_t *>(bufp) + x + 4), uvHigh);
                         }
 
                         for (int x = uvWidthMod8; x < uvWidth; x++)
-                            reinterpret_cast<uint32_t *>(buffer)[x] = (srcpV[x] << 16) | srcpU[x];
+                            reinterpret_cast<uint32_t *>(bufp)[x] = (srcpV[x] << 16) | srcpU[x];
 
                         srcpU += uvStride;
                         srcpV += uvStride;
-                        buffer += bufStride;
+                        bufp += bufStride;
                     }
 
                     subpic.pitch = bufStride;
-                    subpic.bits = vsapi->getWritePtr(d->buffer, 0);
+                    subpic.bits = vsapi->getWritePtr(buffer, 0);
                     subpic.bpp = 16;
                     subpic.type = MSP_P016;
                 } else {
@@ -1200,29 +1657,54 @@ namespace Plugin
                 else
                     timestamp = static_cast<REFERENCE_TIME>(10000000 * d->vfr->TimeStampFromFrameNumber(n));
 
-                if (d->textsub)
-                    d->textsub->Render(subpic, timestamp, d->fps);
-                else
-                    d->vobsub->Render(subpic, timestamp, d->fps);
+                CFilter * renderer = acquireRenderer(d);
+                syncRenderer(d, renderer);
+                if (subpic.type != MSP_RGB32) {
+                    // _Matrix 1 is BT.709, 9 and 10 BT.2020, anything else is rendered as BT.601
+                    const VSMap * srcProps = vsapi->getFramePropsRO(src);
+                    int err{};
+                    const int64_t matrix = vsapi->propGetInt(srcProps, "_Matrix", 0, &err);
+                    int errRange{};
+                    const int64_t range = vsapi->propGetInt(srcProps, "_ColorRange", 0, &errRange);
+                    renderer->SetYUVMatrix(matrix == 1 ? MSP_BT709 : (matrix == 9 || matrix == 10) ? MSP_BT2020 : MSP_BT601, !errRange && range == 0);
+                }
+                renderer->Render(subpic, timestamp, d->fps);
+                CRenderingCacheStats stats[RenderingCaches::COUNT];
+                const bool hasStats = d->cacheStats && renderer->GetCacheStats(stats);
+                releaseRenderer(d, renderer);
+
+                if (hasStats) {
+                    // one entry per cache, named by VSFilterCacheNames
+                    VSMap * props = vsapi->getFramePropsRW(dst);
+                    for (int i = 0; i < RenderingCaches::COUNT; i++) {
+                        const CStringA name(RenderingCaches::GetName(i));
+                        vsapi->propSetData(props, "VSFilterCacheNames", name, name.GetLength(), paAppend);
+                        vsapi->propSetInt(props, "VSFilterCacheHits", stats[i].nHits, paAppend);
+                        vsapi->propSetInt(props, "VSFilterCacheMisses", stats[i].nMisses, paAppend);
+                        vsapi->propSetInt(props, "VSFilterCacheEvictions", stats[i].nEvictions, paAppend);
+                        vsapi->propSetInt(props, "VSFilterCacheEntries", stats[i].nEntries, paAppend);
+                        vsapi->propSetInt(props, "VSFilterCacheBytes", stats[i].nBytes, paAppend);
+                    }
+                }
 
                 if (d->vi->format->id == pfYUV420P16) {
                     const int uvWidth = vsapi->getFrameWidth(dst, 1);
                     const int uvWidthMod8 = uvWidth / 8 * 8;
-                    const int bufStride = vsapi->getStride(d->buffer, 0);
+                    const int bufStride = vsapi->getStride(buffer, 0);
                     const int uvStride = vsapi->getStride(dst, 1) / sizeof(uint16_t);
-                    const uint8_t * buffer = vsapi->getWritePtr(d->buffer, 0);
+                    const uint8_t * bufp = vsapi->getReadPtr(buffer, 0);
                     uint16_t * VS_RESTRICT dstpY = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(dst, 0));
                     uint16_t * VS_RESTRICT dstpU = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(dst, 1));
                     uint16_t * VS_RESTRICT dstpV = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(dst, 2));
 
-                    vs_bitblt(dstpY, vsapi->getStride(dst, 0), buffer, bufStride, d->vi->width * sizeof(uint16_t), d->vi->height);
-                    buffer += bufStride * d->vi->height;
+                    vs_bitblt(dstpY, vsapi->getStride(dst, 0), bufp, bufStride, d->vi->width * sizeof(uint16_t), d->vi->height);
+                    bufp += bufStride * d->vi->height;
 
                     const __m128i mask = _mm_set1_epi32(0x0000FFFF);
                     for (int y = 0; y < vsapi->getFrameHeight(dst, 1); y++) {
                         for (int x = 0; x < uvWidthMod8; x += 8) {
-                            const __m128i uvLow = _mm_load_si128(reinterpret_cast<const __m128i *>(reinterpret_cast<const uint32_t *>(buffer) + x));
-                            const __m128i uvHigh = _mm_load_si128(reinterpret_cast<const __m128i *>(reinterpret_cast<const uint32_t *>(buffer) + x + 4));
+                            const __m128i uvLow = _mm_load_si128(reinterpret_cast<const __m128i *>(reinterpret_cast<const uint32_t *>(bufp) + x));
+                            const __m128i uvHigh = _mm_load_si128(reinterpret_cast<const __m128i *>(reinterpret_cast<const uint32_t *>(bufp) + x + 4));
 
                             const __m128i uLow = _mm_and_si128(uvLow, mask);
                             const __m128i uHigh = _mm_and_si128(uvHigh, mask);
@@ -1236,12 +1718,12 @@ namespace Plugin
                         }
 
                         for (int x = uvWidthMod8; x < uvWidth; x++) {
-                            const uint32_t uv = reinterpret_cast<const uint32_t *>(buffer)[x];
+                            const uint32_t uv = reinterpret_cast<const uint32_t *>(bufp)[x];
                             dstpU[x] = uv & 0xFFFF;
                             dstpV[x] = uv >> 16;
                         }
 
-                        buffer += bufStride;
+                        bufp += bufStride;
                         dstpU += uvStride;
                         dstpV += uvStride;
                     }
@@ -1271,6 +1753,7 @@ namespace Plugin
 
                 vsapi->freeFrame(src);
                 vsapi->freeFrame(bgr);
+                vsapi->freeFrame(buffer);
                 return dst;
             }
 
@@ -1280,7 +1763,6 @@ namespace Plugin
         static void VS_CC vsfilterFree(void * instanceData, VSCore * core, const VSAPI * vsapi) {
             VSFilterData * d = static_cast<VSFilterData *>(instanceData);
             vsapi->freeNode(d->node);
-            vsapi->freeFrame(d->buffer);
             delete d;
         }
 
@@ -1318,26 +1800,76 @@ namespace Plugin
                 if (!d->vi->fpsNum && fps <= 0.0f && !d->vfr)
                     throw std::string{ "variable framerate clip must have fps or vfr specified" };
 
+                d->warmup = static_cast<float>(vsapi->propGetFloat(in, "warmup", 0, &err));
+                if (err)
+                    d->warmup = 0.0f;
+                else if (d->warmup < 0.0f)
+                    throw std::string{ "warmup must not be negative" };
+
+                const int64_t cacheBudget = vsapi->propGetInt(in, "cachebudget", 0, &err);
+                if (err)
+                    d->cacheBudget = 0;
+                else if (cacheBudget < 0)
+                    throw std::string{ "cachebudget must not be negative" };
+                else
+                    d->cacheBudget = static_cast<size_t>(cacheBudget) << 20;
+
+                d->subpixelPhases = int64ToIntS(vsapi->propGetInt(in, "subpixelphases", 0, &err));
+                if (err)
+                    d->subpixelPhases = 8;
+                else if (d->subpixelPhases != 1 && d->subpixelPhases != 2 && d->subpixelPhases != 4 && d->subpixelPhases != 8)
+                    throw std::string{ "subpixelphases must be 1, 2, 4 or 8" };
+
+                const char * rasterizer = vsapi->propGetData(in, "rasterizer", 0, &err);
+                if (err)
+                    d->rasterizerType = Rasterizer::RASTERIZER_TILES;
+                else if (!ParseRasterizerType(rasterizer, d->rasterizerType))
+                    throw std::string{ "rasterizer must be tiles or spans" };
+
+                const char * blur = vsapi->propGetData(in, "blur", 0, &err);
+                if (err)
+                    d->gaussianBlurType = Rasterizer::GAUSSIAN_BLUR_KERNEL;
+                else if (!ParseGaussianBlurType(blur, d->gaussianBlurType))
+                    throw std::string{ "blur must be kernel, boxes or auto" };
+
+                const char * border = vsapi->propGetData(in, "border", 0, &err);
+                if (err)
+                    d->borderType = Rasterizer::BORDER_AUTO;
+                else if (!ParseBorderType(border, d->borderType))
+                    throw std::string{ "border must be auto, ellipse or distance" };
+
+                d->cacheStats = !!vsapi->propGetInt(in, "cachestats", 0, &err);
+
+                d->threads = int64ToIntS(vsapi->propGetInt(in, "threads", 0, &err));
+                if (err)
+                    d->threads = vsapi->getCoreInfo(core)->numThreads;
+                else if (d->threads < 1)
+                    throw std::string{ "threads must be at least 1" };
+
 #ifdef _VSMOD
-				if (filterName == "TextSubMod")
+				d->textsub = filterName == "TextSubMod";
 #else
-				if (filterName == "TextSub")
+				d->textsub = filterName == "TextSub";
 #endif
-                    d->textsub = std::make_unique<CTextSubVapourSynthFilter>(file.get(), charset, fps, &err);
-                else
-                    d->vobsub = std::make_unique<CVobSubVapourSynthFilter>(file.get(), &err);
-                if (err)
-                    throw std::string{ "can't open " } + _file;
+                d->file = file.get();
+                d->charset = charset;
+                d->subFps = fps;
 
-                if (d->vi->format->id == pfYUV420P16)
-                    d->buffer = vsapi->newVideoFrame(vsapi->getFormatPreset(pfGray16, core), d->vi->width, d->vi->height + d->vi->height / 2, nullptr, core);
+                // load the first instance right away so a broken script is reported here, the others are loaded on demand
+                std::unique_ptr<CFilter> renderer = createRenderer(d.get(), true, d->cacheBudget / d->threads);
+                if (!renderer)
+                    throw std::string{ "can't open " } + _file;
+                d->watcher = renderer.get();
+                d->idle.push_back(renderer.get());
+                d->renderers.push_back(std::move(renderer));
+                d->instances = 1;
             } catch (const std::string & error) {
                 vsapi->setError(out, (filterName + ": " + error).c_str());
                 vsapi->freeNode(d->node);
                 return;
             }
 
-            vsapi->createFilter(in, out, static_cast<const char *>(userData), vsfilterInit, vsfilterGetFrame, vsfilterFree, fmParallelRequests, 0, d.release(), core);
+            vsapi->createFilter(in, out, static_cast<const char *>(userData), vsfilterInit, vsfilterGetFrame, vsfilterFree, fmParallel, 0, d.release(), core);
         }
 
         //////////////////////////////////////////
@@ -1352,12 +1884,21 @@ namespace Plugin
 				"file:data;"
 				"charset:int:opt;"
 				"fps:float:opt;"
-				"vfr:data:opt;",
+				"vfr:data:opt;"
+				"threads:int:opt;"
+				"warmup:float:opt;"
+				"cachebudget:int:opt;"
+				"cachestats:int:opt;"
+				"subpixelphases:int:opt;"
+				"rasterizer:data:opt;"
+				"blur:data:opt;"
+				"border:data:opt;",
 				vsfilterCreate, const_cast<char*>("TextSubMod"), plugin);
 
 			registerFunc("VobSub",
 				"clip:clip;"
-				"file:data;",
+				"file:data;"
+				"threads:int:opt;",
 				vsfilterCreate, const_cast<char*>("VobSub"), plugin);
 #else
             configFunc("com.holywu.vsfilter", "vsf", "VSFilter", VAPOURSYNTH_API_VERSION, 1, plugin);
@@ -1367,12 +1908,21 @@ namespace Plugin
                          "file:data;"
                          "charset:int:opt;"
                          "fps:float:opt;"
-                         "vfr:data:opt;",
+                         "vfr:data:opt;"
+                         "threads:int:opt;"
+                         "warmup:float:opt;"
+                         "cachebudget:int:opt;"
+                         "cachestats:int:opt;"
+                         "subpixelphases:int:opt;"
+                         "rasterizer:data:opt;"
+                         "blur:data:opt;"
+                         "border:data:opt;",
                          vsfilterCreate, const_cast<char *>("TextSub"), plugin);
             
             registerFunc("VobSub",
                          "clip:clip;"
-                         "file:data;",
+                         "file:data;"
+                         "threads:int:opt;",
                          vsfilterCreate, const_cast<char *>("VobSub"), plugin);
 #endif
         }